@@ -0,0 +1,50 @@
+project "lua"
+	kind "StaticLib"
+	language "C"
+    staticruntime "on"
+
+	targetdir ("bin/" .. outputdir .. "/%{prj.name}")
+	objdir ("bin-int/" .. outputdir .. "/%{prj.name}")
+
+	files
+	{
+		"lua/*.h",
+		"lua/*.c",
+	}
+
+	--Stand-alone interpreter, compiler, single file build and test library of the lua repository
+	removefiles
+	{
+		"lua/lua.c",
+		"lua/luac.c",
+		"lua/onelua.c",
+		"lua/ltests.c",
+		"lua/ltests.h",
+	}
+
+	includedirs
+	{
+		"lua"
+	}
+
+	defines
+	{
+		"_CRT_SECURE_NO_WARNINGS"
+	}
+	
+	filter "system:windows"
+		systemversion "latest"
+		staticruntime "On"
+
+	filter "configurations:Debug"
+		runtime "Debug"
+		symbols "on"
+
+	filter "configurations:Release"
+		runtime "Release"
+		optimize "on"
+
+    filter "configurations:Dist"
+		runtime "Release"
+		optimize "on"
+        symbols "off"
\ No newline at end of file
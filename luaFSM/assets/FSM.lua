@@ -32,6 +32,19 @@ FSM = {
     ---@type string
     initialStateId = nil,
 
+    ---Metatable shared by the instances of this FSM, see FSM:newInstance
+    ---@type table
+    instanceMeta = nil,
+
+    ---Most state changes one onUpdate call follows before it leaves the rest for the next call,
+    ---this bounds the work of a tick even when conditions keep firing in a loop
+    ---@type integer
+    maxTransitionsPerUpdate = 32,
+
+    ---Blackboard predicates shared by the conditions, see FSM:query
+    ---@type table<string, fun(instance: FSM): any>
+    predicates = nil,
+
 } FSM.__index = FSM
 
 ------------------------------------------------
@@ -85,7 +98,7 @@ function FSM:registerState(state)
     --Create a new FSM_STATE object
     self.states[state.id] = FSM_STATE:new(state)
     self.states[state.id].FSM = self
-    FSM_LOG:log("registering state " .. state.id, FSM_LOG.logLevel.TRACE)
+    if FSM_LOG.traceOn then FSM_LOG:log("registering state " .. state.id, FSM_LOG.logLevel.TRACE) end
 end
 
 function FSM:setInitialState(stateId)
@@ -95,58 +108,355 @@ function FSM:setInitialState(stateId)
         FSM_LOG:log("State " .. stateId .. " not found") 
         return 
     end
+    self:stopTimers()
+    self:closeStateCoroutine()
+    if FSM_TRACE.enabled then FSM_TRACE:record(self, self.currentState, state) end
     self.initialState = state
     self.currentState = state
-    FSM_LOG:log("Set initial state " .. state.id, FSM_LOG.logLevel.TRACE)
-    self.initialState:onEnter()
+    if FSM_LOG.traceOn then FSM_LOG:log("Set initial state " .. state.id, FSM_LOG.logLevel.TRACE) end
+    local started = FSM_PROFILER.enabled and FSM_PROFILER.clock()
+    self.initialState:onEnter(self)
+    if started then FSM_PROFILER:addState(state, FSM_PROFILER.ENTER, started) end
+    self:startTimers(state)
+end
+
+---Metatable shared by the instances of this FSM, created on first use
+---@return table
+function FSM:getInstanceMeta()
+    local meta = rawget(self, "instanceMeta")
+    if not meta then
+        meta = { __index = self }
+        self.instanceMeta = meta
+    end
+    return meta
+end
+
+---Create a lightweight instance of this FSM.
+---The instance only holds its current state and the context, everything else
+---(states, sorted conditions and their functions) is read from this FSM through
+---a shared metatable, so creating one costs a single small table.
+---The instance is passed to every state and condition function as their first argument.
+---Call activate on the FSM before creating instances of it.
+---@param context? any Per instance data, for example the agent that runs the machine
+---@return FSM instance
+function FSM:newInstance(context)
+    local meta = self:getInstanceMeta()
+    --currentState is set to false so lookups never fall through to this FSM's own state
+    local instance = setmetatable({ currentState = false, context = context }, meta)
+    instance:setInitialState(self.initialStateId)
+    return instance
 end
 
 ------------------------------------------------
 --FSM flow
 ------------------------------------------------
 
----Update the FSM
+---States visited by the running onUpdate call, reused so the chain costs no allocations
+local transitionPath = {}
+
+---Log the states an onUpdate call went through when it hit maxTransitionsPerUpdate
+---@param fsm FSM
+---@param pathLength integer
+local function logTransitionLimit(fsm, pathLength)
+    local last = transitionPath[pathLength]
+    local cycleStart = nil
+    for i = pathLength - 1, 1, -1 do
+        if transitionPath[i] == last then
+            cycleStart = i
+            break
+        end
+    end
+    local ids = {}
+    for i = cycleStart or 1, pathLength do
+        ids[#ids + 1] = transitionPath[i].id
+    end
+    local kind = cycleStart and "Transition cycle in " or "Transition limit reached in "
+    FSM_LOG:log(kind .. tostring(fsm.id) .. ": " .. table.concat(ids, " -> "), FSM_LOG.logLevel.WARNING)
+end
+
+---Update the FSM.
+---When a condition changes the state, the new state is updated in the same call,
+---up to maxTransitionsPerUpdate state changes.
 ---@param ... unknown Variable arguments
 function FSM:onUpdate(...)
+    local state = self.currentState
+    if not state then return end
+    self:invalidateBlackboard()
+
+    local maxTransitions = self.maxTransitionsPerUpdate
+    transitionPath[1] = state
+    for transitions = 1, maxTransitions do
+        if FSM_LOG.traceOn then FSM_LOG:log("onUpdate: " .. state.id, FSM_LOG.logLevel.TRACE) end
+
+        --Fire the onUpdate function of the current state, with variable arguments
+        local started = FSM_PROFILER.enabled and FSM_PROFILER.clock()
+        if state.isCoroutine then
+            self:resumeStateCoroutine(state, ...)
+        else
+            state:onUpdate(self, ...)
+        end
+        if started then FSM_PROFILER:addState(state, FSM_PROFILER.UPDATE, started) end
 
-    if not self.currentState then return end
-    
-    FSM_LOG:log("onUpdate: " .. self.currentState.id, FSM_LOG.logLevel.TRACE)
-
-    local oldId = self.currentState.id
+        --onUpdate may have changed the state itself
+        local current = self.currentState
+        if current.isExitState then
+            self:setInitialState(self.initialStateId)
+            return
+        end
 
-    --Fire the onUpdate function of the current state, with variable arguments
-    self.currentState:onUpdate(...)
+        --Evaluate the triggers of the current state
+        current:evaluateConditions(self)
 
-    if self.currentState.isExitState then
-        self:setInitialState(self.initialStateId)
-        return
+        local newState = self.currentState
+        if newState == state then
+            return
+        end
+        state = newState
+        transitionPath[transitions + 1] = state
     end
 
-    --Evaluate the triggers of the current state
-    self.currentState:evaluateConditions()
+    --The last state change is kept, its state is updated on the next call
+    logTransitionLimit(self, maxTransitions + 1)
+end
 
-    if oldId ~= self.currentState.id then
-        self:onUpdate(...)
+---Evaluate the conditions of the current state that are subscribed to an event.
+---Use events for conditions that depend on rare game events, so they cost nothing on regular updates.
+---Stops at the first condition that changes the state, the new state is updated on the next onUpdate.
+---@param event string
+---@param ... unknown Passed on to the condition and action functions
+---@return boolean changed True when the state changed
+function FSM:dispatch(event, ...)
+    local state = self.currentState
+    if not state then return false end
+    local subscribed = state.eventLinks and state.eventLinks[event]
+    if not subscribed then return false end
+    self:invalidateBlackboard()
+    if FSM_LOG.traceOn then FSM_LOG:log("dispatch " .. event .. ": " .. state.id, FSM_LOG.logLevel.TRACE) end
+    for i = 1, #subscribed do
+        local condition = subscribed[i]
+        if condition:evaluate(self, ...) then
+            condition:action(self, ...)
+            local nextState = condition:getNextState()
+            if nextState then
+                self:changeState(nextState, condition)
+                return true
+            end
+        end
     end
+    return false
 end
 
 ---Change the state of the FSM
 ---@param newState FSM_STATE
-function FSM:changeState(newState)
+---@param condition? FSM_CONDITION Condition that caused the change, recorded by FSM_TRACE
+function FSM:changeState(newState, condition)
 
-    FSM_LOG:log("Changed State to " .. newState.id, FSM_LOG.logLevel.TRACE)
+    if FSM_LOG.traceOn then FSM_LOG:log("Changed State to " .. newState.id, FSM_LOG.logLevel.TRACE) end
+    if FSM_TRACE.enabled then FSM_TRACE:record(self, self.currentState, newState, condition) end
 
     --Fire the onExit function of the current state
-    if self.currentState then
-        self.currentState:onExit()
+    local oldState = self.currentState
+    if oldState then
+        self:stopTimers()
+        self:closeStateCoroutine()
+        local started = FSM_PROFILER.enabled and FSM_PROFILER.clock()
+        oldState:onExit(self)
+        if started then FSM_PROFILER:addState(oldState, FSM_PROFILER.EXIT, started) end
     end
 
     --Set the new state as the current state
     self.currentState = newState
 
     --Fire the onEnter function of the new state
-    self.currentState:onEnter()
+    local started = FSM_PROFILER.enabled and FSM_PROFILER.clock()
+    newState:onEnter(self)
+    if started then FSM_PROFILER:addState(newState, FSM_PROFILER.ENTER, started) end
+    self:startTimers(newState)
+end
+
+------------------------------------------------
+--Blackboard
+------------------------------------------------
+
+---Counter of evaluation passes over all machines, so a pass of one instance never matches another one
+local blackboardTick = 0
+
+---Start a new evaluation pass of this FSM or instance, the next query of every predicate computes it again.
+---onUpdate, dispatch and timed conditions start one themselves. Call it when the world changed during a pass,
+---for example when onUpdate moved the agent and the conditions checked after it have to see the move.
+function FSM:invalidateBlackboard()
+    blackboardTick = blackboardTick + 1
+    self.blackboardTick = blackboardTick
+end
+
+---Value of a blackboard predicate for the running pass.
+---The predicate is computed the first time a state or condition asks for it, later queries of the same
+---instance get the cached value until the next onUpdate, dispatch or timed condition, so conditions
+---sharing an expensive query (line of sight, distance checks) only pay for it once per tick.
+---@param name string Key of the predicate in predicates
+---@return any value
+function FSM:query(name)
+    local stamps = rawget(self, "blackboardStamps")
+    if not stamps then
+        stamps = {}
+        self.blackboardStamps = stamps
+        self.blackboard = {}
+    end
+    local tick = rawget(self, "blackboardTick")
+    if tick and stamps[name] == tick then
+        return self.blackboard[name]
+    end
+    local predicate = self.predicates and self.predicates[name]
+    if not predicate then
+        FSM_LOG:log("Predicate " .. tostring(name) .. " not found in " .. tostring(self.id), FSM_LOG.logLevel.WARNING)
+        return nil
+    end
+    local value = predicate(self)
+    self.blackboard[name] = value
+    stamps[name] = tick
+    return value
+end
+
+------------------------------------------------
+--Timed conditions
+------------------------------------------------
+
+---Called by the timer wheel when a timed condition comes due
+---@param timer table
+local function fireTimedCondition(timer)
+    local instance = timer.instance
+    local condition = timer.condition
+    if instance.currentState ~= condition.currentState then return end
+    if FSM_LOG.traceOn then FSM_LOG:log("Timer fired: " .. condition.id, FSM_LOG.logLevel.TRACE) end
+    instance:invalidateBlackboard()
+    if condition:evaluate(instance) then
+        condition:action(instance)
+        local nextState = condition:getNextState()
+        if nextState then
+            instance:changeState(nextState, condition)
+        end
+    end
+end
+
+---Schedule the timed conditions of a state that was just entered.
+---Timer tables are kept per FSM or instance and reused for every state.
+---@param state FSM_STATE
+function FSM:startTimers(state)
+    local timed = state.timedLinks
+    if not timed or #timed == 0 then return end
+    local timers = rawget(self, "timers")
+    if not timers then
+        timers = {}
+        self.timers = timers
+    end
+    for i = 1, #timed do
+        local condition = timed[i]
+        local timer = timers[i]
+        if not timer then
+            timer = { instance = self, callback = fireTimedCondition }
+            timers[i] = timer
+        end
+        timer.condition = condition
+        local wheel = FSM_TIMERS[condition.afterUnit] or FSM_TIMERS.seconds
+        wheel:schedule(timer, condition.after)
+    end
+    self.timerCount = #timed
+end
+
+---Cancel the timers of the state that is being left
+function FSM:stopTimers()
+    local count = rawget(self, "timerCount")
+    if not count or count == 0 then return end
+    local timers = self.timers
+    for i = 1, count do
+        local timer = timers[i]
+        if timer.wheel then
+            timer.wheel:cancel(timer)
+        end
+    end
+    self.timerCount = 0
+end
+
+------------------------------------------------
+--Coroutine states
+------------------------------------------------
+
+---Yielded by a pooled coroutine when the function it ran returned
+local coroutineDone = {}
+
+---Coroutines waiting for their next function, so entering a coroutine state doesn't create one
+local coroutinePool = {}
+local coroutinePoolSize = 0
+
+---Body of every pooled coroutine: run a function, report that it returned and wait for the next one.
+---The tail call keeps the stack flat however many functions the coroutine runs.
+local function coroutineWorker(fn, ...)
+    fn(...)
+    return coroutineWorker(coroutine.yield(coroutineDone))
+end
+
+---Fill the coroutine pool up front, so entering coroutine states allocates nothing
+---until more than count of them run at the same time
+---@param count integer Most coroutine states expected to run at once, over all FSMs
+function FSM:reserveCoroutines(count)
+    for i = coroutinePoolSize + 1, count do
+        coroutinePool[i] = coroutine.create(coroutineWorker)
+    end
+    if count > coroutinePoolSize then
+        coroutinePoolSize = count
+    end
+end
+
+---Resume the onUpdate coroutine of a state.
+---onUpdate starts on the first update after the state is entered and runs once per entry,
+---the arguments are passed to it when it starts and returned by coroutine.yield after that.
+---Once it returns its coroutine goes back to the pool.
+---@param state FSM_STATE
+---@param ... unknown
+function FSM:resumeStateCoroutine(state, ...)
+    if rawget(self, "stateCoroutineDone") then return end
+    local co = rawget(self, "stateCoroutine")
+    local ok, result
+    if co then
+        ok, result = coroutine.resume(co, ...)
+    else
+        if coroutinePoolSize > 0 then
+            co = coroutinePool[coroutinePoolSize]
+            coroutinePool[coroutinePoolSize] = nil
+            coroutinePoolSize = coroutinePoolSize - 1
+        else
+            co = coroutine.create(coroutineWorker)
+        end
+        self.stateCoroutine = co
+        ok, result = coroutine.resume(co, state.onUpdate, state, self, ...)
+    end
+    --onUpdate may have changed the state, which already let go of the coroutine
+    if rawget(self, "stateCoroutine") ~= co then return end
+    if not ok then
+        self.stateCoroutine = false
+        FSM_LOG:log("onUpdate coroutine of " .. state.id .. " failed: " .. tostring(result), FSM_LOG.logLevel.ERROR)
+        error(result, 0)
+    end
+    if result == coroutineDone then
+        self.stateCoroutine = false
+        self.stateCoroutineDone = true
+        coroutinePoolSize = coroutinePoolSize + 1
+        coroutinePool[coroutinePoolSize] = co
+    end
+end
+
+---Let go of the onUpdate coroutine of the state that is being left.
+---A coroutine stopped halfway through onUpdate can't be reused, it is closed instead of pooled.
+function FSM:closeStateCoroutine()
+    if rawget(self, "stateCoroutineDone") then
+        self.stateCoroutineDone = false
+    end
+    local co = rawget(self, "stateCoroutine")
+    if not co then return end
+    self.stateCoroutine = false
+    if coroutine.close and coroutine.status(co) == "suspended" then
+        coroutine.close(co)
+    end
 end
 
 ------------------------------------------------
@@ -222,24 +532,41 @@ FSM_STATE = {
 
     ---Function called when the state is entered
     ---@type function
-    onEnter = function(...) end,
+    onEnter = function() end,
 
     ---Function called when the state is updated
     ---@type function
-    onUpdate = function(...) end,
+    onUpdate = function() end,
 
     ---Function called when the state is exited
     ---@type function
-    onExit = function(...) end,
+    onExit = function() end,
 
     ---Conditions to change state
     ---@type table<string, FSM_CONDITION>
     links = nil,
 
+    ---Polled conditions in evaluation order, rebuilt by sortConditions whenever links change
+    ---@type FSM_CONDITION[]
+    sortedLinks = nil,
+
+    ---Conditions subscribed to an event, by event name and in evaluation order
+    ---@type table<string, FSM_CONDITION[]>
+    eventLinks = nil,
+
+    ---Conditions that are evaluated once, a set time after the state is entered
+    ---@type FSM_CONDITION[]
+    timedLinks = nil,
+
     ---If the state is an exit state
     ---@type boolean
     isExitState = nil,
 
+    ---If onUpdate runs as a coroutine once per entry of the state, resumed on every update
+    ---until it returns and closed if the state is left before that
+    ---@type boolean
+    isCoroutine = nil,
+
     ---FSM the state belongs to
     ---@type FSM
     FSM = nil,
@@ -273,6 +600,7 @@ function FSM_STATE:new(o)
         setmetatable(o.FSM, FSM)
     end
     setmetatable(o, self)
+    o:sortConditions()
     return o
 end
 
@@ -291,36 +619,79 @@ function FSM_STATE:registerCondition(condition)
     --Set the current state of the trigger to this state
     condition.currentStateId = self.id
     condition.currentState = self
-    FSM_LOG:log("registering conditon " .. condition.id, FSM_LOG.logLevel.TRACE)
+    self:sortConditions()
+    if FSM_LOG.traceOn then FSM_LOG:log("registering conditon " .. condition.id, FSM_LOG.logLevel.TRACE) end
+end
+
+---Remove a trigger from a state
+---@param conditionId string
+function FSM_STATE:unregisterCondition(conditionId)
+    if not self.links[conditionId] then return end
+    self.links[conditionId] = nil
+    self:sortConditions()
+    if FSM_LOG.traceOn then FSM_LOG:log("unregistering conditon " .. conditionId, FSM_LOG.logLevel.TRACE) end
 end
 
 ------------------------------------------------
 --FSM State flow
 ------------------------------------------------
 
----Sort the conditions of the state by priority
+---Order conditions by priority, highest first, and by id when priorities are equal
+local function compareConditions(a, b)
+    if a.priority ~= b.priority then
+        return a.priority > b.priority
+    end
+    return a.id < b.id
+end
+
+---Rebuild the cached evaluation order of the conditions of the state.
+---Conditions with an after time go to timedLinks and are evaluated when their timer fires,
+---conditions with an event go to eventLinks and are only evaluated by FSM:dispatch,
+---the others to sortedLinks and are evaluated on every update.
+---Called when links change through registerCondition/unregisterCondition,
+---call it yourself after editing links, priorities or events directly.
 ---@return table<FSM_CONDITION>
 function FSM_STATE:sortConditions()
     local sorted = {}
-    local i = 1
+    local events = {}
+    local timed = {}
     for _, condition in pairs(self.links) do
-        sorted[i] = condition
-        i = i + 1
+        local event = condition.event
+        if condition.after and condition.after > 0 then
+            timed[#timed + 1] = condition
+        elseif event and event ~= "" then
+            local subscribed = events[event]
+            if not subscribed then
+                subscribed = {}
+                events[event] = subscribed
+            end
+            subscribed[#subscribed + 1] = condition
+        else
+            sorted[#sorted + 1] = condition
+        end
     end
-    table.sort(sorted, function(a, b)
-        return a.priority > b.priority
-    end)
+    table.sort(sorted, compareConditions)
+    for _, subscribed in pairs(events) do
+        table.sort(subscribed, compareConditions)
+    end
+    table.sort(timed, compareConditions)
+    self.sortedLinks = sorted
+    self.eventLinks = events
+    self.timedLinks = timed
     return sorted
 end
 
----Evaluate the conditions of the state
-function FSM_STATE:evaluateConditions()
-    local sorted = self:sortConditions()
-    for _, condition in pairs(sorted) do
-        if condition:evaluate() then
-            condition:action()
+---Evaluate the polled conditions of the state
+---@param instance? FSM FSM or instance running this state, defaults to the FSM the state belongs to
+function FSM_STATE:evaluateConditions(instance)
+    instance = instance or self.FSM
+    local sorted = self.sortedLinks or self:sortConditions()
+    for i = 1, #sorted do
+        local condition = sorted[i]
+        if condition:evaluate(instance) then
+            condition:action(instance)
             if condition:getNextState() then
-                self.FSM:changeState(condition:getNextState())
+                instance:changeState(condition:getNextState(), condition)
                 if condition:getNextState().isExitState then
                     return
                 end
@@ -355,16 +726,29 @@ FSM_CONDITION = {
 
     ---Condition to evaluate the condition
     ---@type function
-    condition = function(...) end,
+    condition = function() end,
 
     ---Action that executes when the condition is true
     ---@type function
-    action = function(...) end,
+    action = function() end,
 
     ---ID of the next state
     ---@type string
     nextStateId = "",
 
+    ---Event the condition is subscribed to, empty to evaluate it on every update instead
+    ---@type string
+    event = "",
+
+    ---When above 0 the condition is evaluated once, this long after its state was entered,
+    ---instead of on every update. Return true from condition for a plain timeout.
+    ---@type number
+    after = 0,
+
+    ---Unit of after, "seconds" or "ticks", see FSM_TIMERS
+    ---@type string
+    afterUnit = "seconds",
+
     inLineCurve = 0,
     
     outLineCurve = 0,
@@ -409,11 +793,19 @@ end
 -----------------------------------------------
 
 ---Evaluate the condition
+---@param instance? FSM FSM or instance the condition is evaluated for
+---@param ... unknown Arguments of the dispatched event, if any
 ---@return boolean isTrue
-function FSM_CONDITION:evaluate()
-    FSM_LOG:log("Evaluating " .. self.id, FSM_LOG.logLevel.TRACE)
-    --Evaluate the condition of the condition
-    return self:condition()
+function FSM_CONDITION:evaluate(instance, ...)
+    if FSM_LOG.traceOn then FSM_LOG:log("Evaluating " .. self.id, FSM_LOG.logLevel.TRACE) end
+    if not FSM_PROFILER.enabled then
+        --Evaluate the condition of the condition
+        return self:condition(instance, ...)
+    end
+    local started = FSM_PROFILER.clock()
+    local isTrue = self:condition(instance, ...)
+    FSM_PROFILER:addCondition(self, started, isTrue)
+    return isTrue
 end
 
 ------------------------------------------------
@@ -437,6 +829,962 @@ end
 
 
 
+---------------------------------------------------------------------------------------------------------------
+---------------------------------------------------------------------------------------------------------------
+-- FSM Scheduler
+---------------------------------------------------------------------------------------------------------------
+---------------------------------------------------------------------------------------------------------------
+
+---Drives many FSMs or FSM instances from a single tick call.
+---Every machine has a tick interval (1 = every frame, 8 = every 8th frame), and the
+---machines that are due are updated round robin until the frame budget is spent.
+---Machines left over keep their turn and are updated first on the next frame.
+---@class FSM_SCHEDULER
+FSM_SCHEDULER = {
+
+    ---Seconds a tick call may spend updating machines, 0 for no limit
+    ---@type number
+    budget = 0,
+
+    ---Function returning the current time in seconds
+    ---@type function
+    clock = os.clock,
+
+    ---Scheduled machines, with their interval and the frame of their next update at the same index
+    ---@type FSM[]
+    machines = nil,
+    ---@type integer[]
+    intervals = nil,
+    ---@type integer[]
+    nextFrames = nil,
+
+    ---Index of each scheduled machine
+    ---@type table<FSM, integer>
+    slots = nil,
+
+    ---Slots in use, during a tick it includes the slots of machines removed by that tick
+    count = 0,
+
+    ---Set while tick runs, removals then leave a hole that tick closes when it is done
+    ticking = false,
+
+    ---Slots removed during the running tick
+    holes = 0,
+
+    ---Index the next tick call starts from
+    cursor = 1,
+
+    ---Number of tick calls so far
+    frame = 0,
+
+    ---Machines updated by the last tick call
+    ---@type integer
+    ticked = 0,
+
+    ---Machines that were due but left for the next tick call because the budget ran out
+    ---@type integer
+    deferred = 0,
+
+} FSM_SCHEDULER.__index = FSM_SCHEDULER
+
+------------------------------------------------
+--Constructor
+------------------------------------------------
+
+---Constructor for FSM scheduler
+---@param o? table
+---@return FSM_SCHEDULER newObject
+function FSM_SCHEDULER:new(o)
+    -- Make sure the fields are empty so they arent drawn from the metatable
+    o = o or {}
+    o.machines = {}
+    o.intervals = {}
+    o.nextFrames = {}
+    o.slots = {}
+    o.count = 0
+    o.cursor = 1
+    o.frame = 0
+    o.ticking = false
+    o.holes = 0
+    setmetatable(o, self)
+    return o
+end
+
+------------------------------------------------
+--Register functions
+------------------------------------------------
+
+---Schedule a machine
+---@param machine FSM FSM or instance created with FSM:newInstance
+---@param interval? integer Update the machine every interval frames, defaults to 1
+function FSM_SCHEDULER:add(machine, interval)
+    if self.slots[machine] then
+        self:setInterval(machine, interval)
+        return
+    end
+    interval = interval or 1
+    local slot = self.count + 1
+    self.count = slot
+    self.machines[slot] = machine
+    self.intervals[slot] = interval
+    --Spread machines of the same interval over the frames of that interval
+    self.nextFrames[slot] = self.frame + 1 + slot % interval
+    self.slots[machine] = slot
+end
+
+---Stop scheduling a machine
+---@param machine FSM
+function FSM_SCHEDULER:remove(machine)
+    local slot = self.slots[machine]
+    if not slot then return end
+    self.slots[machine] = nil
+    --Moving the last machine would put it behind the walk of the running tick, so leave a hole that is never due
+    if self.ticking then
+        self.machines[slot] = false
+        self.nextFrames[slot] = math.huge
+        self.holes = self.holes + 1
+        return
+    end
+    local last = self.count
+    --Move the last machine into the freed slot so the arrays stay dense
+    if slot ~= last then
+        local moved = self.machines[last]
+        self.machines[slot] = moved
+        self.intervals[slot] = self.intervals[last]
+        self.nextFrames[slot] = self.nextFrames[last]
+        self.slots[moved] = slot
+    end
+    self.machines[last] = nil
+    self.intervals[last] = nil
+    self.nextFrames[last] = nil
+    self.count = last - 1
+    if self.cursor > self.count then
+        self.cursor = 1
+    end
+end
+
+---Change how often a machine is updated, for example when an agent moves away from the camera
+---@param machine FSM
+---@param interval integer Update the machine every interval frames
+function FSM_SCHEDULER:setInterval(machine, interval)
+    local slot = self.slots[machine]
+    if not slot then return end
+    interval = interval or 1
+    self.intervals[slot] = interval
+    local nextFrame = self.frame + interval
+    if self.nextFrames[slot] > nextFrame then
+        self.nextFrames[slot] = nextFrame
+    end
+end
+
+------------------------------------------------
+--FSM Scheduler flow
+------------------------------------------------
+
+---Close the holes removals left during a tick, keeping the order so the cursor stays on the same machine
+---@param scheduler FSM_SCHEDULER
+---@param cursor integer Slot the next tick starts from
+---@return integer cursor The same machine after compaction
+local function compactScheduler(scheduler, cursor)
+    local machines, intervals, nextFrames, slots = scheduler.machines, scheduler.intervals, scheduler.nextFrames, scheduler.slots
+    local count = scheduler.count
+    local live = 0
+    local newCursor = 1
+    for slot = 1, count do
+        if slot == cursor then
+            newCursor = live + 1
+        end
+        local machine = machines[slot]
+        if machine then
+            live = live + 1
+            if live ~= slot then
+                machines[live] = machine
+                intervals[live] = intervals[slot]
+                nextFrames[live] = nextFrames[slot]
+                slots[machine] = live
+            end
+        end
+    end
+    for slot = live + 1, count do
+        machines[slot] = nil
+        intervals[slot] = nil
+        nextFrames[slot] = nil
+    end
+    scheduler.count = live
+    scheduler.holes = 0
+    if newCursor > live then
+        newCursor = 1
+    end
+    return newCursor
+end
+
+---Update the machines that are due this frame, within the budget.
+---At least one due machine is updated per call so every machine keeps making progress.
+---@param ... unknown Passed on to onUpdate of every machine
+---@return integer ticked Machines updated
+---@return integer deferred Machines that were due but are left for the next call
+function FSM_SCHEDULER:tick(...)
+    local frame = self.frame + 1
+    self.frame = frame
+    local count = self.count
+    if count == 0 then
+        self.ticked = 0
+        self.deferred = 0
+        return 0, 0
+    end
+
+    local machines, intervals, nextFrames = self.machines, self.intervals, self.nextFrames
+    local budget = self.budget
+    local clock = self.clock
+    local deadline = budget > 0 and clock() + budget or nil
+    local slot = self.cursor
+    local ticked = 0
+    local visited = 0
+
+    --Removals during the lap leave holes, so no machine moves and the lap covers the slots it started with.
+    --Machines added during the lap are not due before the next frame.
+    self.ticking = true
+    while visited < count do
+        if nextFrames[slot] <= frame then
+            if deadline and ticked > 0 and clock() >= deadline then
+                break
+            end
+            --Set before the update so a machine removed by its own update is not touched afterwards
+            nextFrames[slot] = frame + intervals[slot]
+            machines[slot]:onUpdate(...)
+            ticked = ticked + 1
+        end
+        visited = visited + 1
+        slot = slot + 1
+        if slot > count then
+            slot = 1
+        end
+    end
+    self.ticking = false
+
+    --The next call starts where the budget ran out, the rest of this lap is deferred
+    local stop = slot
+    local deferred = 0
+    for _ = visited + 1, count do
+        if nextFrames[slot] <= frame then
+            deferred = deferred + 1
+        end
+        slot = slot + 1
+        if slot > count then
+            slot = 1
+        end
+    end
+    slot = stop
+    if self.holes > 0 then
+        slot = compactScheduler(self, slot)
+    end
+    self.cursor = slot
+    self.ticked = ticked
+    self.deferred = deferred
+    return ticked, deferred
+end
+
+
+---------------------------------------------------------------------------------------------------------------
+---------------------------------------------------------------------------------------------------------------
+-- FSM Timer Wheel
+---------------------------------------------------------------------------------------------------------------
+---------------------------------------------------------------------------------------------------------------
+
+---Hierarchical timing wheel that runs timed conditions.
+---Time is counted in steps of resolution. Timers due within the next slotsPerLevel steps
+---live in the first level, later ones in coarser levels and move down as their time comes closer.
+---Scheduling and cancelling are O(1), advancing costs one slot per step no matter how many timers wait.
+---@class FSM_TIMER_WHEEL
+FSM_TIMER_WHEEL = {
+
+    ---Length of one step, in the unit the wheel is advanced in
+    ---@type number
+    resolution = 1,
+
+    slotsPerLevel = 64,
+
+    levels = 4,
+
+    ---Steps advanced so far
+    ---@type integer
+    now = 0,
+
+    ---Time passed to advanceTime that did not add up to a full step yet
+    ---@type number
+    remainder = 0,
+
+    ---Slot lists per level, every slot is the sentinel of a circular doubly linked list
+    ---@type table[][]
+    wheel = nil,
+
+    ---Sentinels the timers of a slot are moved to while they fire or cascade, kept so advancing allocates nothing
+    ---@type table
+    firing = nil,
+
+    ---@type table
+    cascading = nil,
+
+} FSM_TIMER_WHEEL.__index = FSM_TIMER_WHEEL
+
+------------------------------------------------
+--Constructor
+------------------------------------------------
+
+---Constructor for FSM timer wheel
+---@param o? table
+---@return FSM_TIMER_WHEEL newObject
+function FSM_TIMER_WHEEL:new(o)
+    -- Make sure the fields are empty so they arent drawn from the metatable
+    o = o or {}
+    setmetatable(o, self)
+    o.now = 0
+    o.remainder = 0
+    o.wheel = {}
+    for level = 1, o.levels do
+        local slots = {}
+        for slot = 0, o.slotsPerLevel - 1 do
+            local sentinel = {}
+            sentinel.next = sentinel
+            sentinel.prev = sentinel
+            slots[slot] = sentinel
+        end
+        o.wheel[level] = slots
+    end
+    o.firing = {}
+    o.firing.next = o.firing
+    o.firing.prev = o.firing
+    o.cascading = {}
+    o.cascading.next = o.cascading
+    o.cascading.prev = o.cascading
+    return o
+end
+
+------------------------------------------------
+--FSM Timer Wheel flow
+------------------------------------------------
+
+---Link a timer into the slot of its due step
+---@param timer table
+function FSM_TIMER_WHEEL:place(timer)
+    local size = self.slotsPerLevel
+    local delta = timer.due - self.now
+    local level = 1
+    local span = size
+    while delta >= span and level < self.levels do
+        level = level + 1
+        span = span * size
+    end
+    local slot = math.floor(timer.due / (span / size)) % size
+    local sentinel = self.wheel[level][slot]
+    local last = sentinel.prev
+    timer.prev = last
+    timer.next = sentinel
+    last.next = timer
+    sentinel.prev = timer
+end
+
+---Schedule a timer. The timer table is reused by the caller, the wheel only sets due, next and prev on it.
+---timer.callback(timer) is called when it fires.
+---@param timer table
+---@param delay number Time until the timer fires, in the unit the wheel is advanced in
+function FSM_TIMER_WHEEL:schedule(timer, delay)
+    if timer.next then
+        self:cancel(timer)
+    end
+    local steps = math.ceil(delay / self.resolution)
+    if steps < 1 then
+        steps = 1
+    end
+    timer.due = self.now + steps
+    timer.wheel = self
+    self:place(timer)
+end
+
+---Cancel a timer, does nothing when it is not scheduled
+---@param timer table
+function FSM_TIMER_WHEEL:cancel(timer)
+    local next = timer.next
+    if not next then return end
+    local prev = timer.prev
+    prev.next = next
+    next.prev = prev
+    timer.next = nil
+    timer.prev = nil
+end
+
+---Move every timer of a slot to an empty scratch list, so callbacks can schedule and cancel freely
+---@param sentinel table
+---@param list table Empty scratch sentinel of the wheel
+---@return boolean taken False when the slot was empty
+local function takeSlot(sentinel, list)
+    local first = sentinel.next
+    if first == sentinel then return false end
+    local last = sentinel.prev
+    list.next = first
+    list.prev = last
+    first.prev = list
+    last.next = list
+    sentinel.next = sentinel
+    sentinel.prev = sentinel
+    return true
+end
+
+---Advance the wheel by a number of steps, firing the timers that come due.
+---Timer callbacks may schedule and cancel timers but must not advance the same wheel.
+---@param steps integer
+function FSM_TIMER_WHEEL:advance(steps)
+    local size = self.slotsPerLevel
+    local wheel = self.wheel
+    for _ = 1, steps do
+        local now = self.now + 1
+        self.now = now
+
+        --Bring the timers of the next coarser slot down when a level wraps around
+        local level = 1
+        local position = now
+        while position % size == 0 and level < self.levels do
+            level = level + 1
+            position = math.floor(position / size)
+            local list = self.cascading
+            if takeSlot(wheel[level][position % size], list) then
+                while list.next ~= list do
+                    local timer = list.next
+                    self:cancel(timer)
+                    self:place(timer)
+                end
+            end
+        end
+
+        local list = self.firing
+        if takeSlot(wheel[1][now % size], list) then
+            while list.next ~= list do
+                local timer = list.next
+                self:cancel(timer)
+                timer.callback(timer)
+            end
+        end
+    end
+end
+
+---Advance the wheel by an amount of time, in the unit of resolution
+---@param delta number
+function FSM_TIMER_WHEEL:advanceTime(delta)
+    local total = self.remainder + delta
+    local steps = math.floor(total / self.resolution)
+    self.remainder = total - steps * self.resolution
+    if steps > 0 then
+        self:advance(steps)
+    end
+end
+
+---Wheels the timed conditions of every FSM are scheduled in, by FSM_CONDITION.afterUnit
+FSM_TIMERS = {
+    ---@type FSM_TIMER_WHEEL
+    seconds = FSM_TIMER_WHEEL:new({ resolution = 1 / 60 }),
+    ---@type FSM_TIMER_WHEEL
+    ticks = FSM_TIMER_WHEEL:new({ resolution = 1 }),
+}
+
+---Advance the timers of all FSMs, call it once per frame
+---@param dt number Seconds since the last call
+function FSM_TIMERS:update(dt)
+    self.seconds:advanceTime(dt)
+    self.ticks:advance(1)
+end
+
+
+---------------------------------------------------------------------------------------------------------------
+---------------------------------------------------------------------------------------------------------------
+-- FSM Profiler
+---------------------------------------------------------------------------------------------------------------
+---------------------------------------------------------------------------------------------------------------
+
+---Optional timings of state functions and conditions of every FSM.
+---Call start, run the game for a while, then write the profile and load it in the editor
+---(Profile > Load Profile) to colour the graph by cost or frequency.
+---While disabled every call site costs a single field check.
+---@class FSM_PROFILER
+FSM_PROFILER = {
+
+    ---True while timings are recorded
+    ---@type boolean
+    enabled = false,
+
+    ---Clock the timings are taken with, in seconds. os.clock is coarse on some platforms,
+    ---set it to a high resolution timer of the host to profile short functions.
+    ---@type function
+    clock = os.clock,
+
+    ---Positions of the enter, update and exit counts in a state record, each count is followed by its time
+    ENTER = 1,
+    UPDATE = 3,
+    EXIT = 5,
+
+    ---Records by state: {enters, enterTime, updates, updateTime, exits, exitTime}
+    ---@type table<FSM_STATE, number[]>
+    states = {},
+
+    ---Records by condition: {evaluations, evaluationTime, transitions}
+    ---@type table<FSM_CONDITION, number[]>
+    conditions = {},
+
+    ---Clock values of the start and stop of the recording
+    startedAt = 0,
+    stoppedAt = 0,
+}
+
+---Clear the records and start timing
+function FSM_PROFILER:start()
+    self.states = {}
+    self.conditions = {}
+    self.startedAt = self.clock()
+    self.stoppedAt = self.startedAt
+    self.enabled = true
+end
+
+---Stop timing, the records are kept until the next start
+function FSM_PROFILER:stop()
+    if not self.enabled then return end
+    self.enabled = false
+    self.stoppedAt = self.clock()
+end
+
+---Add a call of a state function
+---@param state FSM_STATE
+---@param slot integer FSM_PROFILER.ENTER, UPDATE or EXIT
+---@param started number Clock value before the call
+function FSM_PROFILER:addState(state, slot, started)
+    local elapsed = self.clock() - started
+    local record = self.states[state]
+    if not record then
+        record = { 0, 0, 0, 0, 0, 0 }
+        self.states[state] = record
+    end
+    record[slot] = record[slot] + 1
+    record[slot + 1] = record[slot + 1] + elapsed
+end
+
+---Add an evaluation of a condition
+---@param condition FSM_CONDITION
+---@param started number Clock value before the evaluation
+---@param isTrue boolean Result of the evaluation
+function FSM_PROFILER:addCondition(condition, started, isTrue)
+    local elapsed = self.clock() - started
+    local record = self.conditions[condition]
+    if not record then
+        record = { 0, 0, 0 }
+        self.conditions[condition] = record
+    end
+    record[1] = record[1] + 1
+    record[2] = record[2] + elapsed
+    if isTrue and condition:getNextState() then
+        record[3] = record[3] + 1
+    end
+end
+
+---Id of the FSM a state belongs to, "?" when it has none. Ids never contain spaces, so they can't break a profile line
+---@param state FSM_STATE|nil
+---@return string
+local function stateFsmId(state)
+    local fsm = state and state.FSM
+    if fsm and fsm.id and fsm.id ~= "" then
+        return fsm.id
+    end
+    return "?"
+end
+
+---The records as the text of a profile file, one line per state and condition.
+---Can be called while recording to take a snapshot.
+---@return string
+function FSM_PROFILER:format()
+    local duration = (self.enabled and self.clock() or self.stoppedAt) - self.startedAt
+    local lines = { "luaFSM profile 1", string.format("duration %.9g", duration) }
+    for state, record in pairs(self.states) do
+        lines[#lines + 1] = string.format("state %s %s %d %.9g %d %.9g %d %.9g", stateFsmId(state), state.id,
+            record[1], record[2], record[3], record[4], record[5], record[6])
+    end
+    for condition, record in pairs(self.conditions) do
+        lines[#lines + 1] = string.format("condition %s %s %d %.9g %d", stateFsmId(condition.currentState), condition.id,
+            record[1], record[2], record[3])
+    end
+    lines[#lines + 1] = ""
+    return table.concat(lines, "\n")
+end
+
+---Write the records to a profile file, see format
+---@param path string
+---@return boolean written
+function FSM_PROFILER:write(path)
+    local file = io.open(path, "w")
+    if not file then
+        FSM_LOG:log("Could not open profile file " .. tostring(path), FSM_LOG.logLevel.ERROR)
+        return false
+    end
+    file:write(self:format())
+    file:close()
+    return true
+end
+
+
+---------------------------------------------------------------------------------------------------------------
+---------------------------------------------------------------------------------------------------------------
+-- FSM Trace
+---------------------------------------------------------------------------------------------------------------
+---------------------------------------------------------------------------------------------------------------
+
+---Ring buffer of the latest state changes of every FSM, to find out what an agent did before it misbehaved.
+---A record is five values written into preallocated slots, so recording allocates nothing.
+---dump writes the ring as fixed-size binary records the editor replays on the canvas (Trace > Load Trace).
+---The ring holds on to the instances, states and conditions it recorded until their slots are overwritten.
+---@class FSM_TRACE
+FSM_TRACE = {
+
+    ---True while state changes are recorded
+    ---@type boolean
+    enabled = false,
+
+    ---Records kept, the oldest one is overwritten once the ring is full
+    ---@type integer
+    capacity = 0,
+}
+
+---Records lie back to back in one array, TRACE_RECORD_SIZE slots each: tick of FSM_TIMERS.ticks, instance,
+---previous state (false for the first), new state and the condition that caused the change
+---(false when changeState was called directly).
+---The ring lives in upvalues rather than fields of FSM_TRACE, so recording does no lookups for it.
+local TRACE_RECORD_SIZE = 5
+local traceRing = {}
+local traceRingSize = 0
+---Offset just past the newest record
+local traceHead = 0
+local traceCount = 0
+local traceTicks = FSM_TIMERS.ticks
+
+---Allocate the ring and start recording
+---@param capacity? integer Records kept, 4096 by default
+function FSM_TRACE:start(capacity)
+    capacity = capacity or 4096
+    local ring = {}
+    for slot = 1, capacity * TRACE_RECORD_SIZE do
+        ring[slot] = false
+    end
+    traceRing = ring
+    traceRingSize = capacity * TRACE_RECORD_SIZE
+    traceHead = 0
+    traceCount = 0
+    self.capacity = capacity
+    self.enabled = capacity > 0
+end
+
+---Stop recording, the records stay in the ring until the next start
+function FSM_TRACE:stop()
+    self.enabled = false
+end
+
+---Number of records in the ring
+---@return integer
+function FSM_TRACE:getCount()
+    return traceCount
+end
+
+---Record a state change, called by FSM:changeState and FSM:setInitialState
+---@param instance FSM
+---@param fromState FSM_STATE|false|nil
+---@param toState FSM_STATE
+---@param condition? FSM_CONDITION
+function FSM_TRACE:record(instance, fromState, toState, condition)
+    local base = traceHead
+    if base >= traceRingSize then
+        base = 0
+    end
+    traceHead = base + TRACE_RECORD_SIZE
+    local ring = traceRing
+    ring[base + 1] = traceTicks.now
+    ring[base + 2] = instance
+    ring[base + 3] = fromState or false
+    ring[base + 4] = toState
+    ring[base + 5] = condition or false
+    if traceCount < self.capacity then
+        traceCount = traceCount + 1
+    end
+end
+
+---Little endian unsigned integers, string.pack is not available in lua 5.1
+local function packU16(n)
+    return string.char(n % 256, math.floor(n / 256) % 256)
+end
+
+local function packU32(n)
+    return string.char(n % 256, math.floor(n / 256) % 256, math.floor(n / 65536) % 256, math.floor(n / 16777216) % 256)
+end
+
+---Write the records, oldest first, to a binary trace file.
+---Layout, little endian: "LFSMTRC1", u32 string count, every string as u16 length and its bytes,
+---u32 record count, then 16 byte records of u32 tick, u32 instance, u16 fsm, u16 from, u16 to, u16 condition.
+---fsm, from, to and condition index the strings from 1, 0 means none.
+---Instances are numbered from 1 in the order they first appear in the dump.
+---@param path string
+---@return boolean written
+function FSM_TRACE:dump(path)
+    local file = io.open(path, "wb")
+    if not file then
+        FSM_LOG:log("Could not open trace file " .. tostring(path), FSM_LOG.logLevel.ERROR)
+        return false
+    end
+    local strings, stringIndex = {}, {}
+    local function intern(id)
+        local index = stringIndex[id]
+        if not index then
+            index = #strings + 1
+            strings[index] = id
+            stringIndex[id] = index
+        end
+        return index
+    end
+    local instanceIds, instanceCount = {}, 0
+    local records = {}
+    local ring = traceRing
+    for n = 0, traceCount - 1 do
+        local base = (traceHead - (traceCount - n) * TRACE_RECORD_SIZE) % traceRingSize
+        local instance = ring[base + 2]
+        local instanceId = instanceIds[instance]
+        if not instanceId then
+            instanceCount = instanceCount + 1
+            instanceId = instanceCount
+            instanceIds[instance] = instanceId
+        end
+        local fromState = ring[base + 3]
+        local toState = ring[base + 4]
+        local condition = ring[base + 5]
+        records[n + 1] = packU32(ring[base + 1] % 4294967296) .. packU32(instanceId)
+            .. packU16(intern(stateFsmId(toState)))
+            .. packU16(fromState and intern(fromState.id) or 0)
+            .. packU16(intern(toState.id))
+            .. packU16(condition and intern(condition.id) or 0)
+    end
+    local out = { "LFSMTRC1", packU32(#strings) }
+    for i = 1, #strings do
+        out[#out + 1] = packU16(#strings[i])
+        out[#out + 1] = strings[i]
+    end
+    out[#out + 1] = packU32(#records)
+    out[#out + 1] = table.concat(records)
+    file:write(table.concat(out))
+    file:close()
+    return true
+end
+
+
+---------------------------------------------------------------------------------------------------------------
+---------------------------------------------------------------------------------------------------------------
+-- FSM Snapshot
+---------------------------------------------------------------------------------------------------------------
+---------------------------------------------------------------------------------------------------------------
+
+---Saves and loads the current state of FSMs and their instances as a compact binary string.
+---A snapshot holds the id of every FSM in it once, with the ids of the states its instances are in,
+---and per instance only indices into those and a blob the game serializes the context into.
+---States are matched by id when restoring, so snapshots survive states being added or reordered.
+---Restoring sets the state without running onEnter and without FSM_STATE:new. The timed conditions of the state
+---start waiting from the beginning and a coroutine state runs its onUpdate from the start again.
+---@class FSM_SNAPSHOT
+FSM_SNAPSHOT = {
+
+    ---FSMs restore looks their id up in, the FSMs of every snapshot are added.
+    ---Global FSMs, like the ones the editor generates, are found without registering them.
+    ---@type table<string, FSM>
+    machines = {},
+}
+
+---Record flag of an FSM snapshotted itself rather than one of its instances
+local SNAPSHOT_MACHINE = 1
+
+---Make an FSM known to restore, needed for FSMs that are not globals
+---@param machine FSM
+function FSM_SNAPSHOT:register(machine)
+    self.machines[machine.id] = machine
+end
+
+---FSM an instance was created from, or the FSM itself when it is used without instances
+---@param instance FSM
+---@return FSM machine
+---@return boolean isMachine
+local function snapshotMachine(instance)
+    if rawget(instance, "states") then
+        return instance, true
+    end
+    local meta = getmetatable(instance)
+    return meta.__index, false
+end
+
+---Snapshot many instances at once, the ids of their FSMs and states are stored once for all of them
+---@param instances FSM[] Instances or FSMs
+---@param encode? fun(instance: FSM): string|nil Serializes the context of an instance into its blob
+---@return string data
+function FSM_SNAPSHOT:snapshotAll(instances, encode)
+    local machineList, machineIndex = {}, {}
+    local stateLists, stateIndices = {}, {}
+    local records = {}
+    for i = 1, #instances do
+        local instance = instances[i]
+        local machine, isMachine = snapshotMachine(instance)
+        local m = machineIndex[machine]
+        if not m then
+            m = #machineList + 1
+            machineList[m] = machine
+            machineIndex[machine] = m
+            stateLists[m] = {}
+            stateIndices[m] = {}
+            self.machines[machine.id] = machine
+        end
+        local state = rawget(instance, "currentState")
+        local s = 0
+        if state then
+            s = stateIndices[m][state]
+            if not s then
+                local states = stateLists[m]
+                s = #states + 1
+                states[s] = state.id
+                stateIndices[m][state] = s
+            end
+        end
+        local blob = encode and encode(instance) or ""
+        records[i] = string.char(isMachine and SNAPSHOT_MACHINE or 0) .. packU16(m) .. packU16(s) .. packU32(#blob) .. blob
+    end
+    local out = { "LFSMSNP1", packU16(#machineList) }
+    for m = 1, #machineList do
+        local id = machineList[m].id
+        local states = stateLists[m]
+        out[#out + 1] = packU16(#id) .. id .. packU16(#states)
+        for s = 1, #states do
+            out[#out + 1] = packU16(#states[s]) .. states[s]
+        end
+    end
+    out[#out + 1] = packU32(#records)
+    out[#out + 1] = table.concat(records)
+    return table.concat(out)
+end
+
+---Snapshot one instance
+---@param instance FSM Instance or FSM
+---@param blob? string Serialized context of the instance
+---@return string data
+function FSM_SNAPSHOT:snapshot(instance, blob)
+    return self:snapshotAll({ instance }, blob and function() return blob end)
+end
+
+local function readU16(data, pos)
+    local a, b = string.byte(data, pos, pos + 1)
+    return a + b * 256
+end
+
+local function readU32(data, pos)
+    local a, b, c, d = string.byte(data, pos, pos + 3)
+    return a + b * 256 + c * 65536 + d * 16777216
+end
+
+---Restore a snapshot of snapshotAll. Instances come back as new instances of their FSM,
+---FSMs snapshotted themselves are set back to their state in place.
+---@param data string
+---@param decode? fun(blob: string, machine: FSM): any Turns a blob into the context of its instance, without it the blob is the context.
+---An FSM snapshotted itself gets the result as its own context too, without decode an empty blob leaves its context as it is
+---@return FSM[]|nil instances In the order they were snapshotted, nil when the data is not a valid snapshot
+---@return string|nil error
+function FSM_SNAPSHOT:restoreAll(data, decode)
+    local size = #data
+    if string.sub(data, 1, 8) ~= "LFSMSNP1" or size < 14 then
+        return nil, "not a snapshot"
+    end
+    local pos = 9
+    local machineCount = readU16(data, pos)
+    pos = pos + 2
+    local machines, states = {}, {}
+    for m = 1, machineCount do
+        if pos + 1 > size then return nil, "snapshot is cut off" end
+        local length = readU16(data, pos)
+        local id = string.sub(data, pos + 2, pos + 1 + length)
+        pos = pos + 2 + length
+        local machine = self.machines[id]
+        if not machine then
+            machine = _G[id]
+            if type(machine) ~= "table" or not rawget(machine, "states") then
+                return nil, "FSM " .. id .. " not found, register it with FSM_SNAPSHOT:register"
+            end
+        end
+        machines[m] = machine
+        --Ids are turned into states once, every instance only indexes them
+        local list = {}
+        if pos + 1 > size then return nil, "snapshot is cut off" end
+        local stateCount = readU16(data, pos)
+        pos = pos + 2
+        for s = 1, stateCount do
+            if pos + 1 > size then return nil, "snapshot is cut off" end
+            local stateLength = readU16(data, pos)
+            local stateId = string.sub(data, pos + 2, pos + 1 + stateLength)
+            pos = pos + 2 + stateLength
+            list[s] = machine.states[stateId] or false
+            if not list[s] then
+                FSM_LOG:log("State " .. stateId .. " of " .. id .. " no longer exists, restoring its instances to the initial state", FSM_LOG.logLevel.WARNING)
+            end
+        end
+        states[m] = list
+    end
+    if pos + 3 > size then return nil, "snapshot is cut off" end
+    local count = readU32(data, pos)
+    pos = pos + 4
+    local instances = {}
+    for i = 1, count do
+        if pos + 8 > size then return nil, "snapshot is cut off" end
+        local flags = string.byte(data, pos)
+        local m = readU16(data, pos + 1)
+        local s = readU16(data, pos + 3)
+        local blobLength = readU32(data, pos + 5)
+        local blob = string.sub(data, pos + 9, pos + 8 + blobLength)
+        pos = pos + 9 + blobLength
+        local machine = machines[m]
+        if not machine or pos - 1 > size then return nil, "snapshot is cut off" end
+        local context
+        if decode then
+            context = decode(blob, machine)
+        elseif blob ~= "" then
+            context = blob
+        end
+        local instance = machine
+        if flags ~= SNAPSHOT_MACHINE then
+            instance = setmetatable({ currentState = false, context = context }, machine:getInstanceMeta())
+        elseif decode or blob ~= "" then
+            machine.context = context
+        end
+        local state = s > 0 and states[m][s]
+        if state then
+            instance:stopTimers()
+            instance:closeStateCoroutine()
+            instance.initialState = machine.states[machine.initialStateId] or state
+            instance.currentState = state
+            instance:startTimers(state)
+        elseif s > 0 then
+            instance:setInitialState(machine.initialStateId)
+        end
+        instances[i] = instance
+    end
+    return instances
+end
+
+---Restore a snapshot of snapshot
+---@param data string
+---@param decode? fun(blob: string, machine: FSM): any
+---@return FSM|nil instance
+---@return string|nil error
+function FSM_SNAPSHOT:restore(data, decode)
+    local instances, err = self:restoreAll(data, decode)
+    if not instances then
+        return nil, err
+    end
+    return instances[1]
+end
+
+
 ------------------------------------------------
 -- LOGGING
 ------------------------------------------------
@@ -462,20 +1810,65 @@ FSM_LOG = {
 
     enabled = false,
 
-    currentLevel = 2
+    currentLevel = 2,
+
+    ---True when TRACE lines are written. Check it before building a trace message,
+    ---so disabled tracing costs no string concatenation:
+    ---if FSM_LOG.traceOn then FSM_LOG:log("..." .. id, FSM_LOG.logLevel.TRACE) end
+    ---Keep such guards on one line, release exports of this file strip them.
+    ---@type boolean
+    traceOn = false,
+
+    ---Lines kept in memory before they are written to the file
+    ---@type integer
+    bufferSize = 256,
+
+    ---Seconds after which buffered lines are written even if the buffer is not full
+    ---@type integer
+    flushInterval = 1,
+
+    ---Reused line slots, the first lineCount of them are waiting to be written
+    ---@type string[]
+    lines = {},
+    lineCount = 0,
+    lastFlush = 0,
+
+    ---Date string of the current second, so os.date runs at most once a second
+    lastTime = 0,
+    dateString = "",
 }
 
 ---Start the log file.
 ---@param path string Path to where you want the log file to be.
 function FSM_LOG:start(path)
     self.logFile = io.open(path, "w+")
-    self.enabled = true
+    self.enabled = self.logFile ~= nil
+    self.lineCount = 0
+    self.lastFlush = os.time()
+    self:updateGates()
+end
+
+---Flush the remaining lines and close the log file.
+function FSM_LOG:stop()
+    self:flush()
+    if self.logFile then
+        self.logFile:close()
+    end
+    self.logFile = nil
+    self.enabled = false
+    self:updateGates()
 end
 
 ---Set the logging level
 ---@param level logLevel
 function FSM_LOG:setLevel(level)
     self.currentLevel = level
+    self:updateGates()
+end
+
+---Refresh the level flags checked at the call sites
+function FSM_LOG:updateGates()
+    self.traceOn = self.enabled and self.currentLevel <= self.logLevel.TRACE
 end
 
 ---Log something to the log. 
@@ -487,11 +1880,26 @@ function FSM_LOG:log(text, level)
     level = level or 1
     if level < self.currentLevel then return end
 
-    local printText = "[" .. self.logLevelStrings[level] .. "]" .. "[" .. os.date() .. "] -> <" .. tostring(text) .. ">\n"
-    self.logFile:write(printText)
-    self.logFile:flush()
+    local now = os.time()
+    if now ~= self.lastTime then
+        self.lastTime = now
+        self.dateString = os.date("%Y-%m-%d %H:%M:%S", now)
+    end
+    local count = self.lineCount + 1
+    self.lines[count] = "[" .. self.logLevelStrings[level] .. "][" .. self.dateString .. "] -> <" .. tostring(text) .. ">\n"
+    self.lineCount = count
+    if count >= self.bufferSize or now - self.lastFlush >= self.flushInterval then
+        self:flush()
+    end
 end
 
-
-
-
+---Write the buffered lines to the log file.
+function FSM_LOG:flush()
+    if not self.logFile then return end
+    if self.lineCount > 0 then
+        self.logFile:write(table.concat(self.lines, "", 1, self.lineCount))
+        self.lineCount = 0
+    end
+    self.logFile:flush()
+    self.lastFlush = self.lastTime
+end
@@ -0,0 +1,166 @@
+---------------------------------------------------------------------------------------------------------------
+---------------------------------------------------------------------------------------------------------------
+-- FSM benchmark
+---------------------------------------------------------------------------------------------------------------
+---------------------------------------------------------------------------------------------------------------
+
+--Runs many instances of a sample machine and reports update throughput and how much memory the
+--steady-state ticks allocated. The memory growth should stay at 0 KB, anything that grows with the tick count
+--means the tick path of FSM.lua started allocating and the garbage collector will show up in frame times.
+--Under LuaJIT compiled traces are garbage collected objects too, run it with -joff to measure the runtime alone.
+--
+--Usage, from the assets folder: lua bench/fsm_bench.lua [instances] [ticks] [path to FSM.lua]
+--When FSM.lua is already loaded, for example inside the game, the path is ignored.
+
+local instanceCount, tickCount, runtimePath = ...
+instanceCount = tonumber(instanceCount) or 1000
+tickCount = tonumber(tickCount) or 1000
+if not FSM then
+    dofile(runtimePath or "FSM.lua")
+end
+
+---Ticks run before measuring, so pooled coroutines, timer tables and other one time allocations are done
+local warmupTicks = 200
+
+------------------------------------------------
+--Sample machine
+------------------------------------------------
+
+--patrol: polled condition to rest after a number of updates, event condition to alert
+--rest: timed condition back to patrol, event condition to alert
+--alert: coroutine state that calms down after a few updates, then returns to patrol
+
+local guard = FSM:new({})
+guard.id = "guard"
+guard.name = "Guard"
+guard.initialStateId = "patrol"
+
+local patrol = FSM_STATE:new({})
+patrol.id = "patrol"
+function patrol:onEnter(instance)
+    instance.context.steps = 0
+end
+function patrol:onUpdate(instance)
+    local context = instance.context
+    context.steps = context.steps + 1
+end
+
+local rest = FSM_STATE:new({})
+rest.id = "rest"
+
+local alert = FSM_STATE:new({})
+alert.id = "alert"
+alert.isCoroutine = true
+function alert:onEnter(instance)
+    instance.context.calm = false
+end
+function alert:onUpdate(instance)
+    for _ = 1, 5 do
+        coroutine.yield()
+    end
+    instance.context.calm = true
+end
+
+local tired = FSM_CONDITION:new({})
+tired.id = "tired"
+tired.nextStateId = "rest"
+function tired:condition(instance)
+    return instance.context.steps >= 20
+end
+
+local rested = FSM_CONDITION:new({})
+rested.id = "rested"
+rested.nextStateId = "patrol"
+rested.after = 10
+rested.afterUnit = "ticks"
+function rested:condition()
+    return true
+end
+
+local calm = FSM_CONDITION:new({})
+calm.id = "calm"
+calm.nextStateId = "patrol"
+function calm:condition(instance)
+    return instance.context.calm
+end
+
+local spotted = FSM_CONDITION:new({})
+spotted.id = "spotted"
+spotted.nextStateId = "alert"
+spotted.event = "alarm"
+function spotted:condition()
+    return true
+end
+
+local alarmed = FSM_CONDITION:new({})
+alarmed.id = "alarmed"
+alarmed.nextStateId = "alert"
+alarmed.event = "alarm"
+function alarmed:condition()
+    return true
+end
+
+patrol:registerCondition(tired)
+patrol:registerCondition(spotted)
+rest:registerCondition(rested)
+rest:registerCondition(alarmed)
+alert:registerCondition(calm)
+guard:registerState(patrol)
+guard:registerState(rest)
+guard:registerState(alert)
+
+--One alert starts per tick and lasts a few ticks, the rest of the pool is headroom
+FSM:reserveCoroutines(16)
+
+local instances = {}
+for i = 1, instanceCount do
+    instances[i] = guard:newInstance({ steps = 0, calm = false })
+end
+
+------------------------------------------------
+--Run
+------------------------------------------------
+
+---Update every instance once, raise an alarm on a few of them and advance the tick timers
+---@param step integer
+local function tick(step)
+    for i = 1, instanceCount do
+        instances[i]:onUpdate()
+    end
+    instances[step % instanceCount + 1]:dispatch("alarm")
+    FSM_TIMERS.ticks:advance(1)
+end
+
+for t = 1, warmupTicks do
+    tick(t)
+end
+
+--A full collection shrinks the stacks of the pooled coroutines, let them grow back before measuring
+collectgarbage("collect")
+collectgarbage("collect")
+for t = 1, warmupTicks do
+    tick(warmupTicks + t)
+end
+collectgarbage("stop")
+local memoryBefore = collectgarbage("count")
+local clockBefore = os.clock()
+
+for t = 1, tickCount do
+    tick(t)
+end
+
+local seconds = os.clock() - clockBefore
+local growth = collectgarbage("count") - memoryBefore
+collectgarbage("restart")
+
+local updates = instanceCount * tickCount
+print(string.format("%s, %d instances x %d ticks", _VERSION, instanceCount, tickCount))
+print(string.format("%.3f s, %.0f updates/s", seconds, updates / math.max(seconds, 1e-9)))
+print(string.format("memory growth %.2f KB, %.4f bytes/update", growth, growth * 1024 / updates))
+
+local states = {}
+for i = 1, instanceCount do
+    local id = instances[i].currentState.id
+    states[id] = (states[id] or 0) + 1
+end
+print(string.format("states: patrol %d, rest %d, alert %d", states.patrol or 0, states.rest or 0, states.alert or 0))
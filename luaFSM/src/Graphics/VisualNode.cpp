@@ -64,9 +64,12 @@ namespace LuaFsm
             auto drawList = ImGui::GetWindowDrawList();
             m_LastPosition = (canvasPos + m_Center);
             HandleSelection(editor);
+            auto fillColor = GetCurrentColor();
+            if (const auto heat = editor->GetHeat(this); heat >= 0.0f)
+                fillColor = NodeEditor::HeatColor(heat, IsSelected() || ImGui::IsWindowHovered(ImGuiHoveredFlags_ChildWindows) ? 0.9f : 0.6f);
             if (m_Shape == NodeShape::Ellipse)
             {
-                drawList->AddEllipseFilled(m_LastPosition,  m_EllipseRadius, GetCurrentColor());
+                drawList->AddEllipseFilled(m_LastPosition,  m_EllipseRadius, fillColor);
                 auto borderColor = GetBorderColor();
                 if (m_Type == NodeType::State)
                 {
@@ -81,7 +84,7 @@ namespace LuaFsm
             }
             else if (m_Shape == NodeShape::Circle)
             {
-                drawList->AddCircleFilled(m_LastPosition, m_Radius, GetCurrentColor());
+                drawList->AddCircleFilled(m_LastPosition, m_Radius, fillColor);
                 auto borderColor = GetBorderColor();
                 if (m_Type == NodeType::State)
                 {
@@ -101,7 +104,11 @@ namespace LuaFsm
                 const auto trigger = editor->GetCurrentFsm()->GetTrigger(m_Id);
 
                 const auto textSize = ImGui::CalcTextSize(object->GetName().c_str());
-                const std::string priority = fmt::format("priority: {0}", trigger->GetPriority());
+                std::string priority = fmt::format("priority: {0}", trigger->GetPriority());
+                if (trigger->IsTimed())
+                    priority += fmt::format(", after {0} {1}", trigger->GetAfter(), FsmTrigger::TimerUnitToString(trigger->GetAfterUnit()));
+                else if (trigger->IsEventDriven())
+                    priority += fmt::format(", on {0}", trigger->GetEvent());
                 ImVec2 position;
                 ImVec2 positionPriority;
                 if (
@@ -149,21 +156,36 @@ namespace LuaFsm
             switch (m_Type)
             {
             case NodeType::State:
-                if (const auto state = editor->GetCurrentFsm()->GetState(m_Id); state && !state->GetDescription().empty())
+                if (const auto state = editor->GetCurrentFsm()->GetState(m_Id))
                 {
-                    if (ImGui::BeginTooltip())
+                    const auto profile = editor->GetStateProfile(m_Id);
+                    if ((!state->GetDescription().empty() || profile) && ImGui::BeginTooltip())
                     {
-                        ImGui::Text(state->GetDescription().c_str());
+                        if (!state->GetDescription().empty())
+                            ImGui::Text(state->GetDescription().c_str());
+                        if (profile)
+                        {
+                            ImGui::Text("onEnter: %lld calls, %.3f ms", static_cast<long long>(profile->enters), profile->enterTime * 1000.0);
+                            ImGui::Text("onUpdate: %lld calls, %.3f ms", static_cast<long long>(profile->updates), profile->updateTime * 1000.0);
+                            ImGui::Text("onExit: %lld calls, %.3f ms", static_cast<long long>(profile->exits), profile->exitTime * 1000.0);
+                        }
                         ImGui::EndTooltip();
                     }
                 }
                 break;
             case NodeType::Transition:
-                if (const auto trigger = editor->GetCurrentFsm()->GetTrigger(m_Id); trigger && !trigger->GetDescription().empty())
+                if (const auto trigger = editor->GetCurrentFsm()->GetTrigger(m_Id))
                 {
-                    if (ImGui::BeginTooltip())
+                    const auto profile = editor->GetConditionProfile(m_Id);
+                    if ((!trigger->GetDescription().empty() || profile) && ImGui::BeginTooltip())
                     {
-                        ImGui::Text(trigger->GetDescription().c_str());
+                        if (!trigger->GetDescription().empty())
+                            ImGui::Text(trigger->GetDescription().c_str());
+                        if (profile)
+                        {
+                            ImGui::Text("evaluated: %lld times, %.3f ms", static_cast<long long>(profile->evaluations), profile->evaluationTime * 1000.0);
+                            ImGui::Text("transitions: %lld", static_cast<long long>(profile->transitions));
+                        }
                         ImGui::EndTooltip();
                     }
                 }
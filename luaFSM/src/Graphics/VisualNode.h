@@ -50,6 +50,24 @@ namespace LuaFsm
         }
     };
     
+    /**
+     * \brief Editor layout of a node that ends up in the generated code
+     */
+    struct NodeLayout
+    {
+        ImVec2 gridPos{};
+        ImVec4 color{};
+        float inArrowCurve = 0.0f;
+        float outArrowCurve = 0.0f;
+        bool operator==(const NodeLayout& other) const
+        {
+            return gridPos == other.gridPos
+            && color == other.color
+            && inArrowCurve == other.inArrowCurve
+            && outArrowCurve == other.outArrowCurve;
+        }
+    };
+    
     class VisualNode
     {
     public:
@@ -137,6 +155,7 @@ namespace LuaFsm
         [[nodiscard]] ImVec2 GetLastDrawPos() const { return m_LastPosition; }
 
         ImVec2 GetGridPos() const { return m_GridPos; }
+        [[nodiscard]] NodeLayout GetLayout() const { return {m_GridPos, m_Color.Value, m_InArrowCurve, m_OutArrowCurve}; }
         void SetGridPos(const ImVec2& gridPos) { m_GridPos = gridPos; }
         ImVec2 GetEllipseRadius() const { return m_EllipseRadius; }
         void SetEllipseRadius(const ImVec2& ellipseRadius) { m_EllipseRadius = ellipseRadius; }
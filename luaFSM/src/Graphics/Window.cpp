@@ -1,5 +1,6 @@
 ﻿#include "pch.h"
 #include "Window.h"
+#include <future>
 #include "stb_image.h"
 #include "imgui/ImGuiImpl.h"
 #include "imgui.h"
@@ -13,6 +14,7 @@
 #include "imgui/ImGuiNotify.hpp"
 #include "imgui/IconsFontAwesome6.h"
 #include "imgui/popups/Popup.h"
+#include "runtime/FsmHost.h"
 
 //callback for window close glfw
 bool SHUTDOWN = false;
@@ -39,6 +41,33 @@ namespace LuaFsm
     bool DOCK_SPACE_SET = false;
 
     bool HELP_WINDOW_OPEN = false;
+
+    //Trace replay playback
+    bool TRACE_PLAYING = false;
+    float TRACE_PLAY_SPEED = 4.0f;
+    float TRACE_PLAY_TIME = 0.0f;
+
+    //Simulation panel
+    bool SIMULATION_WINDOW_OPEN = false;
+    bool SIMULATION_PLAYING = false;
+    int SIMULATION_INSTANCES = 1;
+    int SIMULATION_TICKS_PER_FRAME = 1;
+    int SIMULATION_BENCHMARK_TICKS = 1000;
+    int SIMULATION_WATCHED_INSTANCE = 1;
+    bool SIMULATION_PROFILE = true;
+    float SIMULATION_PROFILE_REFRESH = 0.0f;
+    std::string SIMULATION_INPUTS = LuaSimulation::defaultInputScript;
+    FsmProfile SIMULATION_TIMINGS;
+    FsmScalingBenchmark SIMULATION_SCALING{.maxThreads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()))};
+    std::vector<FsmScalingResult> SIMULATION_SCALING_RESULTS;
+    //The benchmark runs on its own thread, the panel polls it every frame
+    struct ScalingOutcome
+    {
+        std::vector<FsmScalingResult> results;
+        std::string error;
+    };
+    std::future<ScalingOutcome> SIMULATION_SCALING_TASK;
+    FsmScalingProgress SIMULATION_SCALING_PROGRESS;
     
     ImVec2 CURSOR_POS = {0, 0};
     bool ADD_NEW_STATE_AT_CURSOR = false;
@@ -91,6 +120,12 @@ namespace LuaFsm
 
     void Window::Shutdown() const
     {
+        //Lets a running benchmark stop after its current tick instead of holding up the exit
+        if (SIMULATION_SCALING_TASK.valid())
+        {
+            SIMULATION_SCALING_PROGRESS.cancel = true;
+            SIMULATION_SCALING_TASK.wait();
+        }
         ImGui_ImplOpenGL3_Shutdown();
         ImGui_ImplGlfw_Shutdown();
         ImGui::DestroyContext();
@@ -189,6 +224,16 @@ namespace LuaFsm
         m_PopupManager.AddPopup(WindowPopups::LoadFile, std::make_shared<LoadFile>());
         m_PopupManager.AddPopup(WindowPopups::CreateFilePopup, std::make_shared<CreateFilePopup>());
         m_PopupManager.AddPopup(WindowPopups::OptionsPopup, std::make_shared<OptionsPopUp>());
+        m_PopupManager.AddPopup(WindowPopups::ExportFlatLua, std::make_shared<ExportFilePopup>(
+            "ExportFlatLua", static_cast<int>(ExportTarget::FlatLua), ".lua", "{0}_flat.lua"));
+        m_PopupManager.AddPopup(WindowPopups::ExportLuaJitFfi, std::make_shared<ExportFilePopup>(
+            "ExportLuaJitFfi", static_cast<int>(ExportTarget::LuaJitFfi), ".lua", "{0}_ffi.lua"));
+        m_PopupManager.AddPopup(WindowPopups::ExportCppHeader, std::make_shared<ExportFilePopup>(
+            "ExportCppHeader", static_cast<int>(ExportTarget::CppHeader), ".h", "{0}.h"));
+        m_PopupManager.AddPopup(WindowPopups::ExportReleaseRuntime, std::make_shared<ExportFilePopup>(
+            "ExportReleaseRuntime", static_cast<int>(ExportTarget::ReleaseRuntime), ".lua", "FSM.lua"));
+        m_PopupManager.AddPopup(WindowPopups::LoadProfile, std::make_shared<LoadProfilePopup>());
+        m_PopupManager.AddPopup(WindowPopups::LoadTrace, std::make_shared<LoadTracePopup>());
         
         const auto addStateCursor = std::make_shared<AddStatePopup>("AddStateCursor");
         addStateCursor->isDrawn = true;
@@ -237,6 +282,8 @@ namespace LuaFsm
         Canvas();
         Properties();
         HelpWindow();
+        TraceReplayWindow();
+        SimulationWindow();
         if (NodeEditor::Get()->GetCurrentFsm() && check)
             NodeEditor::Get()->GetCurrentFsm()->CheckForChanges();
         ImGui::PopFont(); //Main editor font
@@ -313,6 +360,24 @@ namespace LuaFsm
                     //Save to Lua File
                     if (!linkedFile.empty() && ImGui::MenuItem("Save"))
                         fsm->UpdateToFile(fsm->GetId());
+                    //Standalone export targets
+                    if (ImGui::BeginMenu("Export"))
+                    {
+                        if (ImGui::MenuItem("Flattened Lua"))
+                            popupManager->OpenPopup(WindowPopups::ExportFlatLua);
+                        ImGui::SetItemTooltip("Standalone module with integer states and a single update function");
+                        if (ImGui::MenuItem("LuaJIT FFI"))
+                            popupManager->OpenPopup(WindowPopups::ExportLuaJitFfi);
+                        ImGui::SetItemTooltip("LuaJIT module with pools of machines in FFI arrays, the tick loop compiles to a trace");
+                        if (ImGui::MenuItem("C++ Header"))
+                            popupManager->OpenPopup(WindowPopups::ExportCppHeader);
+                        ImGui::SetItemTooltip("Header-only state machine with callback hooks, plus a microbenchmark");
+                        ImGui::Separator();
+                        if (ImGui::MenuItem("Release FSM.lua"))
+                            popupManager->OpenPopup(WindowPopups::ExportReleaseRuntime);
+                        ImGui::SetItemTooltip("Copy of the lua runtime with all TRACE logging removed");
+                        ImGui::EndMenu();
+                    }
                 }
                 ImGui::Separator();
                 //Exit
@@ -321,6 +386,83 @@ namespace LuaFsm
                 ImGui::EndMenu();
             }
             
+            /*-----------------------------*\
+                      Profile menu
+            \*-----------------------------*/
+            if (fsm && ImGui::BeginMenu("Profile"))
+            {
+                const auto nodeEditor = NodeEditor::Get();
+                if (ImGui::MenuItem("Load Profile"))
+                    popupManager->OpenPopup(WindowPopups::LoadProfile);
+                ImGui::SetItemTooltip("Load a file written by FSM_PROFILER:write and colour the graph by it");
+                if (nodeEditor->HasProfile())
+                {
+                    bool showHeatmap = nodeEditor->ShowHeatmap();
+                    if (ImGui::MenuItem("Show Heatmap", nullptr, &showHeatmap))
+                        nodeEditor->SetShowHeatmap(showHeatmap);
+                    ImGui::Separator();
+                    const auto metric = nodeEditor->GetHeatmapMetric();
+                    if (ImGui::MenuItem("Colour by Time", nullptr, metric == ProfileMetric::Time))
+                    {
+                        nodeEditor->SetHeatmapMetric(ProfileMetric::Time);
+                        nodeEditor->SaveSettings();
+                    }
+                    ImGui::SetItemTooltip("Seconds spent in state functions and condition evaluations");
+                    if (ImGui::MenuItem("Colour by Frequency", nullptr, metric == ProfileMetric::Frequency))
+                    {
+                        nodeEditor->SetHeatmapMetric(ProfileMetric::Frequency);
+                        nodeEditor->SaveSettings();
+                    }
+                    ImGui::SetItemTooltip("States by updates, conditions by evaluations and their outgoing links by transitions taken");
+                    ImGui::Separator();
+                    bool profileGuided = nodeEditor->ProfileGuidedExport();
+                    if (ImGui::MenuItem("Order Exports by Profile", nullptr, &profileGuided))
+                    {
+                        nodeEditor->SetProfileGuidedExport(profileGuided);
+                        nodeEditor->SaveSettings();
+                    }
+                    ImGui::SetItemTooltip("Flat lua, LuaJIT FFI and C++ exports test the hottest equal priority conditions first, flat lua the hottest states too");
+                    ImGui::Separator();
+                    if (ImGui::MenuItem("Clear Profile"))
+                        nodeEditor->ClearProfile();
+                }
+                ImGui::EndMenu();
+            }
+            
+            /*-----------------------------*\
+                       Trace menu
+            \*-----------------------------*/
+            if (fsm && ImGui::BeginMenu("Trace"))
+            {
+                const auto nodeEditor = NodeEditor::Get();
+                if (ImGui::MenuItem("Load Trace"))
+                    popupManager->OpenPopup(WindowPopups::LoadTrace);
+                ImGui::SetItemTooltip("Load a file written by FSM_TRACE:dump and replay its state changes on the graph");
+                if (nodeEditor->HasTrace())
+                {
+                    bool showReplay = nodeEditor->ShowTraceReplay();
+                    if (ImGui::MenuItem("Show Replay", nullptr, &showReplay))
+                        nodeEditor->SetShowTraceReplay(showReplay);
+                    ImGui::Separator();
+                    if (ImGui::MenuItem("Clear Trace"))
+                    {
+                        nodeEditor->ClearTrace();
+                        TRACE_PLAYING = false;
+                    }
+                }
+                ImGui::EndMenu();
+            }
+            
+            /*-----------------------------*\
+                     Simulation menu
+            \*-----------------------------*/
+            if (fsm && ImGui::BeginMenu("Simulate"))
+            {
+                ImGui::MenuItem("Simulation Panel", nullptr, &SIMULATION_WINDOW_OPEN);
+                ImGui::SetItemTooltip("Run the linked file with FSM.lua in an embedded lua state and measure it");
+                ImGui::EndMenu();
+            }
+            
             /*-----------------------------*\
                        Theme menu
             \*-----------------------------*/
@@ -994,6 +1136,416 @@ namespace LuaFsm
         }
     }
 
+    void Window::TraceReplayWindow()
+    {
+        const auto nodeEditor = NodeEditor::Get();
+        if (!nodeEditor->HasTrace() || !nodeEditor->ShowTraceReplay())
+            return;
+        const auto viewPort = ImGui::GetMainViewport();
+        ImGui::SetNextWindowPos(viewPort->Pos + ImVec2(viewPort->Size.x * 0.3f, viewPort->Size.y * 0.6f), ImGuiCond_Once);
+        ImGui::SetNextWindowSize({viewPort->Size.x * 0.4f, viewPort->Size.y * 0.3f}, ImGuiCond_Once);
+        bool open = true;
+        ImGui::Begin("Trace Replay", &open,
+            ImGuiWindowFlags_NoDocking
+            | ImGuiWindowFlags_NoCollapse);
+        {
+            const auto& trace = nodeEditor->GetTrace();
+            const auto& view = nodeEditor->GetTraceView();
+            if (!nodeEditor->IsTraceShown())
+            {
+                ImGui::TextWrapped("The trace was recorded for FSM %s, open that FSM to replay it.", trace.fsmId.c_str());
+                TRACE_PLAYING = false;
+                ImGui::End();
+                if (!open)
+                    nodeEditor->SetShowTraceReplay(false);
+                return;
+            }
+
+            //Instance filter
+            const auto instance = nodeEditor->GetTraceInstance();
+            const std::string instanceLabel = instance == 0 ? "All instances" : "Instance " + std::to_string(instance);
+            ImGui::SetNextItemWidth(200);
+            if (ImGui::BeginCombo("##traceInstance", instanceLabel.c_str()))
+            {
+                if (ImGui::Selectable("All instances", instance == 0))
+                    nodeEditor->SetTraceInstance(0);
+                for (const auto traceInstance : trace.instances)
+                {
+                    const std::string label = "Instance " + std::to_string(traceInstance);
+                    if (ImGui::Selectable(label.c_str(), instance == traceInstance))
+                        nodeEditor->SetTraceInstance(traceInstance);
+                }
+                ImGui::EndCombo();
+            }
+
+            //Transport
+            const int last = static_cast<int>(view.size()) - 1;
+            const int position = nodeEditor->GetTracePosition();
+            ImGui::SameLine();
+            if (ImGui::Button(ICON_FA_BACKWARD_FAST))
+                nodeEditor->SetTracePosition(0);
+            ImGui::SameLine();
+            if (ImGui::Button(ICON_FA_BACKWARD_STEP))
+                nodeEditor->SetTracePosition(position - 1);
+            ImGui::SameLine();
+            if (ImGui::Button(TRACE_PLAYING ? ICON_FA_PAUSE : ICON_FA_PLAY))
+            {
+                TRACE_PLAYING = !TRACE_PLAYING;
+                TRACE_PLAY_TIME = 0.0f;
+                if (TRACE_PLAYING && position >= last)
+                    nodeEditor->SetTracePosition(0);
+            }
+            ImGui::SameLine();
+            if (ImGui::Button(ICON_FA_FORWARD_STEP))
+                nodeEditor->SetTracePosition(position + 1);
+            ImGui::SameLine();
+            if (ImGui::Button(ICON_FA_FORWARD_FAST))
+                nodeEditor->SetTracePosition(last);
+            ImGui::SameLine();
+            ImGui::SetNextItemWidth(150);
+            ImGui::SliderFloat("Changes/s", &TRACE_PLAY_SPEED, 0.5f, 60.0f, "%.1f", ImGuiSliderFlags_Logarithmic);
+            ImGui::SameLine();
+            bool follow = nodeEditor->FollowTrace();
+            if (ImGui::Checkbox("Follow", &follow))
+                nodeEditor->SetFollowTrace(follow);
+            ImGui::SetItemTooltip("Scroll the canvas to the new state of every record");
+
+            if (TRACE_PLAYING)
+            {
+                TRACE_PLAY_TIME += ImGui::GetIO().DeltaTime * TRACE_PLAY_SPEED;
+                if (TRACE_PLAY_TIME >= 1.0f)
+                {
+                    const int steps = static_cast<int>(TRACE_PLAY_TIME);
+                    TRACE_PLAY_TIME -= static_cast<float>(steps);
+                    nodeEditor->SetTracePosition(nodeEditor->GetTracePosition() + steps);
+                    if (nodeEditor->GetTracePosition() >= last)
+                        TRACE_PLAYING = false;
+                }
+            }
+
+            //Scrubber
+            int scrub = nodeEditor->GetTracePosition();
+            ImGui::SetNextItemWidth(-1);
+            if (ImGui::SliderInt("##traceScrubber", &scrub, 0, std::max(0, last), "%d"))
+                nodeEditor->SetTracePosition(scrub);
+            if (const auto record = nodeEditor->GetTraceRecord())
+            {
+                ImGui::Text("Tick %u, instance %u: %s -> %s", record->tick, record->instance,
+                    record->fromState.empty() ? "(initial)" : record->fromState.c_str(), record->toState.c_str());
+                if (!record->condition.empty())
+                {
+                    ImGui::SameLine();
+                    ImGui::Text("by %s", record->condition.c_str());
+                }
+            }
+            ImGui::Separator();
+
+            //Records
+            ImGui::BeginChild("##traceRecords");
+            ImGuiListClipper clipper;
+            clipper.Begin(static_cast<int>(view.size()));
+            while (clipper.Step())
+            {
+                for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; ++i)
+                {
+                    const auto& record = trace.records[view[i]];
+                    const std::string label = std::to_string(record.tick) + "  #" + std::to_string(record.instance) + "  "
+                        + (record.fromState.empty() ? "(initial)" : record.fromState) + " -> " + record.toState
+                        + (record.condition.empty() ? "" : "  by " + record.condition) + "##traceRecord" + std::to_string(i);
+                    if (ImGui::Selectable(label.c_str(), i == nodeEditor->GetTracePosition()))
+                    {
+                        nodeEditor->SetTracePosition(i);
+                        TRACE_PLAYING = false;
+                    }
+                }
+            }
+            //Keep the current record in the middle of the list while playing
+            if (TRACE_PLAYING)
+                ImGui::SetScrollY(static_cast<float>(nodeEditor->GetTracePosition()) * ImGui::GetTextLineHeightWithSpacing()
+                    - ImGui::GetWindowHeight() / 2);
+            ImGui::EndChild();
+        }
+        ImGui::End();
+        nodeEditor->HighlightTraceRecord();
+        if (!open)
+        {
+            nodeEditor->SetShowTraceReplay(false);
+            TRACE_PLAYING = false;
+        }
+    }
+
+    void Window::SimulationWindow()
+    {
+        const auto nodeEditor = NodeEditor::Get();
+        auto& simulation = nodeEditor->GetSimulation();
+        const auto fsm = nodeEditor->GetCurrentFsm();
+        //Opening another FSM ends the simulation of the last one
+        if (simulation.IsRunning() && (!fsm || simulation.GetFsmId() != fsm->GetId()))
+        {
+            simulation.Stop();
+            SIMULATION_PLAYING = false;
+            nodeEditor->HighlightSimulationState("");
+        }
+        if (!SIMULATION_WINDOW_OPEN || !fsm)
+            return;
+        const auto viewPort = ImGui::GetMainViewport();
+        ImGui::SetNextWindowPos(viewPort->Pos + ImVec2(viewPort->Size.x * 0.55f, viewPort->Size.y * 0.15f), ImGuiCond_Once);
+        ImGui::SetNextWindowSize({viewPort->Size.x * 0.35f, viewPort->Size.y * 0.7f}, ImGuiCond_Once);
+        ImGui::Begin("Simulation", &SIMULATION_WINDOW_OPEN,
+            ImGuiWindowFlags_NoDocking
+            | ImGuiWindowFlags_NoCollapse);
+        {
+            const bool running = simulation.IsRunning();
+
+            //Setup
+            ImGui::BeginDisabled(running);
+            ImGui::SetNextItemWidth(150);
+            if (ImGui::InputInt("Instances", &SIMULATION_INSTANCES))
+                SIMULATION_INSTANCES = std::clamp(SIMULATION_INSTANCES, 1, 100000);
+            ImGui::SameLine();
+            ImGui::Checkbox("Profile", &SIMULATION_PROFILE);
+            ImGui::SetItemTooltip("Time the state functions and conditions with FSM_PROFILER, shown as heatmap on the canvas");
+            ImGui::Text("Inputs:");
+            ImGui::InputTextMultiline("##simulationInputs", &SIMULATION_INPUTS, {ImGui::GetContentRegionAvail().x, 100});
+            ImGui::EndDisabled();
+            if (fsm->IsUnSaved() || fsm->IsUnSavedGlobal())
+                ImGui::TextColored({0.9f, 0.7f, 0.2f, 1.0f}, "The simulation runs the saved file, unsaved changes are left out");
+
+            //Controls
+            if (!running)
+            {
+                if (ImGui::Button("Start"))
+                {
+                    SIMULATION_TIMINGS = {};
+                    SimulationCode code;
+                    std::string error;
+                    if (!SimulationCode::Read(*fsm, SIMULATION_INPUTS, code, error))
+                        ImGui::InsertNotification({ImGuiToastType::Error, 5000, "Simulation failed to start: %s", error.c_str()});
+                    else if (!simulation.Start(code, SIMULATION_INSTANCES, SIMULATION_PROFILE))
+                        ImGui::InsertNotification({ImGuiToastType::Error, 5000, "Simulation failed to start: %s", simulation.GetError().c_str()});
+                    else if (SIMULATION_PROFILE)
+                        nodeEditor->SetShowHeatmap(true);
+                }
+            }
+            else
+            {
+                if (ImGui::Button(SIMULATION_PLAYING ? ICON_FA_PAUSE " Pause" : ICON_FA_PLAY " Play"))
+                    SIMULATION_PLAYING = !SIMULATION_PLAYING;
+                ImGui::SameLine();
+                if (ImGui::Button(ICON_FA_FORWARD_STEP " Step"))
+                {
+                    SIMULATION_PLAYING = false;
+                    if (!simulation.Run(1))
+                        ImGui::InsertNotification({ImGuiToastType::Error, 5000, "Simulation error: %s", simulation.GetError().c_str()});
+                }
+                ImGui::SameLine();
+                if (ImGui::Button("Run"))
+                {
+                    SIMULATION_PLAYING = false;
+                    if (!simulation.Run(SIMULATION_BENCHMARK_TICKS))
+                        ImGui::InsertNotification({ImGuiToastType::Error, 5000, "Simulation error: %s", simulation.GetError().c_str()});
+                    SIMULATION_PROFILE_REFRESH = 0.0f;
+                }
+                ImGui::SetItemTooltip("Run this many ticks at once, to measure the throughput without the editor frames in between");
+                ImGui::SameLine();
+                ImGui::SetNextItemWidth(120);
+                if (ImGui::InputInt("ticks", &SIMULATION_BENCHMARK_TICKS, 100, 1000))
+                    SIMULATION_BENCHMARK_TICKS = std::clamp(SIMULATION_BENCHMARK_TICKS, 1, 10000000);
+                ImGui::SameLine();
+                if (ImGui::Button("Reset"))
+                {
+                    simulation.Stop();
+                    SIMULATION_PLAYING = false;
+                    nodeEditor->HighlightSimulationState("");
+                }
+                ImGui::SetNextItemWidth(150);
+                ImGui::SliderInt("Ticks per frame", &SIMULATION_TICKS_PER_FRAME, 1, 1000, "%d", ImGuiSliderFlags_Logarithmic);
+            }
+
+            if (simulation.IsRunning() && SIMULATION_PLAYING && !simulation.Run(SIMULATION_TICKS_PER_FRAME))
+            {
+                SIMULATION_PLAYING = false;
+                ImGui::InsertNotification({ImGuiToastType::Error, 5000, "Simulation error: %s", simulation.GetError().c_str()});
+            }
+
+            if (simulation.IsRunning())
+            {
+                ImGui::Separator();
+                ImGui::Text("Tick %lld", static_cast<long long>(simulation.GetTick()));
+                ImGui::Text("%.0f ticks/s, %.0f updates/s", simulation.GetTicksPerSecond(), simulation.GetUpdatesPerSecond());
+                ImGui::SetItemTooltip("Measured over the time spent running ticks, without the editor in between");
+                ImGui::Text("Lua memory %.1f KB", simulation.GetMemory());
+
+                //Watched instance, its state is highlighted on the canvas
+                ImGui::SetNextItemWidth(150);
+                if (ImGui::InputInt("Watch instance", &SIMULATION_WATCHED_INSTANCE))
+                    SIMULATION_WATCHED_INSTANCE = std::clamp(SIMULATION_WATCHED_INSTANCE, 1, simulation.GetInstanceCount());
+                const auto currentState = simulation.GetCurrentState(SIMULATION_WATCHED_INSTANCE);
+                ImGui::SameLine();
+                ImGui::Text("in %s", currentState.empty() ? "(no state)" : currentState.c_str());
+                nodeEditor->HighlightSimulationState(currentState);
+
+                //Timings, refreshed a few times a second since formatting the profile walks every record
+                SIMULATION_PROFILE_REFRESH -= ImGui::GetIO().DeltaTime;
+                if (SIMULATION_PROFILE && SIMULATION_PROFILE_REFRESH <= 0.0f)
+                {
+                    SIMULATION_PROFILE_REFRESH = 0.25f;
+                    if (FsmProfile timings; simulation.GetProfile(timings))
+                    {
+                        SIMULATION_TIMINGS = timings;
+                        nodeEditor->SetProfile(std::move(timings));
+                    }
+                }
+
+                const auto counts = simulation.GetStateCounts();
+                if (ImGui::BeginTable("##simulationStates", 5, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingStretchProp))
+                {
+                    ImGui::TableSetupColumn("State");
+                    ImGui::TableSetupColumn("Instances");
+                    ImGui::TableSetupColumn("Updates");
+                    ImGui::TableSetupColumn("us/update");
+                    ImGui::TableSetupColumn("Enters");
+                    ImGui::TableHeadersRow();
+                    for (const auto& [id, state] : fsm->GetStates())
+                    {
+                        ImGui::TableNextRow();
+                        ImGui::TableNextColumn();
+                        ImGui::TextUnformatted(id.c_str());
+                        ImGui::TableNextColumn();
+                        const auto count = counts.find(id);
+                        ImGui::Text("%d", count != counts.end() ? count->second : 0);
+                        const auto timing = SIMULATION_TIMINGS.GetState(id);
+                        ImGui::TableNextColumn();
+                        ImGui::Text("%lld", timing ? static_cast<long long>(timing->updates) : 0ll);
+                        ImGui::TableNextColumn();
+                        if (timing && timing->updates > 0)
+                            ImGui::Text("%.3f", timing->updateTime * 1e6 / static_cast<double>(timing->updates));
+                        else
+                            ImGui::TextUnformatted("-");
+                        ImGui::TableNextColumn();
+                        ImGui::Text("%lld", timing ? static_cast<long long>(timing->enters) : 0ll);
+                    }
+                    ImGui::EndTable();
+                }
+            }
+
+            //Thread scaling of the native host, measured on a background thread
+            if (SIMULATION_SCALING_TASK.valid() && SIMULATION_SCALING_TASK.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+            {
+                auto outcome = SIMULATION_SCALING_TASK.get();
+                SIMULATION_SCALING_RESULTS = std::move(outcome.results);
+                if (SIMULATION_SCALING_PROGRESS.cancel)
+                    ImGui::InsertNotification({ImGuiToastType::Info, 3000, "Thread scaling cancelled"});
+                else if (!outcome.error.empty())
+                    ImGui::InsertNotification({ImGuiToastType::Error, 5000, "Thread scaling failed: %s", outcome.error.c_str()});
+            }
+            if (ImGui::CollapsingHeader("Thread scaling"))
+            {
+                const bool measuring = SIMULATION_SCALING_TASK.valid();
+                ImGui::BeginDisabled(measuring);
+                ImGui::SetNextItemWidth(150);
+                if (ImGui::InputInt("Instances##scaling", &SIMULATION_SCALING.instances, 1000, 10000))
+                    SIMULATION_SCALING.instances = std::clamp(SIMULATION_SCALING.instances, 1, 10000000);
+                ImGui::SameLine();
+                ImGui::SetNextItemWidth(150);
+                if (ImGui::InputInt("Ticks##scaling", &SIMULATION_SCALING.ticks, 10, 100))
+                    SIMULATION_SCALING.ticks = std::clamp(SIMULATION_SCALING.ticks, 1, 100000);
+                ImGui::SetNextItemWidth(150);
+                if (ImGui::InputInt("Max threads", &SIMULATION_SCALING.maxThreads))
+                    SIMULATION_SCALING.maxThreads = std::clamp(SIMULATION_SCALING.maxThreads, 1, 256);
+                ImGui::SameLine();
+                ImGui::SetNextItemWidth(150);
+                if (ImGui::InputInt("Shards per thread", &SIMULATION_SCALING.shardsPerWorker))
+                    SIMULATION_SCALING.shardsPerWorker = std::clamp(SIMULATION_SCALING.shardsPerWorker, 1, 64);
+                ImGui::SetItemTooltip("Every shard is a lua state, idle threads take the shards of busy ones");
+                ImGui::EndDisabled();
+                if (!measuring)
+                {
+                    if (ImGui::Button("Measure"))
+                    {
+                        SimulationCode code;
+                        std::string error;
+                        SIMULATION_SCALING_RESULTS.clear();
+                        if (!SimulationCode::Read(*fsm, SIMULATION_INPUTS, code, error))
+                            ImGui::InsertNotification({ImGuiToastType::Error, 5000, "Thread scaling failed: %s", error.c_str()});
+                        else
+                        {
+                            SIMULATION_SCALING_PROGRESS.cancel = false;
+                            SIMULATION_SCALING_PROGRESS.ticksDone = 0;
+                            SIMULATION_SCALING_PROGRESS.ticksTotal = 0;
+                            SIMULATION_SCALING_TASK = std::async(std::launch::async, [benchmark = SIMULATION_SCALING, code = std::move(code)]
+                            {
+                                ScalingOutcome outcome;
+                                outcome.results = benchmark.Run(code, outcome.error, &SIMULATION_SCALING_PROGRESS);
+                                return outcome;
+                            });
+                        }
+                    }
+                    ImGui::SetItemTooltip("Tick the instances with 1, 2, 4... up to max threads, one lua state per shard");
+                }
+                else
+                {
+                    const int total = SIMULATION_SCALING_PROGRESS.ticksTotal;
+                    const int done = SIMULATION_SCALING_PROGRESS.ticksDone;
+                    ImGui::ProgressBar(total > 0 ? static_cast<float>(done) / static_cast<float>(total) : 0.0f, {300, 0},
+                                       fmt::format("{0}/{1} ticks", done, total).c_str());
+                    ImGui::SameLine();
+                    ImGui::BeginDisabled(SIMULATION_SCALING_PROGRESS.cancel);
+                    if (ImGui::Button("Cancel##scaling"))
+                        SIMULATION_SCALING_PROGRESS.cancel = true;
+                    ImGui::EndDisabled();
+                }
+                if (!SIMULATION_SCALING_RESULTS.empty()
+                    && ImGui::BeginTable("##simulationScaling", 4, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingStretchProp))
+                {
+                    ImGui::TableSetupColumn("Threads");
+                    ImGui::TableSetupColumn("Updates/s");
+                    ImGui::TableSetupColumn("Speedup");
+                    ImGui::TableSetupColumn("Stolen shards");
+                    ImGui::TableHeadersRow();
+                    for (const auto& result : SIMULATION_SCALING_RESULTS)
+                    {
+                        ImGui::TableNextRow();
+                        ImGui::TableNextColumn();
+                        ImGui::Text("%d", result.threads);
+                        ImGui::TableNextColumn();
+                        ImGui::Text("%.0f", result.updatesPerSecond);
+                        ImGui::TableNextColumn();
+                        ImGui::Text("%.2fx", result.speedup);
+                        ImGui::TableNextColumn();
+                        ImGui::Text("%lld", static_cast<long long>(result.stolen));
+                    }
+                    ImGui::EndTable();
+                }
+            }
+
+            if (!simulation.GetError().empty())
+            {
+                ImGui::Separator();
+                ImGui::PushTextWrapPos();
+                ImGui::TextColored({0.9f, 0.3f, 0.3f, 1.0f}, "%s", simulation.GetError().c_str());
+                ImGui::PopTextWrapPos();
+            }
+            if (!simulation.GetOutput().empty())
+            {
+                ImGui::Separator();
+                ImGui::Text("Output:");
+                ImGui::BeginChild("##simulationOutput");
+                for (const auto& line : simulation.GetOutput())
+                    ImGui::TextUnformatted(line.c_str());
+                if (ImGui::GetScrollY() >= ImGui::GetScrollMaxY())
+                    ImGui::SetScrollHereY(1.0f);
+                ImGui::EndChild();
+            }
+        }
+        ImGui::End();
+        if (!SIMULATION_WINDOW_OPEN)
+        {
+            SIMULATION_PLAYING = false;
+            nodeEditor->HighlightSimulationState("");
+        }
+    }
+
     void Window::HelpWindow()
     {
         if (!HELP_WINDOW_OPEN)
@@ -1025,6 +1577,14 @@ namespace LuaFsm
             ImGui::Text("Release on another node - Create connection");
             ImGui::Text("Release on empty canvas space - Create node");
             ImGui::Separator();
+            ImGui::Text("Profiling:");
+            ImGui::Separator();
+            ImGui::Text("FSM_PROFILER:start() / stop() / write(path) in lua - Record state and condition timings");
+            ImGui::Text("Profile > Load Profile - Colour nodes and links by time or frequency, hover a node for its numbers");
+            ImGui::Text("FSM_TRACE:start(capacity) / stop() / dump(path) in lua - Record the latest state changes of every instance");
+            ImGui::Text("Trace > Load Trace - Step through the state changes, the new state and its condition get highlighted");
+            ImGui::Text("Simulate > Simulation Panel - Tick instances of the saved FSM with an input script, timings show as heatmap");
+            ImGui::Separator();
             ImGui::Text("Various elements have right click context menu's, including the canvas.");
             ImGui::Separator();
             ImGui::Text("Help:");
@@ -1068,14 +1628,21 @@ format the program expects in the Lua Code sections of each properties page.
         }
     }
 
-    void Window::DrawTextEditor(TextEditor& txtEditor, std::string& oldText)
+    bool Window::DrawTextEditor(std::unique_ptr<TextEditor>& txtEditor, FunctionBody& body)
     {
-        txtEditor.SetPalette(m_Palette);
-        if (strcmp(txtEditor.GetText().c_str(), oldText.c_str()) != 0)
-            txtEditor.SetText(oldText);
-        txtEditor.Render("Code");
-        if (txtEditor.IsTextChanged())
-            oldText = txtEditor.GetText();
+        if (!txtEditor)
+        {
+            txtEditor = std::make_unique<TextEditor>();
+            txtEditor->SetLanguageDefinition(TextEditor::LanguageDefinition::Lua());
+        }
+        txtEditor->SetPalette(m_Palette);
+        if (strcmp(txtEditor->GetText().c_str(), body.Get().c_str()) != 0)
+            txtEditor->SetText(body.Get());
+        txtEditor->Render("Code");
+        if (!txtEditor->IsTextChanged())
+            return false;
+        body = txtEditor->GetText();
+        return true;
     }
 
     void Window::InitThemes()
@@ -1169,11 +1736,6 @@ format the program expects in the Lua Code sections of each properties page.
             glfwSwapInterval(0);
     }
     
-    void Window::TrimTrailingNewlines(std::string& str)
-    {
-        while (!str.empty() && (str.back() == '\n' || str.back() == '\r'))
-            str.pop_back();
-    }
 
 
     
@@ -26,6 +26,12 @@ namespace LuaFsm
         AddTriggerCursor,
         PasteTrigger,
         OptionsPopup,
+        ExportFlatLua,
+        ExportLuaJitFfi,
+        ExportCppHeader,
+        ExportReleaseRuntime,
+        LoadProfile,
+        LoadTrace,
     };
     
     struct WindowProps
@@ -94,8 +100,10 @@ namespace LuaFsm
         static void BeginImGui();
         static void OnImGuiRender();
         static void HelpWindow();
-        static void DrawTextEditor(TextEditor& txtEditor, std::string& oldText);
-        static void TrimTrailingNewlines(std::string& str);
+        static void TraceReplayWindow();
+        static void SimulationWindow();
+        //Creates the editor on first use, so objects whose functions are never opened do not hold one
+        static bool DrawTextEditor(std::unique_ptr<TextEditor>& txtEditor, FunctionBody& body);
         static void RenderNotifications();
         static void MainMenu();
         static void MainDockSpace();
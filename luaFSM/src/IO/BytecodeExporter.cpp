@@ -0,0 +1,119 @@
+﻿#include "pch.h"
+#include "BytecodeExporter.h"
+
+#include <filesystem>
+#include <fstream>
+
+extern "C" {
+#include "lua.h"
+#include "lauxlib.h"
+}
+
+#include <spdlog/fmt/bundled/format.h>
+
+#include "FileReader.h"
+
+namespace LuaFsm
+{
+    std::string BytecodeExporter::GetBytecodePath(const std::string& sourcePath)
+    {
+        return std::filesystem::path(sourcePath).replace_extension(Extension).string();
+    }
+
+    uint64_t BytecodeExporter::Hash(const std::string_view data)
+    {
+        //FNV-1a, only has to tell edited sources apart
+        uint64_t hash = 14695981039346656037ull;
+        for (const char c : data)
+        {
+            hash ^= static_cast<unsigned char>(c);
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    std::string BytecodeExporter::GetStamp(const std::string_view source)
+    {
+        return fmt::format("{0:016x} {1} {2}\n", Hash(source), source.size(), LUA_RELEASE);
+    }
+
+    bool BytecodeExporter::IsStale(const std::string& sourcePath, const std::string_view source)
+    {
+        const auto bytecodePath = GetBytecodePath(sourcePath);
+        const auto stampPath = bytecodePath + StampExtension;
+        if (!FileReader::FileExists(bytecodePath.c_str()) || !FileReader::FileExists(stampPath.c_str()))
+            return true;
+        return FileReader::ReadAllBytes(stampPath) != GetStamp(source);
+    }
+
+    bool BytecodeExporter::Compile(const std::string_view source, const std::string& chunkName, std::string& bytecode, std::string& error)
+    {
+        //Compiling needs no libraries, a bare state only parses and dumps
+        lua_State* L = luaL_newstate();
+        if (!L)
+        {
+            error = "Failed to create a lua state";
+            return false;
+        }
+        bool compiled = false;
+        if (luaL_loadbufferx(L, source.data(), source.size(), ("@" + chunkName).c_str(), "t") == LUA_OK)
+        {
+            bytecode.clear();
+            const auto writer = [](lua_State*, const void* data, const size_t size, void* output)
+            {
+                static_cast<std::string*>(output)->append(static_cast<const char*>(data), size);
+                return 0;
+            };
+            compiled = lua_dump(L, writer, &bytecode, 1) == 0;
+            if (!compiled)
+                error = "Failed to dump the compiled chunk";
+        }
+        else
+            error = lua_tostring(L, -1);
+        lua_close(L);
+        return compiled;
+    }
+
+    BytecodeExporter::Result BytecodeExporter::CompileFile(const std::string& sourcePath, std::string& error)
+    {
+        const auto source = FileReader::ReadAllBytes(sourcePath);
+        if (source.empty())
+        {
+            error = "Nothing to compile in " + sourcePath;
+            return Result::Failed;
+        }
+        if (!IsStale(sourcePath, source))
+            return Result::UpToDate;
+        std::string bytecode;
+        if (!Compile(source, std::filesystem::path(sourcePath).filename().string(), bytecode, error))
+            return Result::Failed;
+        const auto bytecodePath = GetBytecodePath(sourcePath);
+        //Stamp last, an interrupted export leaves the bytecode stale instead of trusted
+        std::error_code removeError;
+        std::filesystem::remove(bytecodePath + StampExtension, removeError);
+        std::ofstream file(bytecodePath, std::ios::binary);
+        if (!file.is_open())
+        {
+            error = "Failed to write " + bytecodePath;
+            return Result::Failed;
+        }
+        file.write(bytecode.data(), static_cast<std::streamsize>(bytecode.size()));
+        file.close();
+        if (!file.good())
+        {
+            error = "Failed to write " + bytecodePath;
+            return Result::Failed;
+        }
+        std::ofstream stamp(bytecodePath + StampExtension, std::ios::binary);
+        stamp << GetStamp(source);
+        stamp.close();
+        if (!stamp.good())
+        {
+            //A partial stamp must not survive, the next export compiles again
+            std::filesystem::remove(bytecodePath + StampExtension, removeError);
+            error = "Failed to write " + bytecodePath + StampExtension;
+            return Result::Failed;
+        }
+        return Result::Compiled;
+    }
+}
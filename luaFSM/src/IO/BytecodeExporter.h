@@ -0,0 +1,41 @@
+﻿#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace LuaFsm
+{
+    /**
+     * \brief Precompiles exported lua files to stripped bytecode with the embedded lua 5.4 compiler
+     *
+     * The bytecode is written next to the source (fsm.lua -> fsm.luac) and loads with loadfile, dofile
+     * or a "?.luac" entry in package.path, skipping the parser at startup. Debug info is stripped, so errors
+     * raised from it have no line numbers. Lua bytecode only loads in the same lua version with the same
+     * number types, it is no use to games running LuaJIT or another lua version.
+     * A stamp file with the hash of the source is kept next to the bytecode, so unchanged files aren't recompiled.
+     */
+    class BytecodeExporter
+    {
+    public:
+        enum class Result
+        {
+            Compiled,
+            UpToDate,
+            Failed
+        };
+
+        static constexpr const char* Extension = ".luac";
+        static constexpr const char* StampExtension = ".stamp";
+
+        [[nodiscard]] static std::string GetBytecodePath(const std::string& sourcePath);
+        //Compiles the file unless its bytecode was already compiled from the same source
+        static Result CompileFile(const std::string& sourcePath, std::string& error);
+        static bool Compile(std::string_view source, const std::string& chunkName, std::string& bytecode, std::string& error);
+        [[nodiscard]] static bool IsStale(const std::string& sourcePath, std::string_view source);
+
+    private:
+        //Identifies the source and the compiler, a new lua release invalidates the bytecode too
+        [[nodiscard]] static std::string GetStamp(std::string_view source);
+        [[nodiscard]] static uint64_t Hash(std::string_view data);
+    };
+}
@@ -0,0 +1,70 @@
+﻿#include "pch.h"
+#include "CodeWriter.h"
+
+#include <algorithm>
+
+namespace LuaFsm
+{
+    CodeWriter::CodeWriter(std::ostream& sink, const size_t flushThreshold)
+        : m_Sink(&sink), m_FlushThreshold(flushThreshold)
+    {
+        m_Buffer.reserve(flushThreshold + flushThreshold / 4);
+    }
+
+    CodeWriter::~CodeWriter()
+    {
+        if (m_Sink)
+            Flush();
+    }
+
+    void CodeWriter::Append(const std::string_view text)
+    {
+        m_Buffer.append(text.data(), text.data() + text.size());
+        FlushIfFull();
+    }
+
+    void CodeWriter::Append(const char character)
+    {
+        m_Buffer.push_back(character);
+    }
+
+    void CodeWriter::WriteFunctionBody(const std::string_view body)
+    {
+        size_t start = 0;
+        while (start <= body.size())
+        {
+            auto end = body.find('\n', start);
+            if (end == std::string_view::npos)
+                end = body.size();
+            auto line = body.substr(start, end - start);
+            if (!line.empty() && line.back() == '\r')
+                line.remove_suffix(1);
+            m_Buffer.push_back('\t');
+            m_Buffer.append(line.data(), line.data() + line.size());
+            m_Buffer.push_back('\n');
+            start = end + 1;
+        }
+        FlushIfFull();
+    }
+
+    size_t CodeWriter::EstimateFunctionBodySize(const std::string_view body)
+    {
+        const auto lines = static_cast<size_t>(std::ranges::count(body, '\n')) + 1;
+        return body.size() + lines * 2;
+    }
+
+    bool CodeWriter::UsesVarargs(const std::string_view body)
+    {
+        return body.find("...") != std::string_view::npos;
+    }
+
+    bool CodeWriter::Flush()
+    {
+        if (!m_Sink)
+            return false;
+        if (m_Buffer.size() > 0)
+            m_Sink->write(m_Buffer.data(), static_cast<std::streamsize>(m_Buffer.size()));
+        m_Buffer.clear();
+        return m_Sink->good();
+    }
+}
@@ -0,0 +1,93 @@
+﻿#pragma once
+#include <ostream>
+#include <string>
+#include <string_view>
+
+#include <spdlog/fmt/bundled/format.h>
+
+namespace LuaFsm
+{
+    /**
+     * \brief Writes generated code through a single growable buffer
+     *
+     * Without a sink the whole output stays in memory and can be taken with ToString().
+     * With a sink the buffer is flushed to it whenever it grows past the flush threshold,
+     * so exporting large machines never holds more than one chunk of code at a time.
+     */
+    class CodeWriter
+    {
+    public:
+        CodeWriter() = default;
+        explicit CodeWriter(const size_t sizeHint) { Reserve(sizeHint); }
+        explicit CodeWriter(std::ostream& sink, size_t flushThreshold = 64 * 1024);
+        ~CodeWriter();
+
+        CodeWriter(const CodeWriter&) = delete;
+        CodeWriter& operator=(const CodeWriter&) = delete;
+
+        void Reserve(const size_t size) { m_Buffer.reserve(size); }
+
+        template <typename... Args>
+        void Write(fmt::format_string<Args...> format, Args&&... args)
+        {
+            fmt::format_to(std::back_inserter(m_Buffer), format, std::forward<Args>(args)...);
+            FlushIfFull();
+        }
+
+        void Append(std::string_view text);
+        void Append(char character);
+
+        //Writes every line of a function body indented by one tab
+        void WriteFunctionBody(std::string_view body);
+
+        [[nodiscard]] static size_t EstimateFunctionBodySize(std::string_view body);
+
+        //Whether a function body refers to ..., lua 5.1 builds an arg table on every call to a vararg function that does not
+        [[nodiscard]] static bool UsesVarargs(std::string_view body);
+
+        [[nodiscard]] size_t GetSize() const { return m_Buffer.size(); }
+        [[nodiscard]] std::string_view GetView() const { return {m_Buffer.data(), m_Buffer.size()}; }
+        [[nodiscard]] std::string ToString() const { return {m_Buffer.data(), m_Buffer.size()}; }
+        void Clear() { m_Buffer.clear(); }
+
+        bool Flush();
+
+    private:
+        void FlushIfFull()
+        {
+            if (m_Sink && m_Buffer.size() >= m_FlushThreshold)
+                Flush();
+        }
+
+        fmt::memory_buffer m_Buffer;
+        std::ostream* m_Sink = nullptr;
+        size_t m_FlushThreshold = 0;
+    };
+
+    /**
+     * \brief Cached piece of generated code that is only rebuilt after it has been invalidated
+     */
+    class CodeFragment
+    {
+    public:
+        void Invalidate() { m_Valid = false; }
+        [[nodiscard]] bool IsValid() const { return m_Valid; }
+
+        template <typename Builder>
+        const std::string& Get(const size_t sizeHint, Builder&& build)
+        {
+            if (!m_Valid)
+            {
+                CodeWriter writer(sizeHint);
+                build(writer);
+                m_Code = writer.ToString();
+                m_Valid = true;
+            }
+            return m_Code;
+        }
+
+    private:
+        std::string m_Code;
+        bool m_Valid = false;
+    };
+}
@@ -0,0 +1,297 @@
+﻿#include "pch.h"
+#include "CppExporter.h"
+
+#include <cctype>
+#include <filesystem>
+#include <unordered_set>
+
+#include "CodeWriter.h"
+#include "ExportModel.h"
+#include "FsmProfile.h"
+#include "data/FSM.h"
+
+namespace LuaFsm
+{
+    namespace
+    {
+        //Event names are free text in the editor, anything that can't be in an identifier becomes _
+        std::string MakeEventIdentifier(const std::string& event)
+        {
+            std::string identifier = event;
+            for (auto& c : identifier)
+                if (!std::isalnum(static_cast<unsigned char>(c)))
+                    c = '_';
+            if (identifier.empty() || std::isdigit(static_cast<unsigned char>(identifier.front())))
+                identifier.insert(identifier.begin(), '_');
+            return CppExporter::MakeIdentifier(identifier);
+        }
+    }
+
+    std::string CppExporter::MakeIdentifier(const std::string& id)
+    {
+        static const std::unordered_set<std::string> keywords{
+            "alignas", "alignof", "asm", "auto", "bool", "case", "catch", "char", "char8_t", "char16_t", "char32_t",
+            "class", "co_await", "co_return", "co_yield", "concept", "const", "consteval", "constexpr", "constinit",
+            "const_cast", "continue", "decltype", "default", "delete", "double", "dynamic_cast", "enum", "explicit",
+            "export", "extern", "float", "friend", "inline", "int", "long", "mutable", "namespace", "new", "noexcept",
+            "nullptr", "operator", "private", "protected", "public", "register", "reinterpret_cast", "requires",
+            "short", "signed", "sizeof", "static", "static_assert", "static_cast", "struct", "switch", "template",
+            "this", "thread_local", "throw", "try", "typedef", "typeid", "typename", "union", "unsigned", "using",
+            "virtual", "void", "volatile", "wchar_t", "xor", "or", "not", "bitand", "bitor", "compl", "and_eq",
+            "or_eq", "xor_eq", "not_eq"};
+        if (keywords.contains(id))
+            return id + "_";
+        return id;
+    }
+
+    void CppExporter::WriteHeader(const Fsm& fsm, CodeWriter& writer, const FsmProfile* profile)
+    {
+        const auto model = ExportModel::Build(fsm, profile);
+        const auto name = MakeIdentifier(fsm.GetId());
+        const auto* initial = model.GetState(model.initialState);
+
+        writer.Write("//Native export of FSM {0} ({1})\n", fsm.GetId(), fsm.GetName());
+        writer.Append("//Generated by luaFSM, edit the machine in the editor and export it again instead of changing this file\n");
+        if (model.profileGuided)
+        {
+            //States are looked up by index here, only the condition order depends on the profile
+            writer.Write("//Hot conditions first, ordered by the profile {0}\n", std::filesystem::path(profile->filePath).filename().string());
+            writer.Write("//Predicted over the profiled run: {0} condition evaluations instead of {1}\n",
+                         model.guidedCost.evaluations, model.plainCost.evaluations);
+        }
+        writer.Append("#pragma once\n");
+        writer.Append("#include <array>\n");
+        writer.Append("#include <cstddef>\n");
+        writer.Append("#include <cstdint>\n");
+        writer.Append("#include <utility>\n\n");
+        writer.Write("namespace {0}\n{{\n", name);
+
+        writer.Append("    enum class StateId : std::uint16_t\n    {\n");
+        for (const auto& state : model.states)
+            writer.Write("        {0},\n", MakeIdentifier(state.state->GetId()));
+        writer.Append("    };\n\n");
+        writer.Append("    enum class ConditionId : std::uint16_t\n    {\n");
+        for (const auto& condition : model.conditions)
+            writer.Write("        {0},\n", MakeIdentifier(condition.trigger->GetId()));
+        writer.Append("    };\n\n");
+        writer.Append("    enum class EventId : std::uint16_t\n    {\n");
+        for (const auto& event : model.events)
+            writer.Write("        {0},\n", MakeEventIdentifier(event));
+        writer.Append("    };\n\n");
+
+        writer.Write("    inline constexpr std::size_t StateCount = {0};\n", model.states.size());
+        writer.Write("    inline constexpr std::size_t ConditionCount = {0};\n", model.conditions.size());
+        writer.Write("    inline constexpr std::size_t EventCount = {0};\n", model.events.size());
+        writer.Append("    //Next state of a condition that only runs its action\n");
+        writer.Append("    inline constexpr auto NoState = static_cast<StateId>(StateCount);\n");
+        writer.Append("    //Event of a condition that is evaluated on every update\n");
+        writer.Append("    inline constexpr auto NoEvent = static_cast<EventId>(EventCount);\n");
+        writer.Write("    inline constexpr StateId InitialState = StateId::{0};\n\n",
+                     MakeIdentifier(initial ? initial->state->GetId() : ""));
+
+        writer.Append("    inline constexpr std::array<const char*, StateCount> StateNames{\n");
+        for (const auto& state : model.states)
+            writer.Write("        \"{0}\",\n", state.state->GetId());
+        writer.Append("    };\n\n");
+        writer.Append("    inline constexpr std::array<const char*, ConditionCount> ConditionNames{\n");
+        for (const auto& condition : model.conditions)
+            writer.Write("        \"{0}\",\n", condition.trigger->GetId());
+        writer.Append("    };\n\n");
+        writer.Append("    inline constexpr std::array<const char*, EventCount> EventNames{\n");
+        for (const auto& event : model.events)
+            writer.Write("        \"{0}\",\n", event);
+        writer.Append("    };\n\n");
+        writer.Append("    inline constexpr std::array<bool, StateCount> ExitStates{\n");
+        for (const auto& state : model.states)
+            writer.Write("        {0},\n", state.state->IsExitState() ? "true" : "false");
+        writer.Append("    };\n\n");
+
+        writer.Append("    struct Transition\n    {\n");
+        writer.Append("        ConditionId condition;\n");
+        writer.Append("        StateId next;\n");
+        writer.Append("        std::int32_t priority;\n");
+        writer.Append("        EventId event;\n");
+        writer.Append("    };\n\n");
+        writer.Append(model.profileGuided
+            ? "    //Transitions of every state, grouped by state and ordered by descending priority, then by transitions taken in the profile\n"
+            : "    //Transitions of every state, grouped by state and ordered by descending priority\n");
+        writer.Append("    inline constexpr std::array<Transition, ConditionCount> Transitions{{\n");
+        for (const auto& state : model.states)
+        {
+            for (const auto& condition : state.conditions)
+            {
+                const auto* next = model.GetState(condition.nextState);
+                writer.Write("        {{ConditionId::{0}, {1}, {2}, {3}}}, //{4}\n",
+                             MakeIdentifier(condition.trigger->GetId()),
+                             next ? "StateId::" + MakeIdentifier(next->state->GetId()) : std::string("NoState"),
+                             condition.trigger->GetPriority(),
+                             condition.event ? "EventId::" + MakeEventIdentifier(model.events[condition.event - 1]) : std::string("NoEvent"),
+                             state.state->GetId());
+            }
+        }
+        writer.Append("    }};\n\n");
+        writer.Append("    //Transitions of state s are Transitions[TransitionStart[s]] up to Transitions[TransitionStart[s + 1]]\n");
+        writer.Append("    inline constexpr std::array<std::uint16_t, StateCount + 1> TransitionStart{\n        0,");
+        size_t start = 0;
+        for (const auto& state : model.states)
+        {
+            start += state.conditions.size();
+            writer.Write(" {0},", start);
+        }
+        writer.Append("\n    };\n\n");
+
+        writer.Append("    /**\n");
+        writer.Write("     * \\brief Allocation free runtime of the {0} machine\n", fsm.GetId());
+        writer.Append("     *\n");
+        writer.Append("     * Hooks is any type providing:\n");
+        writer.Append("     *   void OnEnter(StateId), void OnUpdate(StateId), void OnExit(StateId),\n");
+        writer.Append("     *   bool Condition(ConditionId), void Action(ConditionId)\n");
+        writer.Append("     * Update only polls conditions without an event, Dispatch evaluates the ones subscribed to an event.\n");
+        writer.Append("     * The machine owns its hooks, so per instance data can live in them.\n");
+        writer.Append("     */\n");
+        writer.Append(R"(    template <typename Hooks>
+    class Machine
+    {
+    public:
+        //Transitions taken in a single Update, stops machines whose conditions keep firing in a cycle
+        static constexpr std::size_t MaxTransitionsPerUpdate = StateCount;
+
+        Machine() = default;
+        explicit Machine(Hooks hooks) : m_Hooks(std::move(hooks)) {}
+
+        void Start()
+        {
+            m_State = InitialState;
+            m_Hooks.OnEnter(m_State);
+        }
+
+        [[nodiscard]] StateId GetState() const { return m_State; }
+        [[nodiscard]] const char* GetStateName() const { return StateNames[static_cast<std::size_t>(m_State)]; }
+        [[nodiscard]] Hooks& GetHooks() { return m_Hooks; }
+        [[nodiscard]] const Hooks& GetHooks() const { return m_Hooks; }
+
+        void Update()
+        {
+            for (std::size_t step = 0; step <= MaxTransitionsPerUpdate; ++step)
+            {
+                const auto state = m_State;
+                const auto index = static_cast<std::size_t>(state);
+                m_Hooks.OnUpdate(state);
+                if (ExitStates[index])
+                {
+                    m_State = InitialState;
+                    m_Hooks.OnEnter(m_State);
+                    return;
+                }
+                bool changed = false;
+                for (auto i = TransitionStart[index]; i < TransitionStart[index + 1]; ++i)
+                {
+                    const auto& transition = Transitions[i];
+                    if (transition.event != NoEvent || !m_Hooks.Condition(transition.condition))
+                        continue;
+                    m_Hooks.Action(transition.condition);
+                    if (transition.next == NoState)
+                        continue;
+                    m_Hooks.OnExit(state);
+                    m_State = transition.next;
+                    m_Hooks.OnEnter(m_State);
+                    changed = true;
+                    break;
+                }
+                if (!changed)
+                    return;
+            }
+        }
+
+        //Evaluates the conditions of the current state subscribed to event, returns true when the state changed
+        bool Dispatch(const EventId event)
+        {
+            const auto state = m_State;
+            const auto index = static_cast<std::size_t>(state);
+            for (auto i = TransitionStart[index]; i < TransitionStart[index + 1]; ++i)
+            {
+                const auto& transition = Transitions[i];
+                if (transition.event != event || !m_Hooks.Condition(transition.condition))
+                    continue;
+                m_Hooks.Action(transition.condition);
+                if (transition.next == NoState)
+                    continue;
+                m_Hooks.OnExit(state);
+                m_State = transition.next;
+                m_Hooks.OnEnter(m_State);
+                return true;
+            }
+            return false;
+        }
+
+    private:
+        Hooks m_Hooks{};
+        StateId m_State = InitialState;
+    };
+}
+)");
+    }
+
+    void CppExporter::WriteBenchmark(const Fsm& fsm, const std::string& headerFileName, CodeWriter& writer)
+    {
+        const auto name = MakeIdentifier(fsm.GetId());
+        const auto benchFileName = headerFileName.substr(0, headerFileName.find_last_of('.')) + "_bench.cpp";
+
+        writer.Write("//Microbenchmark of the native export of FSM {0}\n", fsm.GetId());
+        writer.Write("//Generated by luaFSM, build with optimizations, for example: c++ -std=c++17 -O2 {0}\n", benchFileName);
+        writer.Write("#include \"{0}\"\n\n", headerFileName);
+        writer.Append("#include <chrono>\n");
+        writer.Append("#include <cstdio>\n\n");
+        writer.Append("namespace\n{\n");
+        writer.Append("    //Hooks with empty state callbacks and pseudo random conditions that fire one time in eight\n");
+        writer.Append("    struct BenchHooks\n    {\n");
+        writer.Append("        std::uint32_t seed = 2463534242u;\n");
+        writer.Append("        std::uint64_t enters = 0;\n");
+        writer.Append("        std::uint64_t actions = 0;\n\n");
+        writer.Write("        void OnEnter({0}::StateId) {{ ++enters; }}\n", name);
+        writer.Write("        void OnUpdate({0}::StateId) {{}}\n", name);
+        writer.Write("        void OnExit({0}::StateId) {{}}\n", name);
+        writer.Write("        bool Condition({0}::ConditionId)\n", name);
+        writer.Append("        {\n");
+        writer.Append("            seed ^= seed << 13;\n");
+        writer.Append("            seed ^= seed >> 17;\n");
+        writer.Append("            seed ^= seed << 5;\n");
+        writer.Append("            return (seed & 7u) == 0;\n");
+        writer.Append("        }\n");
+        writer.Write("        void Action({0}::ConditionId) {{ ++actions; }}\n", name);
+        writer.Append("    };\n\n");
+        writer.Append("    constexpr std::size_t MachineCount = 1024;\n");
+        writer.Append("    constexpr std::size_t TickCount = 10000;\n");
+        writer.Append("}\n\n");
+        writer.Append("int main()\n{\n");
+        writer.Append("    //Static storage keeps the machines off the heap as well\n");
+        writer.Write("    static std::array<{0}::Machine<BenchHooks>, MachineCount> machines{{}};\n", name);
+        writer.Append(R"(    for (std::size_t i = 0; i < MachineCount; ++i)
+    {
+        machines[i].GetHooks().seed += static_cast<std::uint32_t>(i) * 2654435761u;
+        machines[i].Start();
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    for (std::size_t tick = 0; tick < TickCount; ++tick)
+        for (auto& machine : machines)
+            machine.Update();
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::uint64_t enters = 0;
+    std::uint64_t actions = 0;
+    for (const auto& machine : machines)
+    {
+        enters += machine.GetHooks().enters;
+        actions += machine.GetHooks().actions;
+    }
+    const double updates = static_cast<double>(MachineCount) * static_cast<double>(TickCount);
+)");
+        writer.Write("    std::printf(\"{0}: %zu machines x %zu ticks in %.3f s\\n\", MachineCount, TickCount, elapsed.count());\n", fsm.GetId());
+        writer.Append(R"(    std::printf("%.1f ns per update, %.2f M updates/s\n", elapsed.count() * 1e9 / updates, updates / elapsed.count() / 1e6);
+    std::printf("%llu state entries, %llu actions\n", static_cast<unsigned long long>(enters), static_cast<unsigned long long>(actions));
+    return 0;
+}
+)");
+    }
+}
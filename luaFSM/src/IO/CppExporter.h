@@ -0,0 +1,28 @@
+﻿#pragma once
+#include <string>
+
+namespace LuaFsm
+{
+    class Fsm;
+    class CodeWriter;
+    struct FsmProfile;
+
+    /**
+     * \brief Exports an FSM as a header-only C++ state machine
+     *
+     * The header holds enum state and condition ids, constexpr transition tables ordered by priority
+     * and a Machine template that calls user supplied hooks for onEnter/onUpdate/onExit and condition/action.
+     * Nothing in it allocates, so a tick costs a few table reads and the hook calls.
+     * Lua function bodies are not translated, they are left for the hooks to implement.
+     */
+    class CppExporter
+    {
+    public:
+        //Given a profile of the FSM, conditions of equal priority are ordered by the transitions they took
+        static void WriteHeader(const Fsm& fsm, CodeWriter& writer, const FsmProfile* profile = nullptr);
+        //Microbenchmark ticking a block of machines with pseudo random conditions
+        static void WriteBenchmark(const Fsm& fsm, const std::string& headerFileName, CodeWriter& writer);
+        //Lua ids can still be C++ keywords, those get a trailing underscore
+        [[nodiscard]] static std::string MakeIdentifier(const std::string& id);
+    };
+}
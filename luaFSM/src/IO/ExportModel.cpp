@@ -0,0 +1,162 @@
+﻿#include "pch.h"
+#include "ExportModel.h"
+
+#include <algorithm>
+
+#include "FsmProfile.h"
+#include "data/FSM.h"
+
+namespace LuaFsm
+{
+    namespace
+    {
+        int64_t GetUpdates(const FsmProfile& profile, const ExportState& state)
+        {
+            const auto* record = profile.GetState(state.state->GetId());
+            return record ? record->updates : 0;
+        }
+
+        int64_t GetTransitions(const FsmProfile& profile, const ExportCondition& condition)
+        {
+            const auto* record = profile.GetCondition(condition.trigger->GetId());
+            return record ? record->transitions : 0;
+        }
+
+        ExportCost PredictCost(const ExportModel& model, const FsmProfile& profile)
+        {
+            ExportCost cost;
+            int64_t position = 0;
+            for (const int index : model.stateOrder)
+            {
+                const auto& state = model.states[index - 1];
+                cost.stateChecks += GetUpdates(profile, state) * ++position;
+                if (state.state->IsExitState())
+                    continue;
+                //The polled conditions are checked together, the ones of each event on their own
+                std::vector<int> groups;
+                for (const auto& condition : state.conditions)
+                    if (!condition.trigger->GetCondition().empty() && std::ranges::find(groups, condition.event) == groups.end())
+                        groups.push_back(condition.event);
+                for (const int event : groups)
+                {
+                    //The first condition of a group runs on every check, so the most evaluated one counts the checks
+                    int64_t checks = 0;
+                    int64_t taken = 0;
+                    int64_t checked = 0;
+                    for (const auto& condition : state.conditions)
+                    {
+                        if (condition.event != event || condition.trigger->GetCondition().empty())
+                            continue;
+                        checked++;
+                        if (const auto* record = profile.GetCondition(condition.trigger->GetId()))
+                        {
+                            checks = std::max(checks, record->evaluations);
+                            cost.evaluations += record->transitions * checked;
+                            taken += record->transitions;
+                        }
+                    }
+                    cost.evaluations += std::max<int64_t>(checks - taken, 0) * checked;
+                }
+            }
+            return cost;
+        }
+    }
+
+    ExportModel ExportModel::Build(const Fsm& fsm, const FsmProfile* profile)
+    {
+        ExportModel model;
+        const auto states = fsm.GetStates();
+        model.states.reserve(states.size());
+        for (const auto& value : states | std::views::values)
+            model.states.push_back({value, 0, {}});
+        const auto initialStateId = fsm.GetInitialStateId();
+        std::ranges::sort(model.states, [&initialStateId](const ExportState& a, const ExportState& b)
+        {
+            const bool aInitial = a.state->GetId() == initialStateId;
+            if (const bool bInitial = b.state->GetId() == initialStateId; aInitial != bInitial)
+                return aInitial;
+            return a.state->GetId() < b.state->GetId();
+        });
+
+        std::unordered_map<std::string, int> stateIndices;
+        for (size_t i = 0; i < model.states.size(); i++)
+        {
+            model.states[i].index = static_cast<int>(i) + 1;
+            stateIndices[model.states[i].state->GetId()] = model.states[i].index;
+        }
+        if (stateIndices.contains(initialStateId))
+            model.initialState = stateIndices[initialStateId];
+        else if (!model.states.empty())
+            model.initialState = 1;
+
+        for (const auto& exportState : model.states)
+            for (const auto& trigger : exportState.state->GetTriggersRef() | std::views::values)
+                if (trigger->IsEventDriven() && !trigger->IsTimed())
+                    model.events.push_back(trigger->GetEvent());
+        std::ranges::sort(model.events);
+        model.events.erase(std::ranges::unique(model.events).begin(), model.events.end());
+
+        for (auto& exportState : model.states)
+        {
+            for (const auto& trigger : exportState.state->GetTriggersRef() | std::views::values)
+            {
+                if (trigger->IsTimed())
+                    continue;
+                ExportCondition condition{trigger, 0, 0, 0};
+                if (const auto next = stateIndices.find(trigger->GetNextStateId()); next != stateIndices.end())
+                    condition.nextState = next->second;
+                if (trigger->IsEventDriven())
+                    condition.event = static_cast<int>(std::ranges::lower_bound(model.events, trigger->GetEvent()) - model.events.begin()) + 1;
+                exportState.conditions.push_back(condition);
+            }
+            std::ranges::sort(exportState.conditions, [](const ExportCondition& a, const ExportCondition& b)
+            {
+                if (a.trigger->GetPriority() != b.trigger->GetPriority())
+                    return a.trigger->GetPriority() > b.trigger->GetPriority();
+                return a.trigger->GetId() < b.trigger->GetId();
+            });
+        }
+
+        model.stateOrder.reserve(model.states.size());
+        for (const auto& exportState : model.states)
+            model.stateOrder.push_back(exportState.index);
+
+        if (profile && !profile->IsEmpty())
+        {
+            model.plainCost = PredictCost(model, *profile);
+            //Stable sorts keep the id order among equally hot conditions and states
+            for (auto& exportState : model.states)
+            {
+                std::ranges::stable_sort(exportState.conditions, [profile](const ExportCondition& a, const ExportCondition& b)
+                {
+                    if (a.trigger->GetPriority() != b.trigger->GetPriority())
+                        return a.trigger->GetPriority() > b.trigger->GetPriority();
+                    return GetTransitions(*profile, a) > GetTransitions(*profile, b);
+                });
+            }
+            std::ranges::stable_sort(model.stateOrder, [&model, profile](const int a, const int b)
+            {
+                return GetUpdates(*profile, model.states[a - 1]) > GetUpdates(*profile, model.states[b - 1]);
+            });
+            model.guidedCost = PredictCost(model, *profile);
+            model.profileGuided = true;
+        }
+
+        for (auto& exportState : model.states)
+        {
+            for (auto& condition : exportState.conditions)
+            {
+                condition.index = static_cast<int>(model.conditions.size()) + 1;
+                model.conditions.push_back(condition);
+            }
+        }
+        return model;
+    }
+
+    const ExportState* ExportModel::GetState(const int index) const
+    {
+        if (index < 1 || index > static_cast<int>(states.size()))
+            return nullptr;
+        return &states[index - 1];
+    }
+}
@@ -0,0 +1,82 @@
+﻿#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace LuaFsm
+{
+    class Fsm;
+    class FsmState;
+    class FsmTrigger;
+    struct FsmProfile;
+
+    /**
+     * \brief Condition of a state as seen by the exporters
+     */
+    struct ExportCondition
+    {
+        std::shared_ptr<FsmTrigger> trigger;
+        //1-based position in ExportModel::conditions
+        int index = 0;
+        //1-based index of the target state, 0 when the condition has no valid next state
+        int nextState = 0;
+        //1-based position of its event in ExportModel::events, 0 when the condition is polled every update
+        int event = 0;
+    };
+
+    /**
+     * \brief State with its conditions in evaluation order
+     */
+    struct ExportState
+    {
+        std::shared_ptr<FsmState> state;
+        //1-based position in ExportModel::states
+        int index = 0;
+        std::vector<ExportCondition> conditions;
+    };
+
+    /**
+     * \brief Work a profile predicts the generated dispatch does for one ordering
+     *
+     * Assumes the same conditions would have fired under any ordering, which holds
+     * whenever at most one condition of a state is true at a time.
+     */
+    struct ExportCost
+    {
+        //Comparisons of the current state in the if chain of the flattened update
+        int64_t stateChecks = 0;
+        //Condition functions called, polled and event driven
+        int64_t evaluations = 0;
+    };
+
+    /**
+     * \brief Fixed ordering of an FSM that the standalone export targets are generated from
+     *
+     * States are numbered with the initial state first and the rest sorted by id.
+     * Conditions are sorted by descending priority, ties broken by id, and numbered in that order.
+     * Conditions without a current state are left out since the runtime never evaluates them,
+     * timed conditions are left out since the standalone targets have no timer wheel.
+     * Event names are collected once each and sorted.
+     * With a profile of the FSM, conditions of equal priority are ordered by descending transitions
+     * and the dispatch checks states by descending updates, so the hot paths are tested first.
+     * Distinct priorities keep their order, state numbers do not depend on the profile.
+     */
+    struct ExportModel
+    {
+        std::vector<ExportState> states;
+        std::vector<ExportCondition> conditions;
+        std::vector<std::string> events;
+        //1-based index of the initial state, 0 when the FSM has no states
+        int initialState = 0;
+        //1-based state indices in the order the dispatch checks them
+        std::vector<int> stateOrder;
+        //Set when the ordering came from a profile, with the predicted cost of the plain and the profiled ordering
+        bool profileGuided = false;
+        ExportCost plainCost;
+        ExportCost guidedCost;
+
+        static ExportModel Build(const Fsm& fsm, const FsmProfile* profile = nullptr);
+        [[nodiscard]] const ExportState* GetState(int index) const;
+    };
+}
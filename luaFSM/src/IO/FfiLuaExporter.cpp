@@ -0,0 +1,303 @@
+﻿#include "pch.h"
+#include "FfiLuaExporter.h"
+
+#include <algorithm>
+
+#include "CodeWriter.h"
+#include "ExportModel.h"
+#include "FlatLuaExporter.h"
+#include "data/FSM.h"
+
+namespace LuaFsm
+{
+    namespace
+    {
+        //Functions a step closure refers to directly, kept under the 60 upvalues lua 5.1 and LuaJIT allow
+        constexpr size_t MaxLocalFunctions = 48;
+
+        const char* Parameters(const std::string& body)
+        {
+            return CodeWriter::UsesVarargs(body) ? "self, instance, ..." : "self, instance";
+        }
+
+        //Only bodies that read ... are passed the argument of update or dispatch
+        const char* Arguments(const std::string& body)
+        {
+            return CodeWriter::UsesVarargs(body) ? "context, context, arg" : "context, context";
+        }
+
+        std::string FunctionName(const bool locals, const std::string& name)
+        {
+            return locals ? name : fmt::format("functions.{0}", name);
+        }
+
+        void WriteArrayFunction(CodeWriter& writer, const char* table, const int index, const std::string& comment, const FunctionBody& body)
+        {
+            if (body.empty())
+                return;
+            writer.Write("--{0}\n", comment);
+            writer.Write("{0}[{1}] = function(self, instance)\n", table, index);
+            writer.WriteFunctionBody(body.Get());
+            writer.Append("end\n\n");
+        }
+
+        void WriteBlockFunction(CodeWriter& writer, const bool locals, const std::string& name, const std::string& comment, const FunctionBody& body)
+        {
+            if (body.empty())
+                return;
+            writer.Write("--{0}\n", comment);
+            if (locals)
+                writer.Write("local function {0}({1})\n", name, Parameters(body.Get()));
+            else
+                writer.Write("functions.{0} = function({1})\n", name, Parameters(body.Get()));
+            writer.WriteFunctionBody(body.Get());
+            writer.Append("end\n");
+        }
+
+        void WriteTransition(CodeWriter& writer, const ExportModel& model, const ExportState& from, const ExportCondition& condition,
+                             const bool locals, const char* indent, const bool passArgument)
+        {
+            const auto& trigger = condition.trigger;
+            const auto* to = model.GetState(condition.nextState);
+            if (!trigger->GetAction().empty())
+            {
+                writer.Write("{0}{1}({2})\n", indent, FunctionName(locals, "action_" + trigger->GetId()),
+                             passArgument ? Arguments(trigger->GetAction()) : "context, context");
+            }
+            if (!to)
+                return;
+            if (!from.state->GetOnExit().empty())
+                writer.Write("{0}onExit[{1}](context, context)\n", indent, from.index);
+            writer.Write("{0}machine.state = {1}\n", indent, to->index);
+            if (!to->state->GetOnEnter().empty())
+                writer.Write("{0}onEnter[{1}](context, context)\n", indent, to->index);
+            writer.Write("{0}return true\n", indent);
+        }
+
+        void WriteStateBlock(CodeWriter& writer, const ExportModel& model, const ExportState& state)
+        {
+            const auto& stateId = state.state->GetId();
+            const bool exitState = state.state->IsExitState();
+            const bool locals = 1 + 2 * state.conditions.size() <= MaxLocalFunctions;
+
+            writer.Write("do --{0}\n", stateId);
+            if (!locals)
+                writer.Append("local functions = {}\n");
+            WriteBlockFunction(writer, locals, "onUpdate", stateId + ":onUpdate", state.state->GetOnUpdateBody());
+            for (const auto& condition : state.conditions)
+            {
+                const auto& conditionId = condition.trigger->GetId();
+                if (exitState || condition.trigger->GetCondition().empty())
+                    continue;
+                WriteBlockFunction(writer, locals, "condition_" + conditionId, conditionId + ":condition", condition.trigger->GetConditionBody());
+                WriteBlockFunction(writer, locals, "action_" + conditionId, conditionId + ":action", condition.trigger->GetActionBody());
+            }
+
+            writer.Write("stepState[{0}] = function(context, machine, arg)\n", state.index);
+            if (!state.state->GetOnUpdate().empty())
+                writer.Write("\t{0}({1})\n", FunctionName(locals, "onUpdate"), Arguments(state.state->GetOnUpdate()));
+            if (exitState)
+            {
+                //Exit states hand control back to the initial state, the same way FSM:onUpdate does
+                if (const auto* initial = model.GetState(model.initialState))
+                {
+                    writer.Write("\tmachine.state = {0}\n", initial->index);
+                    if (!initial->state->GetOnEnter().empty())
+                        writer.Write("\tonEnter[{0}](context, context)\n", initial->index);
+                }
+                writer.Append("\treturn false\n");
+                writer.Append("end\n");
+                writer.Append("end\n\n");
+                return;
+            }
+            for (const auto& condition : state.conditions)
+            {
+                //Event conditions are left to dispatch
+                if (condition.trigger->GetCondition().empty() || condition.event != 0)
+                    continue;
+                writer.Write("\tif {0}(context, context) then\n", FunctionName(locals, "condition_" + condition.trigger->GetId()));
+                WriteTransition(writer, model, state, condition, locals, "\t\t", false);
+                writer.Append("\tend\n");
+            }
+            writer.Append("\treturn false\n");
+            writer.Append("end\n");
+
+            //Events in the order their first condition is evaluated
+            std::vector<int> events;
+            for (const auto& condition : state.conditions)
+            {
+                if (condition.event != 0 && !condition.trigger->GetCondition().empty() && std::ranges::find(events, condition.event) == events.end())
+                    events.push_back(condition.event);
+            }
+            if (!events.empty())
+            {
+                writer.Write("dispatchState[{0}] = function(context, machine, event, arg)\n", state.index);
+                for (size_t i = 0; i < events.size(); i++)
+                {
+                    writer.Write("\t{0} event == \"{1}\" then\n", i == 0 ? "if" : "elseif", model.events[events[i] - 1]);
+                    for (const auto& condition : state.conditions)
+                    {
+                        if (condition.event != events[i] || condition.trigger->GetCondition().empty())
+                            continue;
+                        writer.Write("\t\tif {0}({1}) then\n", FunctionName(locals, "condition_" + condition.trigger->GetId()),
+                                     Arguments(condition.trigger->GetCondition()));
+                        WriteTransition(writer, model, state, condition, locals, "\t\t\t", true);
+                        writer.Append("\t\tend\n");
+                    }
+                }
+                writer.Append("\tend\n");
+                writer.Append("\treturn false\n");
+                writer.Append("end\n");
+            }
+            writer.Append("end\n\n");
+        }
+    }
+
+    void FfiLuaExporter::Write(const Fsm& fsm, CodeWriter& writer, const FsmProfile* profile)
+    {
+        const auto model = ExportModel::Build(fsm, profile);
+        const auto& id = fsm.GetId();
+        const auto machineType = fmt::format("luafsm_{0}_machine", id);
+
+        writer.Write("--LuaJIT FFI export of FSM {0}\n", id);
+        writer.Append("--Generated by luaFSM, edit the machine in the editor and export it again instead of changing this file\n");
+        writer.Append("--Needs LuaJIT, the state of every machine lives in an FFI array and the tick loop avoids NYI constructs\n");
+        writer.Append("--Inside every exported function both self and instance are the context table of the machine\n");
+        writer.Append("--update and dispatch pass on one argument instead of varargs, functions that read ... get it as their only vararg\n");
+        if (model.profileGuided)
+            writer.Append("--Conditions of equal priority that fire most are tested first, ordered by a loaded profile\n");
+        writer.Append("\n");
+        writer.Append("local ffi = require(\"ffi\")\n\n");
+        writer.Write("local {0} = {{}}\n", id);
+        writer.Write("{0}.id = \"{0}\"\n", id);
+        writer.Write("{0}.name = \"{1}\"\n", id, fsm.GetName());
+        writer.Write("{0}.initialState = {1}\n", id, model.initialState);
+        writer.Append("---Most state changes one update call follows, the rest wait for the next call\n");
+        writer.Write("{0}.maxTransitionsPerUpdate = {1}\n\n", id, std::max<size_t>(model.states.size(), 1));
+
+        writer.Append("---State constants\n");
+        writer.Write("{0}.states = {{\n", id);
+        for (const auto& state : model.states)
+            writer.Write("\t{0} = {1},\n", state.state->GetId(), state.index);
+        writer.Append("}\n\n");
+        writer.Append("---State ids by constant, for debugging\n");
+        writer.Write("{0}.stateIds = {{\n", id);
+        for (const auto& state : model.states)
+            writer.Write("\t\"{0}\",\n", state.state->GetId());
+        writer.Append("}\n\n");
+
+        //ffi.cdef fails on a type it already knows, which happens when the module is loaded again
+        writer.Write("if not pcall(ffi.typeof, \"{0}\") then\n", machineType);
+        writer.Append("\tffi.cdef[[\n");
+        writer.Write("\t\ttypedef struct {{ int32_t state; }} {0};\n", machineType);
+        writer.Append("\t]]\n");
+        writer.Append("end\n");
+        writer.Write("local machineArray = ffi.typeof(\"{0}[?]\")\n\n", machineType);
+
+        //onEnter and onExit only run on state changes, the other states reach them through these arrays
+        writer.Append("local onEnter, onExit, stepState, dispatchState = {}, {}, {}, {}\n\n");
+        for (const auto& state : model.states)
+        {
+            const auto& stateId = state.state->GetId();
+            WriteArrayFunction(writer, "onEnter", state.index, stateId + ":onEnter", state.state->GetOnEnterBody());
+            WriteArrayFunction(writer, "onExit", state.index, stateId + ":onExit", state.state->GetOnExitBody());
+        }
+        const bool blackboard = FlatLuaExporter::WriteBlackboard(fsm, writer);
+
+        //Every state is a do block, so its functions are locals that go out of scope with it and large machines stay under the local limit
+        for (const auto& state : model.states)
+            WriteStateBlock(writer, model, state);
+
+        writer.Append("---Create a pool of machines, their states are kept in one FFI array\n");
+        writer.Append("---@param capacity integer Most machines the pool holds\n");
+        writer.Append("---@return table pool\n");
+        writer.Write("function {0}.newPool(capacity)\n", id);
+        writer.Append("\treturn { machines = machineArray(capacity), contexts = {}, count = 0, capacity = capacity }\n");
+        writer.Append("end\n\n");
+
+        writer.Append("---Add a machine in the initial state to a pool\n");
+        writer.Append("---@param pool table Pool created with newPool()\n");
+        writer.Append("---@param context? table Data of the machine, its functions get it as self and instance\n");
+        writer.Append("---@return integer handle 0-based slot of the machine in the pool\n");
+        writer.Write("function {0}.add(pool, context)\n", id);
+        writer.Append("\tlocal handle = pool.count\n");
+        writer.Append("\tassert(handle < pool.capacity, \"FSM pool is full\")\n");
+        writer.Append("\tcontext = context or {}\n");
+        if (blackboard)
+        {
+            writer.Append("\tcontext.query = query\n");
+            writer.Append("\tcontext.blackboard, context.blackboardStamps, context.blackboardTick = {}, {}, 0\n");
+        }
+        writer.Append("\tpool.count = handle + 1\n");
+        writer.Append("\tpool.contexts[handle + 1] = context\n");
+        writer.Write("\tpool.machines[handle].state = {0}.initialState\n", id);
+        writer.Write("\tlocal enter = onEnter[{0}.initialState]\n", id);
+        writer.Append("\tif enter then\n");
+        writer.Append("\t\tenter(context, context)\n");
+        writer.Append("\tend\n");
+        writer.Append("\treturn handle\n");
+        writer.Append("end\n\n");
+
+        writer.Append("---Update one machine by one tick, following state changes up to maxTransitionsPerUpdate\n");
+        writer.Append("---@param pool table\n");
+        writer.Append("---@param handle integer Slot returned by add()\n");
+        writer.Append("---@param arg? any Passed on to onUpdate functions that read ...\n");
+        writer.Write("function {0}.update(pool, handle, arg)\n", id);
+        writer.Append("\tlocal machine = pool.machines[handle]\n");
+        writer.Append("\tlocal context = pool.contexts[handle + 1]\n");
+        if (blackboard)
+            writer.Append("\tcontext.blackboardTick = context.blackboardTick + 1\n");
+        writer.Write("\tfor _ = 1, {0}.maxTransitionsPerUpdate do\n", id);
+        writer.Append("\t\tif not stepState[machine.state](context, machine, arg) then\n");
+        writer.Append("\t\t\treturn\n");
+        writer.Append("\t\tend\n");
+        writer.Append("\tend\n");
+        writer.Append("end\n\n");
+
+        writer.Append("---Update every machine of a pool by one tick, in the order they were added\n");
+        writer.Append("---@param pool table\n");
+        writer.Append("---@param arg? any Passed on to onUpdate functions that read ...\n");
+        writer.Write("function {0}.updateAll(pool, arg)\n", id);
+        writer.Write("\tlocal update = {0}.update\n", id);
+        writer.Append("\tfor handle = 0, pool.count - 1 do\n");
+        writer.Append("\t\tupdate(pool, handle, arg)\n");
+        writer.Append("\tend\n");
+        writer.Append("end\n\n");
+
+        writer.Append("---Evaluate the conditions of the current state of a machine that are subscribed to an event\n");
+        writer.Append("---@param pool table\n");
+        writer.Append("---@param handle integer Slot returned by add()\n");
+        writer.Append("---@param event string\n");
+        writer.Append("---@param arg? any Passed on to the condition and action functions that read ...\n");
+        writer.Append("---@return boolean changed True when the state changed\n");
+        writer.Write("function {0}.dispatch(pool, handle, event, arg)\n", id);
+        writer.Append("\tlocal machine = pool.machines[handle]\n");
+        writer.Append("\tlocal handler = dispatchState[machine.state]\n");
+        writer.Append("\tif not handler then\n");
+        writer.Append("\t\treturn false\n");
+        writer.Append("\tend\n");
+        writer.Append("\tlocal context = pool.contexts[handle + 1]\n");
+        if (blackboard)
+            writer.Append("\tcontext.blackboardTick = context.blackboardTick + 1\n");
+        writer.Append("\treturn handler(context, machine, event, arg)\n");
+        writer.Append("end\n\n");
+
+        writer.Append("---Get the context table of a machine\n");
+        writer.Append("---@param pool table\n");
+        writer.Append("---@param handle integer\n");
+        writer.Append("---@return table context\n");
+        writer.Write("function {0}.getContext(pool, handle)\n", id);
+        writer.Append("\treturn pool.contexts[handle + 1]\n");
+        writer.Append("end\n\n");
+
+        writer.Append("---Get the string id of the current state of a machine\n");
+        writer.Append("---@param pool table\n");
+        writer.Append("---@param handle integer\n");
+        writer.Append("---@return string stateId\n");
+        writer.Write("function {0}.getStateId(pool, handle)\n", id);
+        writer.Write("\treturn {0}.stateIds[pool.machines[handle].state]\n", id);
+        writer.Append("end\n\n");
+
+        writer.Write("return {0}\n", id);
+    }
+}
@@ -0,0 +1,25 @@
+﻿#pragma once
+
+namespace LuaFsm
+{
+    class Fsm;
+    class CodeWriter;
+    struct FsmProfile;
+
+    /**
+     * \brief Exports an FSM as a LuaJIT module that keeps machine state in FFI structs
+     *
+     * Machines live in pools: the current state of every machine is an int32_t in one FFI array,
+     * the data of a machine stays in a plain context table that its functions get as self and instance.
+     * Each state gets a step function stored in an array indexed by the state number, its onUpdate,
+     * conditions and actions are local functions of a do block called directly from it.
+     * The tick loop has no pairs, no varargs, no table.sort and no metatables, so LuaJIT compiles it whole.
+     * update and dispatch pass on one argument, bodies that read ... get it as their only vararg.
+     * Given a profile of the FSM equal priority conditions that fire most are tested first, see ExportModel.
+     */
+    class FfiLuaExporter
+    {
+    public:
+        static void Write(const Fsm& fsm, CodeWriter& writer, const FsmProfile* profile = nullptr);
+    };
+}
@@ -297,6 +297,21 @@ namespace LuaFsm
         return content;
     }
 
+    std::string FileReader::ReadAllBytes(const std::string& path)
+    {
+        std::string filePath = path;
+        std::ranges::replace(filePath, '\\', '/');
+        std::ifstream file(filePath, std::ios::binary);
+        if (!file.is_open())
+        {
+            ImGui::InsertNotification({ImGuiToastType::Error, 3000, "Can not open file: %s", filePath.c_str()});
+            LOG_ERROR("Failed to open file: {0}", filePath);
+            return "";
+        }
+        std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        return content;
+    }
+
     std::string FileReader::RemoveStartingTab(const std::string& input)
     {
         const std::regex startLineWhite(R"(^((?:\t|    )))");
@@ -32,6 +32,7 @@ namespace LuaFsm
         static void RemoveLuaComments(std::string& line);
         static void RemoveTabs(std::string& line);
         static std::string ReadAllText(const std::string& path);
+        static std::string ReadAllBytes(const std::string& path);
         static std::string RemoveStartingTab(const std::string& input);
         static std::string lastPath;
         static std::string lastFilePath;
@@ -0,0 +1,278 @@
+﻿#include "pch.h"
+#include "FlatLuaExporter.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <map>
+
+#include "CodeWriter.h"
+#include "ExportModel.h"
+#include "FsmProfile.h"
+#include "data/FSM.h"
+
+namespace LuaFsm
+{
+    namespace
+    {
+        //Functions written so far by parameters and interned body, with the slot and comment of the first one
+        using SharedFunctions = std::map<std::pair<std::string_view, const void*>, std::pair<std::string, std::string>>;
+
+        void WriteFunction(CodeWriter& writer, const char* table, const int index, const std::string& comment,
+                           const char* parameters, const FunctionBody& body, SharedFunctions* shared)
+        {
+            if (body.empty())
+                return;
+            if (shared)
+            {
+                const auto [it, inserted] = shared->try_emplace({parameters, body.GetKey()}, fmt::format("{0}[{1}]", table, index), comment);
+                if (!inserted)
+                {
+                    writer.Write("--{0}, same function as {1}\n", comment, it->second.second);
+                    writer.Write("{0}[{1}] = {2}\n\n", table, index, it->second.first);
+                    return;
+                }
+            }
+            writer.Write("--{0}\n", comment);
+            writer.Write("{0}[{1}] = function({2})\n", table, index, parameters);
+            writer.WriteFunctionBody(body.Get());
+            writer.Append("end\n\n");
+        }
+
+        const char* VarargParameters(const std::string& body)
+        {
+            return CodeWriter::UsesVarargs(body) ? "self, instance, ..." : "self, instance";
+        }
+
+        void WriteTransition(CodeWriter& writer, const ExportModel& model, const ExportState& from,
+                             const ExportCondition& condition, const char* indent, const char* arguments)
+        {
+            const auto* to = model.GetState(condition.nextState);
+            if (!condition.trigger->GetAction().empty())
+                writer.Write("{0}action[{1}]({2})\n", indent, condition.index, arguments);
+            if (!to)
+                return;
+            if (!from.state->GetOnExit().empty())
+                writer.Write("{0}onExit[{1}](self, self)\n", indent, from.index);
+            writer.Write("{0}self.state = {1}\n", indent, to->index);
+            if (!to->state->GetOnEnter().empty())
+                writer.Write("{0}onEnter[{1}](self, self)\n", indent, to->index);
+            writer.Write("{0}return true\n", indent);
+        }
+    }
+
+    bool FlatLuaExporter::WriteBlackboard(const Fsm& fsm, CodeWriter& writer)
+    {
+        if (fsm.GetPredicates().empty())
+            return false;
+        writer.Append("local predicates = {}\n\n");
+        for (const auto& predicate : fsm.GetPredicates())
+        {
+            writer.Write("--predicate {0}\n", predicate.name);
+            writer.Write("predicates.{0} = function(instance)\n", predicate.name);
+            writer.WriteFunctionBody(predicate.body.Get());
+            writer.Append("end\n\n");
+        }
+        writer.Append("---Value of a blackboard predicate, computed at most once per tick\n");
+        writer.Append("---@param self table Instance the conditions run on\n");
+        writer.Append("---@param name string\n");
+        writer.Append("---@return any\n");
+        writer.Append("local function query(self, name)\n");
+        writer.Append("\tlocal stamps = self.blackboardStamps\n");
+        writer.Append("\tif stamps[name] == self.blackboardTick then\n");
+        writer.Append("\t\treturn self.blackboard[name]\n");
+        writer.Append("\tend\n");
+        writer.Append("\tlocal value = predicates[name](self)\n");
+        writer.Append("\tself.blackboard[name] = value\n");
+        writer.Append("\tstamps[name] = self.blackboardTick\n");
+        writer.Append("\treturn value\n");
+        writer.Append("end\n\n");
+        return true;
+    }
+
+    void FlatLuaExporter::Write(const Fsm& fsm, CodeWriter& writer, const FsmProfile* profile, const bool shareFunctions)
+    {
+        const auto model = ExportModel::Build(fsm, profile);
+        const auto& id = fsm.GetId();
+
+        writer.Write("--Flattened dispatch export of FSM {0}\n", id);
+        writer.Append("--Generated by luaFSM, edit the machine in the editor and export it again instead of changing this file\n");
+        writer.Append("--Inside every function both self and instance are the machine instance created with new()\n");
+        if (shareFunctions)
+            writer.Append("--Identical functions are written once and shared by every state and condition using them\n");
+        if (model.profileGuided)
+        {
+            writer.Write("--Hot states and conditions first, ordered by the profile {0}\n", std::filesystem::path(profile->filePath).filename().string());
+            writer.Write("--Predicted over the profiled run: {0} state checks instead of {1}, {2} condition evaluations instead of {3}\n",
+                         model.guidedCost.stateChecks, model.plainCost.stateChecks, model.guidedCost.evaluations, model.plainCost.evaluations);
+        }
+        writer.Append("\n");
+        writer.Write("local {0} = {{}}\n", id);
+        writer.Write("{0}.id = \"{0}\"\n", id);
+        writer.Write("{0}.name = \"{1}\"\n", id, fsm.GetName());
+        writer.Write("{0}.initialState = {1}\n", id, model.initialState);
+        writer.Append("---Most state changes one update call follows, the rest wait for the next call\n");
+        writer.Write("{0}.maxTransitionsPerUpdate = {1}\n\n", id, std::max<size_t>(model.states.size(), 1));
+
+        writer.Append("---State constants\n");
+        writer.Write("{0}.states = {{\n", id);
+        for (const auto& state : model.states)
+            writer.Write("\t{0} = {1},\n", state.state->GetId(), state.index);
+        writer.Append("}\n\n");
+        writer.Append("---State ids by constant, for debugging\n");
+        writer.Write("{0}.stateIds = {{\n", id);
+        for (const auto& state : model.states)
+            writer.Write("\t\"{0}\",\n", state.state->GetId());
+        writer.Append("}\n\n");
+
+        //Functions live in arrays so large machines stay clear of lua's local and upvalue limits
+        writer.Append("local onEnter, onUpdate, onExit, condition, action = {}, {}, {}, {}, {}\n\n");
+        SharedFunctions sharedFunctions;
+        auto* shared = shareFunctions ? &sharedFunctions : nullptr;
+        for (const auto& state : model.states)
+        {
+            const auto& stateId = state.state->GetId();
+            WriteFunction(writer, "onEnter", state.index, stateId + ":onEnter", "self, instance", state.state->GetOnEnterBody(), shared);
+            const auto& onUpdate = state.state->GetOnUpdateBody();
+            WriteFunction(writer, "onUpdate", state.index, stateId + ":onUpdate", VarargParameters(onUpdate.Get()), onUpdate, shared);
+            WriteFunction(writer, "onExit", state.index, stateId + ":onExit", "self, instance", state.state->GetOnExitBody(), shared);
+        }
+        for (const auto& condition : model.conditions)
+        {
+            const auto& conditionId = condition.trigger->GetId();
+            const auto& conditionBody = condition.trigger->GetConditionBody();
+            const auto& actionBody = condition.trigger->GetActionBody();
+            WriteFunction(writer, "condition", condition.index, conditionId + ":condition", VarargParameters(conditionBody.Get()), conditionBody, shared);
+            WriteFunction(writer, "action", condition.index, conditionId + ":action", VarargParameters(actionBody.Get()), actionBody, shared);
+        }
+
+        const bool blackboard = WriteBlackboard(fsm, writer);
+
+        writer.Append("---Update the current state and check its conditions once\n");
+        writer.Append("---@param self table Instance created with new()\n");
+        writer.Append("---@return boolean changed True when a condition changed the state\n");
+        writer.Append("local function step(self, ...)\n");
+        writer.Append("\tlocal state = self.state\n");
+        bool first = true;
+        for (const int index : model.stateOrder)
+        {
+            const auto& state = model.states[index - 1];
+            writer.Write("\t{0} state == {1} then --{2}\n", first ? "if" : "elseif", state.index, state.state->GetId());
+            first = false;
+            if (!state.state->GetOnUpdate().empty())
+                writer.Write("\t\tonUpdate[{0}](self, self, ...)\n", state.index);
+            if (state.state->IsExitState())
+            {
+                //Exit states hand control back to the initial state, the same way FSM:onUpdate does
+                if (const auto* initial = model.GetState(model.initialState))
+                {
+                    writer.Write("\t\tself.state = {0}\n", initial->index);
+                    if (!initial->state->GetOnEnter().empty())
+                        writer.Write("\t\tonEnter[{0}](self, self)\n", initial->index);
+                }
+                writer.Append("\t\treturn false\n");
+                continue;
+            }
+            for (const auto& condition : state.conditions)
+            {
+                //Event conditions are left to dispatch
+                if (condition.trigger->GetCondition().empty() || condition.event != 0)
+                    continue;
+                writer.Write("\t\tif condition[{0}](self, self) then --{1}\n", condition.index, condition.trigger->GetId());
+                WriteTransition(writer, model, state, condition, "\t\t\t", "self, self");
+                writer.Append("\t\tend\n");
+            }
+        }
+        if (!first)
+            writer.Append("\tend\n");
+        writer.Append("\treturn false\n");
+        writer.Append("end\n\n");
+
+        //A loop instead of a tail call per transition, so a cycle of true conditions cannot hang the caller
+        writer.Append("---Update the machine by one tick, following state changes up to maxTransitionsPerUpdate\n");
+        writer.Append("---@param self table Instance created with new()\n");
+        writer.Append("---@param ... unknown Passed on to the onUpdate function of the current state\n");
+        writer.Write("function {0}.update(self, ...)\n", id);
+        //Once per update like FSM:onUpdate, predicates keep their value across the state changes of one tick
+        if (blackboard)
+            writer.Append("\tself.blackboardTick = self.blackboardTick + 1\n");
+        writer.Write("\tfor _ = 1, {0}.maxTransitionsPerUpdate do\n", id);
+        writer.Append("\t\tif not step(self, ...) then\n");
+        writer.Append("\t\t\treturn\n");
+        writer.Append("\t\tend\n");
+        writer.Append("\tend\n");
+        writer.Append("end\n\n");
+
+        writer.Append("---Evaluate the conditions of the current state that are subscribed to an event\n");
+        writer.Append("---@param self table Instance created with new()\n");
+        writer.Append("---@param event string\n");
+        writer.Append("---@param ... unknown Passed on to the condition and action functions\n");
+        writer.Append("---@return boolean changed True when the state changed\n");
+        writer.Write("function {0}.dispatch(self, event, ...)\n", id);
+        if (!model.events.empty())
+        {
+            if (blackboard)
+                writer.Append("\tself.blackboardTick = self.blackboardTick + 1\n");
+            writer.Append("\tlocal state = self.state\n");
+            first = true;
+            for (const int index : model.stateOrder)
+            {
+                const auto& state = model.states[index - 1];
+                if (state.state->IsExitState())
+                    continue;
+                //Events in the order their first condition is evaluated
+                std::vector<int> events;
+                for (const auto& condition : state.conditions)
+                    if (condition.event != 0 && !condition.trigger->GetCondition().empty() && std::ranges::find(events, condition.event) == events.end())
+                        events.push_back(condition.event);
+                if (events.empty())
+                    continue;
+                writer.Write("\t{0} state == {1} then --{2}\n", first ? "if" : "elseif", state.index, state.state->GetId());
+                first = false;
+                for (size_t i = 0; i < events.size(); i++)
+                {
+                    writer.Write("\t\t{0} event == \"{1}\" then\n", i == 0 ? "if" : "elseif", model.events[events[i] - 1]);
+                    for (const auto& condition : state.conditions)
+                    {
+                        if (condition.event != events[i] || condition.trigger->GetCondition().empty())
+                            continue;
+                        writer.Write("\t\t\tif condition[{0}](self, self, ...) then --{1}\n", condition.index, condition.trigger->GetId());
+                        WriteTransition(writer, model, state, condition, "\t\t\t\t", "self, self, ...");
+                        writer.Append("\t\t\tend\n");
+                    }
+                }
+                writer.Append("\t\tend\n");
+            }
+            if (!first)
+                writer.Append("\tend\n");
+        }
+        writer.Append("\treturn false\n");
+        writer.Append("end\n\n");
+
+        writer.Append("---Create a new instance of the machine in its initial state\n");
+        writer.Append("---@param o? table Table to turn into the instance\n");
+        writer.Append("---@return table instance\n");
+        writer.Write("function {0}.new(o)\n", id);
+        writer.Append("\to = o or {}\n");
+        writer.Write("\to.state = {0}.initialState\n", id);
+        if (blackboard)
+        {
+            writer.Append("\to.query = query\n");
+            writer.Append("\to.blackboard, o.blackboardStamps, o.blackboardTick = {}, {}, 0\n");
+        }
+        writer.Append("\tlocal enter = onEnter[o.state]\n");
+        writer.Append("\tif enter then\n");
+        writer.Append("\t\tenter(o, o)\n");
+        writer.Append("\tend\n");
+        writer.Append("\treturn o\n");
+        writer.Append("end\n\n");
+
+        writer.Append("---Get the string id of the current state of an instance\n");
+        writer.Append("---@param self table\n");
+        writer.Append("---@return string stateId\n");
+        writer.Write("function {0}.getStateId(self)\n", id);
+        writer.Write("\treturn {0}.stateIds[self.state]\n", id);
+        writer.Append("end\n\n");
+
+        writer.Write("return {0}\n", id);
+    }
+}
@@ -0,0 +1,29 @@
+﻿#pragma once
+
+namespace LuaFsm
+{
+    class Fsm;
+    class CodeWriter;
+    struct FsmProfile;
+
+    /**
+     * \brief Exports an FSM as a standalone lua module with flattened dispatch
+     *
+     * States become integer constants and the whole machine is driven by one update function
+     * that branches on the current state and checks its conditions inline in priority order.
+     * update follows state changes in a loop bounded by maxTransitionsPerUpdate, the number of states by default.
+     * The module does not need FSM.lua and never goes through metatables or string ids while ticking.
+     * Inside every exported function self and instance are both the machine instance created with new(),
+     * so bodies written against FSM:newInstance keep working.
+     * Given a profile of the FSM the hot states and conditions are tested first, see ExportModel.
+     * With shared functions every distinct body is compiled to one closure, the other slots using it refer to it.
+     */
+    class FlatLuaExporter
+    {
+    public:
+        static void Write(const Fsm& fsm, CodeWriter& writer, const FsmProfile* profile = nullptr, bool shareFunctions = false);
+        //Predicates and a local query(self, name) with the contract of FSM:query, false when the FSM has none.
+        //Callers bump self.blackboardTick once per tick and set up the instance fields in new()
+        static bool WriteBlackboard(const Fsm& fsm, CodeWriter& writer);
+    };
+}
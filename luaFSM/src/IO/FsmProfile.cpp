@@ -0,0 +1,114 @@
+﻿#include "pch.h"
+#include "FsmProfile.h"
+
+#include <algorithm>
+#include <sstream>
+
+namespace LuaFsm
+{
+    namespace
+    {
+        float Heat(const double value, const double max)
+        {
+            if (max <= 0.0)
+                return 0.0f;
+            return static_cast<float>(std::clamp(value / max, 0.0, 1.0));
+        }
+    }
+
+    bool FsmProfile::Parse(const std::string_view text, const std::string& fsmId, FsmProfile& profile)
+    {
+        profile = {};
+        profile.fsmId = fsmId;
+        std::istringstream lines{std::string(text)};
+        std::string line;
+        bool hasHeader = false;
+        while (std::getline(lines, line))
+        {
+            std::istringstream fields(line);
+            std::string kind;
+            if (!(fields >> kind))
+                continue;
+            if (!hasHeader)
+            {
+                std::string word;
+                if (kind != "luaFSM" || !(fields >> word) || word != "profile")
+                    return false;
+                hasHeader = true;
+                continue;
+            }
+            if (kind == "duration")
+            {
+                fields >> profile.duration;
+                continue;
+            }
+            std::string recordFsm, id;
+            if (!(fields >> recordFsm >> id) || recordFsm != fsmId)
+                continue;
+            if (kind == "state")
+            {
+                StateProfile state;
+                if (fields >> state.enters >> state.enterTime >> state.updates >> state.updateTime >> state.exits >> state.exitTime)
+                {
+                    profile.m_MaxStateTime = std::max(profile.m_MaxStateTime, state.GetTime());
+                    profile.m_MaxUpdates = std::max(profile.m_MaxUpdates, state.updates);
+                    profile.states[id] = state;
+                }
+            }
+            else if (kind == "condition")
+            {
+                ConditionProfile condition;
+                if (fields >> condition.evaluations >> condition.evaluationTime >> condition.transitions)
+                {
+                    profile.m_MaxEvaluationTime = std::max(profile.m_MaxEvaluationTime, condition.evaluationTime);
+                    profile.m_MaxEvaluations = std::max(profile.m_MaxEvaluations, condition.evaluations);
+                    profile.m_MaxTransitions = std::max(profile.m_MaxTransitions, condition.transitions);
+                    profile.conditions[id] = condition;
+                }
+            }
+        }
+        return hasHeader;
+    }
+
+    const StateProfile* FsmProfile::GetState(const std::string& id) const
+    {
+        const auto it = states.find(id);
+        return it != states.end() ? &it->second : nullptr;
+    }
+
+    const ConditionProfile* FsmProfile::GetCondition(const std::string& id) const
+    {
+        const auto it = conditions.find(id);
+        return it != conditions.end() ? &it->second : nullptr;
+    }
+
+    float FsmProfile::GetStateHeat(const std::string& id, const ProfileMetric metric) const
+    {
+        const auto state = GetState(id);
+        if (!state)
+            return -1.0f;
+        if (metric == ProfileMetric::Time)
+            return Heat(state->GetTime(), m_MaxStateTime);
+        return Heat(static_cast<double>(state->updates), static_cast<double>(m_MaxUpdates));
+    }
+
+    float FsmProfile::GetConditionHeat(const std::string& id, const ProfileMetric metric) const
+    {
+        const auto condition = GetCondition(id);
+        if (!condition)
+            return -1.0f;
+        if (metric == ProfileMetric::Time)
+            return Heat(condition->evaluationTime, m_MaxEvaluationTime);
+        return Heat(static_cast<double>(condition->evaluations), static_cast<double>(m_MaxEvaluations));
+    }
+
+    float FsmProfile::GetTransitionHeat(const std::string& id, const ProfileMetric metric) const
+    {
+        if (metric == ProfileMetric::Time)
+            return GetConditionHeat(id, metric);
+        const auto condition = GetCondition(id);
+        if (!condition)
+            return -1.0f;
+        return Heat(static_cast<double>(condition->transitions), static_cast<double>(m_MaxTransitions));
+    }
+}
@@ -0,0 +1,81 @@
+﻿#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace LuaFsm
+{
+    /**
+     * \brief What the heatmap colours the graph by
+     */
+    enum class ProfileMetric : int
+    {
+        //Seconds spent in the state functions and condition evaluations
+        Time,
+        //Updates of states, evaluations of conditions and transitions taken over links
+        Frequency
+    };
+
+    /**
+     * \brief Calls and seconds spent in the functions of a state
+     */
+    struct StateProfile
+    {
+        int64_t enters = 0;
+        double enterTime = 0.0;
+        int64_t updates = 0;
+        double updateTime = 0.0;
+        int64_t exits = 0;
+        double exitTime = 0.0;
+        [[nodiscard]] double GetTime() const { return enterTime + updateTime + exitTime; }
+    };
+
+    /**
+     * \brief Evaluations of a condition and how many of them changed the state
+     */
+    struct ConditionProfile
+    {
+        int64_t evaluations = 0;
+        double evaluationTime = 0.0;
+        int64_t transitions = 0;
+    };
+
+    /**
+     * \brief Records of one FSM from a profile file written by FSM_PROFILER:write in FSM.lua
+     *
+     * Every line holds one record, fields separated by spaces:
+     * state <fsmId> <stateId> <enters> <enterTime> <updates> <updateTime> <exits> <exitTime>
+     * condition <fsmId> <conditionId> <evaluations> <evaluationTime> <transitions>
+     * Heat is a record's value divided by the highest value of its kind, so the hottest state,
+     * condition and link each get a heat of 1.
+     */
+    struct FsmProfile
+    {
+        std::string fsmId;
+        std::string filePath;
+        //Seconds the profile was recorded over
+        double duration = 0.0;
+        std::unordered_map<std::string, StateProfile> states;
+        std::unordered_map<std::string, ConditionProfile> conditions;
+
+        //Reads the records of fsmId, false when the text is not a profile
+        static bool Parse(std::string_view text, const std::string& fsmId, FsmProfile& profile);
+
+        [[nodiscard]] bool IsEmpty() const { return states.empty() && conditions.empty(); }
+        [[nodiscard]] const StateProfile* GetState(const std::string& id) const;
+        [[nodiscard]] const ConditionProfile* GetCondition(const std::string& id) const;
+
+        //Heat between 0 and 1, negative when there is no record of the id
+        [[nodiscard]] float GetStateHeat(const std::string& id, ProfileMetric metric) const;
+        [[nodiscard]] float GetConditionHeat(const std::string& id, ProfileMetric metric) const;
+        [[nodiscard]] float GetTransitionHeat(const std::string& id, ProfileMetric metric) const;
+
+    private:
+        double m_MaxStateTime = 0.0;
+        int64_t m_MaxUpdates = 0;
+        double m_MaxEvaluationTime = 0.0;
+        int64_t m_MaxEvaluations = 0;
+        int64_t m_MaxTransitions = 0;
+    };
+}
@@ -0,0 +1,117 @@
+﻿#include "pch.h"
+#include "FsmTrace.h"
+
+#include <algorithm>
+
+namespace LuaFsm
+{
+    namespace
+    {
+        /**
+         * \brief Bounds checked little endian reads over the trace bytes
+         */
+        class ByteReader
+        {
+        public:
+            explicit ByteReader(const std::string_view bytes) : m_Bytes(bytes) {}
+
+            bool ReadU16(uint16_t& value)
+            {
+                if (m_Bytes.size() - m_Position < 2)
+                    return false;
+                value = static_cast<uint16_t>(Byte(0) | Byte(1) << 8);
+                m_Position += 2;
+                return true;
+            }
+
+            bool ReadU32(uint32_t& value)
+            {
+                if (m_Bytes.size() - m_Position < 4)
+                    return false;
+                value = Byte(0) | Byte(1) << 8 | Byte(2) << 16 | Byte(3) << 24;
+                m_Position += 4;
+                return true;
+            }
+
+            bool ReadString(const size_t length, std::string& value)
+            {
+                if (m_Bytes.size() - m_Position < length)
+                    return false;
+                value.assign(m_Bytes.substr(m_Position, length));
+                m_Position += length;
+                return true;
+            }
+
+            [[nodiscard]] size_t GetRemaining() const { return m_Bytes.size() - m_Position; }
+
+        private:
+            [[nodiscard]] uint32_t Byte(const size_t offset) const
+            {
+                return static_cast<unsigned char>(m_Bytes[m_Position + offset]);
+            }
+
+            std::string_view m_Bytes;
+            size_t m_Position = 0;
+        };
+
+        constexpr std::string_view traceMagic = "LFSMTRC1";
+        constexpr size_t recordSize = 16;
+    }
+
+    bool FsmTrace::Parse(const std::string_view bytes, const std::string& fsmId, FsmTrace& trace)
+    {
+        trace = {};
+        trace.fsmId = fsmId;
+        if (!bytes.starts_with(traceMagic))
+            return false;
+        ByteReader reader(bytes.substr(traceMagic.size()));
+        uint32_t stringCount = 0;
+        if (!reader.ReadU32(stringCount))
+            return false;
+        std::vector<std::string> strings;
+        strings.reserve(std::min<size_t>(stringCount, reader.GetRemaining() / 2));
+        for (uint32_t i = 0; i < stringCount; ++i)
+        {
+            uint16_t length = 0;
+            std::string value;
+            if (!reader.ReadU16(length) || !reader.ReadString(length, value))
+                return false;
+            strings.push_back(std::move(value));
+        }
+        //Index 0 is none, anything past the table is a corrupt record
+        const auto lookup = [&strings](const uint16_t index, std::string& value)
+        {
+            if (index > strings.size())
+                return false;
+            if (index > 0)
+                value = strings[index - 1];
+            return true;
+        };
+        uint32_t recordCount = 0;
+        if (!reader.ReadU32(recordCount) || reader.GetRemaining() / recordSize < recordCount)
+            return false;
+        for (uint32_t i = 0; i < recordCount; ++i)
+        {
+            TraceRecord record;
+            uint16_t fsm = 0, from = 0, to = 0, condition = 0;
+            reader.ReadU32(record.tick);
+            reader.ReadU32(record.instance);
+            reader.ReadU16(fsm);
+            reader.ReadU16(from);
+            reader.ReadU16(to);
+            reader.ReadU16(condition);
+            std::string recordFsm;
+            if (!lookup(fsm, recordFsm) || !lookup(from, record.fromState)
+                || !lookup(to, record.toState) || !lookup(condition, record.condition))
+                return false;
+            if (recordFsm != fsmId)
+                continue;
+            trace.instances.push_back(record.instance);
+            trace.records.push_back(std::move(record));
+        }
+        std::ranges::sort(trace.instances);
+        const auto duplicates = std::ranges::unique(trace.instances);
+        trace.instances.erase(duplicates.begin(), duplicates.end());
+        return true;
+    }
+}
@@ -0,0 +1,46 @@
+﻿#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace LuaFsm
+{
+    /**
+     * \brief One state change of an FSM instance
+     */
+    struct TraceRecord
+    {
+        //Tick of FSM_TIMERS.ticks when the state changed
+        uint32_t tick = 0;
+        //Instance number, in the order the instances first appear in the trace
+        uint32_t instance = 0;
+        //Empty for the initial state
+        std::string fromState;
+        std::string toState;
+        //Empty when changeState was called directly
+        std::string condition;
+    };
+
+    /**
+     * \brief Records of one FSM from a binary trace file written by FSM_TRACE:dump in FSM.lua
+     *
+     * Layout, little endian: "LFSMTRC1", u32 string count, every string as u16 length and its bytes,
+     * u32 record count, then 16 byte records of u32 tick, u32 instance, u16 fsm, u16 from, u16 to, u16 condition.
+     * fsm, from, to and condition index the strings from 1, 0 means none.
+     */
+    struct FsmTrace
+    {
+        std::string fsmId;
+        std::string filePath;
+        //Oldest first
+        std::vector<TraceRecord> records;
+        //Sorted instance numbers that appear in the records
+        std::vector<uint32_t> instances;
+
+        //Reads the records of fsmId, false when the bytes are not a trace or are cut off
+        static bool Parse(std::string_view bytes, const std::string& fsmId, FsmTrace& trace);
+
+        [[nodiscard]] bool IsEmpty() const { return records.empty(); }
+    };
+}
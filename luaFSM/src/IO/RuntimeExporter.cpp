@@ -0,0 +1,35 @@
+﻿#include "pch.h"
+#include "RuntimeExporter.h"
+
+#include "CodeWriter.h"
+
+namespace LuaFsm
+{
+    bool RuntimeExporter::IsTraceLine(std::string_view line)
+    {
+        const auto start = line.find_first_not_of(" \t");
+        if (start == std::string_view::npos)
+            return false;
+        line.remove_prefix(start);
+        while (!line.empty() && std::isspace(static_cast<unsigned char>(line.back())))
+            line.remove_suffix(1);
+        return line.starts_with("if FSM_LOG.traceOn then ") && line.ends_with(" end");
+    }
+
+    void RuntimeExporter::WriteRelease(const std::string_view runtime, CodeWriter& writer)
+    {
+        writer.Append("--Release build of FSM.lua exported by luaFSM, TRACE logging has been stripped\n");
+        size_t start = 0;
+        while (start < runtime.size())
+        {
+            auto end = runtime.find('\n', start);
+            if (end == std::string_view::npos)
+                end = runtime.size();
+            else
+                end++;
+            if (const auto line = runtime.substr(start, end - start); !IsTraceLine(line))
+                writer.Append(line);
+            start = end;
+        }
+    }
+}
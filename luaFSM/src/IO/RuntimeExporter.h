@@ -0,0 +1,20 @@
+﻿#pragma once
+#include <string_view>
+
+namespace LuaFsm
+{
+    class CodeWriter;
+
+    /**
+     * \brief Writes release copies of the FSM.lua runtime shipped with the editor
+     */
+    class RuntimeExporter
+    {
+    public:
+        static constexpr const char* RuntimePath = "assets/FSM.lua";
+
+        //Copies the runtime without its one-line "if FSM_LOG.traceOn then ... end" call sites
+        static void WriteRelease(std::string_view runtime, CodeWriter& writer);
+        [[nodiscard]] static bool IsTraceLine(std::string_view line);
+    };
+}
@@ -3,6 +3,7 @@
 #include "FSM.h"
 
 #include <codecvt>
+#include <filesystem>
 
 #include "FsmTrigger.h"
 #include <spdlog/fmt/bundled/format.h>
@@ -12,6 +13,7 @@
 #include "Graphics/Window.h"
 #include "imgui/imgui_stdlib.h"
 #include "imgui/NodeEditor.h"
+#include "IO/CodeWriter.h"
 #include "IO/FileReader.h"
 #include "json.hpp"
 #include "Log.h"
@@ -32,7 +34,8 @@ namespace LuaFsm
         m_States[key] = make_shared<FsmState>(key);
         auto value = m_States[key];
         if (m_InitialStateId.empty())
-            m_InitialStateId = key;
+            SetInitialState(key);
+        InvalidateActivateCode();
         return value;
     }
 
@@ -41,7 +44,8 @@ namespace LuaFsm
         const auto key = value->GetId();
         m_States[key] = value;
         if (m_InitialStateId.empty())
-            m_InitialStateId = key;
+            SetInitialState(key);
+        InvalidateActivateCode();
     }
 
     void Fsm::InitPopups()
@@ -62,6 +66,7 @@ namespace LuaFsm
         m_Triggers[key] = value;
         if (const auto state = value->GetCurrentState(); state != nullptr)
             state->AddTrigger(value);
+        InvalidateActivateCode();
     }
 
     FsmTriggerPtr Fsm::GetTrigger(const std::string& key)
@@ -92,7 +97,140 @@ namespace LuaFsm
                 value->SetNextState("");
         }
         if (m_InitialStateId == state)
-            m_InitialStateId = "";
+            SetInitialState("");
+        InvalidateActivateCode();
+    }
+
+    void Fsm::SetInitialState(const std::string& initialState)
+    {
+        if (m_InitialStateId == initialState)
+            return;
+        m_InitialStateId = initialState;
+        m_HeaderCode.Invalidate();
+        InvalidateActivateCode();
+    }
+
+    void Fsm::SetName(const std::string& name)
+    {
+        if (m_Name == name)
+            return;
+        m_Name = name;
+        m_HeaderCode.Invalidate();
+        m_CodeRevision++;
+    }
+
+    void Fsm::SetId(const std::string& id)
+    {
+        m_Id = id;
+        m_HeaderCode.Invalidate();
+        m_PredicatesCode.Invalidate();
+        InvalidateActivateCode();
+    }
+
+    void Fsm::SetCodeGenMode(const CodeGenMode mode)
+    {
+        if (m_CodeGenMode == mode)
+            return;
+        m_CodeGenMode = mode;
+        m_HeaderCode.Invalidate();
+        InvalidateActivateCode();
+        for (const auto& value : m_States | std::views::values)
+            value->InvalidateCode();
+        for (const auto& value : m_Triggers | std::views::values)
+            value->InvalidateCode();
+    }
+
+    void Fsm::SetUsesLayoutFile(const bool usesLayoutFile)
+    {
+        if (m_UsesLayoutFile == usesLayoutFile)
+            return;
+        m_UsesLayoutFile = usesLayoutFile;
+        m_HeaderCode.Invalidate();
+        m_CodeRevision++;
+        for (const auto& value : m_States | std::views::values)
+            value->InvalidateCode();
+        for (const auto& value : m_Triggers | std::views::values)
+            value->InvalidateCode();
+    }
+
+    std::string Fsm::GetLayoutFilePath(const std::string& luaFile)
+    {
+        return std::filesystem::path(luaFile).replace_extension(".layout.json").string();
+    }
+
+    nlohmann::json Fsm::ReadLayoutFile(const std::string& luaFile)
+    {
+        const auto layoutFile = GetLayoutFilePath(luaFile);
+        if (!FileReader::FileExists(layoutFile.c_str()))
+            return nlohmann::json::object();
+        auto layout = nlohmann::json::parse(FileReader::ReadAllText(layoutFile), nullptr, false);
+        if (layout.is_discarded() || !layout.is_object())
+            return nlohmann::json::object();
+        return layout;
+    }
+
+    nlohmann::json Fsm::GetLayoutEntry(const nlohmann::json& layout, const std::string& group, const std::string& id)
+    {
+        if (const auto entries = layout.find(group); entries != layout.end() && entries->is_object() && entries->contains(id))
+            return entries->at(id);
+        return nlohmann::json::object();
+    }
+
+    void Fsm::SaveLayoutFile() const
+    {
+        if (!m_UsesLayoutFile || m_LinkedFile.empty())
+            return;
+        nlohmann::json layout;
+        layout["fsm"] = m_Id;
+        auto& states = layout["states"] = nlohmann::json::object();
+        for (const auto& [key, state] : m_States)
+            states[key] = state->SerializeLayout();
+        auto& conditions = layout["conditions"] = nlohmann::json::object();
+        for (const auto& [key, condition] : m_Triggers)
+            conditions[key] = condition->SerializeLayout();
+        FileReader::SaveFile(GetLayoutFilePath(m_LinkedFile), layout.dump(4));
+    }
+
+    void Fsm::InvalidateActivateCode()
+    {
+        m_ActivateCode.Invalidate();
+        m_CodeRevision++;
+    }
+
+    const FsmPredicate* Fsm::GetPredicate(const std::string& name) const
+    {
+        const auto it = std::ranges::find(m_Predicates, name, &FsmPredicate::name);
+        return it != m_Predicates.end() ? &*it : nullptr;
+    }
+
+    bool Fsm::AddPredicate(const std::string& name)
+    {
+        if (name.empty() || std::regex_search(name, FsmRegex::InvalidIdRegex()))
+        {
+            ImGui::InsertNotification({ImGuiToastType::Error, 3000, "Predicate name %s is not a valid lua identifier!", name.c_str()});
+            return false;
+        }
+        if (GetPredicate(name))
+        {
+            ImGui::InsertNotification({ImGuiToastType::Error, 3000, "Predicate %s already exists!", name.c_str()});
+            return false;
+        }
+        m_Predicates.push_back({name, FunctionBody("return false"), nullptr});
+        InvalidatePredicatesCode();
+        return true;
+    }
+
+    void Fsm::RemovePredicate(const std::string& name)
+    {
+        if (std::erase_if(m_Predicates, [&name](const FsmPredicate& predicate) { return predicate.name == name; }) > 0)
+            InvalidatePredicatesCode();
+    }
+
+    void Fsm::InvalidatePredicatesCode()
+    {
+        m_PredicatesCode.Invalidate();
+        m_CodeRevision++;
+        m_UnSaved = true;
     }
 
     FsmState* Fsm::GetInitialState()
@@ -125,7 +263,11 @@ namespace LuaFsm
                 ImGui::SameLine();
                 if (ImGui::Button("Refactor ID"))
                     m_PopupManager.OpenPopup(static_cast<int>(StatePopups::SetNewId));
-                ImGui::InputText("Name", &m_Name);
+                if (ImGui::InputText("Name", &m_Name))
+                {
+                    m_HeaderCode.Invalidate();
+                    m_CodeRevision++;
+                }
                 ImGui::Separator();
                 ImGui::Text("Initial State: ");
                 if (!m_InitialStateId.empty())
@@ -160,6 +302,21 @@ namespace LuaFsm
                 else
                     ImGui::Text("Create a lua file to link it!");
                 ImGui::Separator();
+                //The mode of a linked file is read from the file itself
+                ImGui::BeginDisabled(!m_LinkedFile.empty());
+                if (bool useTable = UsesRegistrationTable(); ImGui::Checkbox("Registration table", &useTable))
+                    SetCodeGenMode(useTable ? CodeGenMode::RegistrationTable : CodeGenMode::LocalDeclarations);
+                ImGui::EndDisabled();
+                ImGui::SetItemTooltip("Declare states and conditions in tables and register them in a loop.\n"
+                                      "Use for large machines that hit lua's 200 locals limit.");
+                //A linked file can be moved to a layout file on its next save, but not back
+                ImGui::BeginDisabled(!m_LinkedFile.empty() && m_UsesLayoutFile);
+                if (bool useLayoutFile = m_UsesLayoutFile; ImGui::Checkbox("Layout file", &useLayoutFile))
+                    SetUsesLayoutFile(useLayoutFile);
+                ImGui::EndDisabled();
+                ImGui::SetItemTooltip("Save descriptions, node positions, colors and curves to a .layout.json file\n"
+                                      "next to the lua file, so the game only loads the logic.");
+                ImGui::Separator();
                 m_LuaCodeEditor.SetPalette(Window::GetPalette());
                 if (ImGui::Button("Regenerate code"))
                     m_LuaCodeEditor.SetText(GetLuaCode());
@@ -167,6 +324,11 @@ namespace LuaFsm
                 m_LuaCodeEditor.Render("Lua Code");
                 ImGui::EndTabItem();
             }
+            if (ImGui::BeginTabItem("Blackboard"))
+            {
+                DrawBlackboard();
+                ImGui::EndTabItem();
+            }
             if (ImGui::BeginTabItem("States"))
             {
                 ImGui::Text("States:");
@@ -245,6 +407,46 @@ namespace LuaFsm
         m_PopupManager.ShowOpenPopups();
     }
 
+    void Fsm::DrawBlackboard()
+    {
+        ImGui::TextWrapped("Predicates are queries shared by the conditions of this FSM, like line of sight or distance checks. "
+                           "A condition reads one with instance:query(\"name\"), the runtime computes it at most once per tick per instance.");
+        ImGui::Separator();
+        ImGui::InputText("##newPredicate", &m_NewPredicateName);
+        ImGui::SameLine();
+        if (ImGui::Button("Add predicate") && AddPredicate(m_NewPredicateName))
+        {
+            m_SelectedPredicate = m_Predicates.size() - 1;
+            m_NewPredicateName.clear();
+        }
+        if (m_Predicates.empty())
+            return;
+        ImGui::Separator();
+        m_SelectedPredicate = std::min(m_SelectedPredicate, m_Predicates.size() - 1);
+        if (ImGui::BeginListBox("Predicates##box", {500, 150}))
+        {
+            for (size_t i = 0; i < m_Predicates.size(); i++)
+            {
+                if (ImGui::Selectable(m_Predicates[i].name.c_str(), i == m_SelectedPredicate))
+                    m_SelectedPredicate = i;
+            }
+            ImGui::EndListBox();
+        }
+        auto& predicate = m_Predicates[m_SelectedPredicate];
+        ImGui::Text("instance:query(\"%s\")", predicate.name.c_str());
+        ImGui::SameLine();
+        if (ImGui::Button("Remove predicate"))
+        {
+            const auto name = predicate.name;
+            RemovePredicate(name);
+            return;
+        }
+        ImGui::PushID(predicate.name.c_str());
+        if (Window::DrawTextEditor(predicate.editor, predicate.body))
+            InvalidatePredicatesCode();
+        ImGui::PopID();
+    }
+
     void Fsm::LastState()
     {
         m_LastName = m_Name;
@@ -327,6 +529,24 @@ namespace LuaFsm
             code = std::regex_replace(code, regex, fmt::format("{0}.initialStateId = \"{1}\"", m_Id, m_InitialStateId));
         else if (!m_InitialStateId.empty())
             ImGui::InsertNotification({ImGuiToastType::Warning, 3000, "Initial state ID entry not found in file!"});
+        if (!NodeEditor::Get()->FunctionEditorOnly())
+        {
+            //The whole block is written again, so added, removed and renamed predicates all land in the file
+            CodeWriter predicates;
+            WritePredicatesCode(predicates);
+            auto block = predicates.ToString();
+            if (!block.empty())
+                block.pop_back();
+            if (std::smatch match; std::regex_search(code, match, FsmRegex::PredicatesBlock()))
+            {
+                if (block.empty())
+                    FsmRegex::RemoveEntry(code, FsmRegex::PredicatesBlock());
+                else
+                    code.replace(static_cast<size_t>(match.position(0)), static_cast<size_t>(match.length(0)), block);
+            }
+            else if (!block.empty() && !FsmRegex::InsertEntryAfter(code, FsmRegex::ClassStringRegex(m_Id, "initialStateId"), "\n" + block))
+                ImGui::InsertNotification({ImGuiToastType::Warning, 3000, "Initial state ID entry not found in file, predicates not saved!"});
+        }
         for (const auto& value : m_States | std::views::values)
             value->UpdateFileContents(code, value->GetId());
         for (const auto& value : m_Triggers | std::views::values)
@@ -336,34 +556,82 @@ namespace LuaFsm
 
     void Fsm::UpdateEditors()
     {
+        if (m_LuaCodeEditorRevision == m_CodeRevision)
+            return;
         m_LuaCodeEditor.SetText(GetLuaCode());
+        m_LuaCodeEditorRevision = m_CodeRevision;
     }
 
     std::string Fsm::GetActivateFunctionCode()
     {
-        std::string code;
-        code += fmt::format("\n--Example function of enabling the FSM\n");
-        code += fmt::format("---Activate this FSM\n");
-        code += fmt::format("function {0}:activate()\n", m_Id);
-        code += fmt::format("\t--If you want logging uncomment\n");
-        code += fmt::format("\t--if not FSM_LOG.enabled then\n");
-        code += fmt::format("\t--\tFSM_LOG:start(\"fsm_log.log\")\n");
-        code += fmt::format("\t--\tFSM_LOG:setLevel(FSM_LOG.logLevel.TRACE)\n");
-        code += fmt::format("\t--end\n");
-        for (const auto& [key, state] : m_States)
+        CodeWriter writer(EstimateLuaCodeSize());
+        WriteActivateFunctionCode(writer);
+        return writer.ToString();
+    }
+
+    void Fsm::WritePredicatesCode(CodeWriter& writer) const
+    {
+        size_t sizeHint = 160 + m_Id.size();
+        for (const auto& predicate : m_Predicates)
+            sizeHint += 48 + m_Id.size() + predicate.name.size() + CodeWriter::EstimateFunctionBodySize(predicate.body.Get());
+        writer.Append(m_PredicatesCode.Get(sizeHint, [this](CodeWriter& code)
         {
-            for (const auto& [id, trigger] : state->GetTriggers())
-                code += fmt::format("\t{0}:registerCondition({1})\n", state->GetId(), id);
-            code += fmt::format("\tself:registerState({0})\n", key);
-        }
-        code += fmt::format("\n\tif not self.currentState then\n");
-        if (m_InitialStateId.empty())
-            code += fmt::format("\t\tself:setInitialState(self.initialStateId)\n");
-        else
-            code += fmt::format("\t\tself:setInitialState(\"{0}\")\n", m_InitialStateId);
-        code += fmt::format("\tend\n");
-        code += fmt::format("end\n");
-        return code;
+            if (m_Predicates.empty())
+                return;
+            code.Append("---@predicates\n");
+            code.Append("--Blackboard, conditions read a predicate with instance:query(\"name\") and it is computed at most once per tick\n");
+            code.Write("{0}.predicates = {{}}\n", m_Id);
+            for (const auto& predicate : m_Predicates)
+            {
+                code.Write("\nfunction {0}.predicates.{1}(instance)\n", m_Id, predicate.name);
+                code.WriteFunctionBody(predicate.body.Get());
+                code.Append("end---@endFunc\n");
+            }
+            code.Append("---@endPredicates\n");
+        }));
+    }
+
+    void Fsm::WriteActivateFunctionCode(CodeWriter& writer) const
+    {
+        writer.Append(m_ActivateCode.Get(EstimateLuaCodeSize(), [this](CodeWriter& code)
+        {
+            code.Append("\n--Example function of enabling the FSM\n");
+            code.Append("---Activate this FSM\n");
+            code.Write("function {0}:activate()\n", m_Id);
+            code.Append("\t--If you want logging uncomment\n");
+            code.Append("\t--if not FSM_LOG.enabled then\n");
+            code.Append("\t--\tFSM_LOG:start(\"fsm_log.log\")\n");
+            code.Append("\t--\tFSM_LOG:setLevel(FSM_LOG.logLevel.TRACE)\n");
+            code.Append("\t--end\n");
+            if (UsesRegistrationTable())
+            {
+                code.Write("\tfor _, condition in pairs({0}) do\n", ConditionsTable);
+                code.Write("\t\tlocal state = {0}[condition.currentStateId]\n", StatesTable);
+                code.Append("\t\tif state then\n");
+                code.Append("\t\t\tstate:registerCondition(condition)\n");
+                code.Append("\t\tend\n");
+                code.Append("\tend\n");
+                code.Write("\tfor _, state in pairs({0}) do\n", StatesTable);
+                code.Append("\t\tself:registerState(state)\n");
+                code.Append("\tend\n");
+            }
+            else
+            {
+                for (const auto& [key, state] : m_States)
+                {
+                    for (const auto& id : state->GetTriggersRef() | std::views::keys)
+                        code.Write("\t{0}:registerCondition({1})\n", key, id);
+                    code.Write("\tself:registerState({0})\n", key);
+                }
+            }
+            code.Append("\n\tif not self.currentState then\n");
+            if (m_InitialStateId.empty())
+                code.Append("\t\tself:setInitialState(self.initialStateId)\n");
+            else
+                code.Write("\t\tself:setInitialState(\"{0}\")\n", m_InitialStateId);
+            code.Append("\tend\n");
+            code.Append("end\n");
+        }));
     }
 
     std::string Fsm::GetLinkedFileCode() const
@@ -380,21 +648,58 @@ namespace LuaFsm
         if (code.empty())
             return;
         m_UnSavedGlobal = false;
-        FileReader::SaveFile(m_LinkedFile, code);
+        if (m_UsesLayoutFile && !std::regex_search(code, FsmRegex::LayoutFileAnnotation()))
+        {
+            //The annotation makes the file load its layout file, it is added by the first save after switching
+            auto annotated = code;
+            FsmRegex::InsertEntryAfter(annotated, FsmRegex::ClassStringRegex(m_Id, "initialStateId"), "---@layoutFile");
+            FileReader::SaveFile(m_LinkedFile, annotated);
+        }
+        else
+            FileReader::SaveFile(m_LinkedFile, code);
+        SaveLayoutFile();
+        NodeEditor::Get()->CompileBytecode(m_LinkedFile);
     }
 
     std::string Fsm::GetLuaCode()
     {
-        std::string code;
-        code += fmt::format("--require(\"FSM\")\n\n");
-        code += fmt::format("---@FSM {0}\n", m_Id);
-        code += fmt::format("---@class {0} : FSM\n", m_Id);
-        code += fmt::format("{0} = FSM:new({{}})\n", m_Id);
-        code += fmt::format("{0}.id = \"{1}\"\n", m_Id, m_Id);
-        code += fmt::format("{0}.name = \"{1}\"\n", m_Id, m_Name);
-        code += fmt::format("{0}.initialStateId = \"{1}\"\n\n", m_Id, m_InitialStateId);
-        code += GetActivateFunctionCode();
-        return code;
+        CodeWriter writer(EstimateLuaCodeSize());
+        WriteLuaCode(writer);
+        return writer.ToString();
+    }
+
+    size_t Fsm::EstimateLuaCodeSize() const
+    {
+        size_t size = 640 + m_Id.size() * 8 + m_Name.size() + m_InitialStateId.size();
+        for (const auto& [key, state] : m_States)
+            size += 32 + key.size() * (state->GetTriggersRef().size() + 2) + state->GetTriggersRef().size() * 48;
+        for (const auto& predicate : m_Predicates)
+            size += 48 + m_Id.size() + predicate.name.size() + predicate.body.size();
+        return size;
+    }
+
+    void Fsm::WriteLuaCode(CodeWriter& writer) const
+    {
+        writer.Append(m_HeaderCode.Get(192 + m_Id.size() * 8 + m_Name.size() + m_InitialStateId.size(), [this](CodeWriter& code)
+        {
+            code.Append("--require(\"FSM\")\n\n");
+            code.Write("---@FSM {0}\n", m_Id);
+            code.Write("---@class {0} : FSM\n", m_Id);
+            code.Write("{0} = FSM:new({{}})\n", m_Id);
+            code.Write("{0}.id = \"{1}\"\n", m_Id, m_Id);
+            code.Write("{0}.name = \"{1}\"\n", m_Id, m_Name);
+            code.Write("{0}.initialStateId = \"{1}\"\n", m_Id, m_InitialStateId);
+            if (m_UsesLayoutFile)
+                code.Append("---@layoutFile\n");
+            code.Append("\n");
+            if (UsesRegistrationTable())
+            {
+                code.Write("local {0} = {{}}\n", StatesTable);
+                code.Write("local {0} = {{}}\n\n", ConditionsTable);
+            }
+        }));
+        WritePredicatesCode(writer);
+        WriteActivateFunctionCode(writer);
     }
 
     std::shared_ptr<Fsm> Fsm::CreateFromFile(const std::string& filePath)
@@ -436,15 +741,33 @@ namespace LuaFsm
         else
             name = m_Id;
         SetName(name);
+        SetCodeGenMode(std::regex_search(code, FsmRegex::LocalTableDeclaration(StatesTable))
+                           ? CodeGenMode::RegistrationTable
+                           : CodeGenMode::LocalDeclarations);
+        SetUsesLayoutFile(std::regex_search(code, FsmRegex::LayoutFileAnnotation()));
+        //States and conditions without an entry keep their defaults, so a lost layout file only costs the layout
+        //Parsed once here and handed to every state and condition
+        const auto layout = m_UsesLayoutFile ? ReadLayoutFile(filePath) : nlohmann::json::object();
+        if (m_UsesLayoutFile && layout.empty())
+            ImGui::InsertNotification({ImGuiToastType::Warning, 3000, "Layout file missing or invalid: %s", GetLayoutFilePath(filePath).c_str()});
         std::string initialStateId;
         for (const auto& state : m_States | std::views::values)
-            state->UpdateFromFile(filePath);
+            state->UpdateFromFile(filePath, layout);
         for (const auto& trigger : m_Triggers | std::views::values)
-            trigger->UpdateFromFile(filePath);
+            trigger->UpdateFromFile(filePath, layout);
+        m_Predicates.clear();
+        if (std::smatch block; std::regex_search(code, block, FsmRegex::PredicatesBlock()))
+        {
+            const auto text = block.str();
+            const auto regex = FsmRegex::PredicateFunction(m_Id);
+            for (auto it = std::sregex_iterator(text.begin(), text.end(), regex); it != std::sregex_iterator(); ++it)
+                m_Predicates.push_back({(*it)[1].str(), FunctionBody(FileReader::RemoveStartingTab((*it)[2].str())), nullptr});
+        }
+        InvalidatePredicatesCode();
         if (std::smatch match; std::regex_search(code, match, FsmRegex::ClassStringRegex(m_Id, "initialStateId")))
             initialStateId = match[1].str();
         SetInitialState(initialStateId);
-        m_LuaCodeEditor.SetText(GetLuaCode());
+        UpdateEditors();
         ImGui::InsertNotification({ImGuiToastType::Success, 3000, "Updated from file: %s", filePath.c_str()});
         m_UnSaved = false;
     }
@@ -455,6 +778,7 @@ namespace LuaFsm
         {
             m_Triggers[newId] = m_Triggers[oldId];
             m_Triggers.erase(oldId);
+            InvalidateActivateCode();
         }
     }
 
@@ -468,5 +792,6 @@ namespace LuaFsm
         if (const auto state = obj->GetCurrentState(); state != nullptr)
             state->RemoveTrigger(trigger);
         m_Triggers.erase(trigger);
+        InvalidateActivateCode();
     }
 }
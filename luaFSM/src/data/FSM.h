@@ -5,8 +5,10 @@
 #include "DrawableObject.h"
 #include "FsmState.h"
 #include "FsmTrigger.h"
+#include "FunctionBody.h"
 #include "json.hpp"
 #include "imgui/popups/Popup.h"
+#include "IO/CodeWriter.h"
 
 namespace LuaFsm
 {
@@ -20,7 +22,32 @@ namespace LuaFsm
     {
         SetNewId
     };
+
+    /**
+     * \brief How states and conditions are declared in the generated lua file
+     */
+    enum class CodeGenMode : int
+    {
+        //Every entity is a top-level local, registered one call at a time
+        LocalDeclarations,
+        //Entities are stored in file-local tables and registered in a loop,
+        //which keeps large machines under lua's 200 locals limit
+        RegistrationTable
+    };
     
+    /**
+     * \brief Named query on the blackboard of an FSM
+     *
+     * Conditions read it with instance:query("name"), the runtime computes it at most once per tick per instance.
+     */
+    struct FsmPredicate
+    {
+        std::string name;
+        FunctionBody body;
+        //Created the first time the properties draw it
+        std::unique_ptr<TextEditor> editor;
+    };
+
     /**
      * \brief Represents a Finite State Machine
      */
@@ -30,7 +57,7 @@ namespace LuaFsm
         explicit Fsm(const std::string& id);
         
         [[nodiscard]] std::unordered_map<std::string, FsmStatePtr> GetStates() const { return m_States; }
-        void ClearStates() { m_States.clear(); }
+        void ClearStates() { m_States.clear(); InvalidateActivateCode(); }
         
         FsmStatePtr GetState(const std::string& key);
         FsmStatePtr AddState(const std::string& key);
@@ -38,17 +65,43 @@ namespace LuaFsm
         void RemoveState(const std::string& state);
         
         [[nodiscard]] std::string GetInitialStateId() const { return m_InitialStateId; }
-        void SetInitialState(const std::string& initialState) { m_InitialStateId = initialState; }
+        void SetInitialState(const std::string& initialState);
         FsmState* GetInitialState();
         
         std::unordered_map<std::string, FsmTriggerPtr> GetTriggers();
-        void ClearTriggers() { m_Triggers.clear(); }
+        void ClearTriggers() { m_Triggers.clear(); InvalidateActivateCode(); }
         
         void AddTrigger(const FsmTriggerPtr& value);
         FsmTriggerPtr GetTrigger(const std::string& key);
         void RemoveTrigger(const std::string& trigger);
         void ChangeTriggerId(const std::string& oldId, const std::string& newId);
 
+        void SetName(const std::string& name) override;
+        void SetId(const std::string& id) override;
+
+        [[nodiscard]] CodeGenMode GetCodeGenMode() const { return m_CodeGenMode; }
+        void SetCodeGenMode(CodeGenMode mode);
+        [[nodiscard]] bool UsesRegistrationTable() const { return m_CodeGenMode == CodeGenMode::RegistrationTable; }
+        static constexpr const char* StatesTable = "FSM_STATES";
+        static constexpr const char* ConditionsTable = "FSM_CONDITIONS";
+
+        //Editor only fields (descriptions, positions, colors and curves) are kept in a sidecar file
+        //instead of the lua file, so the game doesn't load them
+        [[nodiscard]] bool UsesLayoutFile() const { return m_UsesLayoutFile; }
+        void SetUsesLayoutFile(bool usesLayoutFile);
+        static std::string GetLayoutFilePath(const std::string& luaFile);
+        static nlohmann::json ReadLayoutFile(const std::string& luaFile);
+        //Entry of a state or condition in a parsed layout file, empty when the layout file has none for it
+        static nlohmann::json GetLayoutEntry(const nlohmann::json& layout, const std::string& group, const std::string& id);
+        void SaveLayoutFile() const;
+
+        //Blackboard predicates shared by the conditions, kept in the order they were added
+        [[nodiscard]] const std::vector<FsmPredicate>& GetPredicates() const { return m_Predicates; }
+        [[nodiscard]] const FsmPredicate* GetPredicate(const std::string& name) const;
+        //False with a toast when the name is not a valid lua identifier or already taken
+        bool AddPredicate(const std::string& name);
+        void RemovePredicate(const std::string& name);
+
         std::string GetLinkedFile() const { return m_LinkedFile; }
         void SetLinkedFile(const std::string& linkedFile) { m_LinkedFile = linkedFile; }
 
@@ -56,6 +109,9 @@ namespace LuaFsm
         void SaveLinkedFile(const std::string& code);
         
         std::string GetLuaCode();
+        void WriteLuaCode(CodeWriter& writer) const;
+        [[nodiscard]] size_t EstimateLuaCodeSize() const;
+        void InvalidateActivateCode();
 
         static std::shared_ptr<Fsm> CreateFromFile(const std::string& filePath);
         void UpdateFromFile(const std::string& filePath);
@@ -75,11 +131,17 @@ namespace LuaFsm
         
         void UpdateEditors();
         std::string GetActivateFunctionCode();
+        void WriteActivateFunctionCode(CodeWriter& writer) const;
+        //Predicates between ---@predicates and ---@endPredicates, empty without predicates
+        void WritePredicatesCode(CodeWriter& writer) const;
         
         PopupManager* GetPopupManager() {return &m_PopupManager;}
         void InitPopups();
 
     private:
+        void InvalidatePredicatesCode();
+        void DrawBlackboard();
+
         std::unordered_map<std::string, FsmStatePtr> m_States{};
         std::unordered_map<std::string, FsmTriggerPtr> m_Triggers{};
         std::string m_InitialStateId;
@@ -88,7 +150,19 @@ namespace LuaFsm
         std::string m_LinkedFile = "";
         bool m_UnSaved = false;
         bool m_UnSavedGlobal = false;
+        CodeGenMode m_CodeGenMode = CodeGenMode::LocalDeclarations;
+        bool m_UsesLayoutFile = false;
         TextEditor m_LuaCodeEditor;
         PopupManager m_PopupManager;
+        std::vector<FsmPredicate> m_Predicates{};
+        std::string m_NewPredicateName;
+        size_t m_SelectedPredicate = 0;
+
+        //Generated code is cached per fragment and rebuilt by the setter that changed it
+        mutable CodeFragment m_HeaderCode;
+        mutable CodeFragment m_ActivateCode;
+        mutable CodeFragment m_PredicatesCode;
+        uint32_t m_CodeRevision = 1;
+        uint32_t m_LuaCodeEditorRevision = 0;
     };
 }
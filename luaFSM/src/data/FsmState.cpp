@@ -10,18 +10,13 @@
 #include "Graphics/Window.h"
 #include "imgui/ImGuiNotify.hpp"
 #include "imgui/NodeEditor.h"
+#include "IO/CodeWriter.h"
 #include "IO/FileReader.h"
 
 namespace LuaFsm
 {
     FsmState::FsmState(const std::string& id): DrawableObject(id)
     {
-        m_OnEnterEditor.SetText(m_OnEnter);
-        m_OnEnterEditor.SetLanguageDefinition(TextEditor::LanguageDefinition::Lua());
-        m_OnUpdateEditor.SetText(m_OnUpdate);
-        m_OnUpdateEditor.SetLanguageDefinition(TextEditor::LanguageDefinition::Lua());
-        m_OnExitEditor.SetText(m_OnExit);
-        m_OnExitEditor.SetLanguageDefinition(TextEditor::LanguageDefinition::Lua());
         m_LuaCodeEditor.SetLanguageDefinition(TextEditor::LanguageDefinition::Lua());
         m_Node.SetId(m_Id);
         m_Node.SetType(NodeType::State);
@@ -37,9 +32,9 @@ namespace LuaFsm
         m_OnUpdate = other.m_OnUpdate;
         m_OnExit = other.m_OnExit;
         m_IsExitState = other.m_IsExitState;
+        m_IsCoroutine = other.m_IsCoroutine;
         m_Node = other.m_Node;
-        for (const auto& value : other.m_Triggers | std::views::values)
-            AddTrigger(value);
+        m_Triggers = other.m_Triggers;
         m_Node.SetGridPos(other.m_Node.GetGridPos());
         m_Node.SetColor(other.m_Node.GetColor());
     }
@@ -48,9 +43,11 @@ namespace LuaFsm
     {
         const auto oldId = m_Id;
         m_Id = id;
+        InvalidateCode();
         const auto fsm = NodeEditor::Get()->GetCurrentFsm();
         if (!fsm)
             return;
+        fsm->InvalidateActivateCode();
         if (!oldId.empty())
         {
             for (const auto& [key, value] : fsm->GetStates())
@@ -84,18 +81,127 @@ namespace LuaFsm
 
     void FsmState::UpdateEditors()
     {
-        Window::TrimTrailingNewlines(m_OnEnter);
-        m_OnEnterEditor.SetText(m_OnEnter);
-        Window::TrimTrailingNewlines(m_OnUpdate);
-        m_OnUpdateEditor.SetText(m_OnUpdate);
-        Window::TrimTrailingNewlines(m_OnExit);
-        m_OnExitEditor.SetText(m_OnExit);
-        m_LuaCodeEditor.SetText(GetLuaCode());
+        if (m_OnEnter.TrimTrailingNewlines())
+        {
+            InvalidateFragment(m_OnEnterCode);
+            m_EditorsDirty = true;
+        }
+        if (m_OnUpdate.TrimTrailingNewlines())
+        {
+            InvalidateFragment(m_OnUpdateCode);
+            m_EditorsDirty = true;
+        }
+        if (m_OnExit.TrimTrailingNewlines())
+        {
+            InvalidateFragment(m_OnExitCode);
+            m_EditorsDirty = true;
+        }
+        if (m_EditorsDirty)
+        {
+            if (m_OnEnterEditor)
+                m_OnEnterEditor->SetText(m_OnEnter.Get());
+            if (m_OnUpdateEditor)
+                m_OnUpdateEditor->SetText(m_OnUpdate.Get());
+            if (m_OnExitEditor)
+                m_OnExitEditor->SetText(m_OnExit.Get());
+            m_EditorsDirty = false;
+        }
+        RefreshLayoutCode();
+        if (m_LuaCodeEditorRevision != m_CodeRevision)
+        {
+            m_LuaCodeEditor.SetText(GetLuaCode());
+            m_LuaCodeEditorRevision = m_CodeRevision;
+        }
+    }
+
+    void FsmState::SetName(const std::string& name)
+    {
+        if (m_Name == name)
+            return;
+        m_Name = name;
+        InvalidateFragment(m_InfoCode);
+    }
+
+    void FsmState::SetDescription(const std::string& description)
+    {
+        if (m_Description == description)
+            return;
+        m_Description = description;
+        InvalidateFragment(m_InfoCode);
+    }
+
+    void FsmState::SetExitState(const bool isExitState)
+    {
+        if (m_IsExitState == isExitState)
+            return;
+        m_IsExitState = isExitState;
+        InvalidateFragment(m_InfoCode);
+    }
+
+    void FsmState::SetCoroutine(const bool isCoroutine)
+    {
+        if (m_IsCoroutine == isCoroutine)
+            return;
+        m_IsCoroutine = isCoroutine;
+        InvalidateFragment(m_InfoCode);
+    }
+
+    void FsmState::SetOnEnter(const std::string& onEnter)
+    {
+        if (m_OnEnter == onEnter)
+            return;
+        m_OnEnter = onEnter;
+        InvalidateFragment(m_OnEnterCode);
+        m_EditorsDirty = true;
+    }
+
+    void FsmState::SetOnUpdate(const std::string& onUpdate)
+    {
+        if (m_OnUpdate == onUpdate)
+            return;
+        m_OnUpdate = onUpdate;
+        InvalidateFragment(m_OnUpdateCode);
+        m_EditorsDirty = true;
+    }
+
+    void FsmState::SetOnExit(const std::string& onExit)
+    {
+        if (m_OnExit == onExit)
+            return;
+        m_OnExit = onExit;
+        InvalidateFragment(m_OnExitCode);
+        m_EditorsDirty = true;
+    }
+
+    void FsmState::InvalidateFragment(CodeFragment& fragment)
+    {
+        fragment.Invalidate();
+        m_CodeRevision++;
+    }
+
+    void FsmState::InvalidateCode()
+    {
+        for (auto* fragment : {&m_HeaderCode, &m_InfoCode, &m_LayoutCode, &m_OnUpdateCode, &m_OnEnterCode, &m_OnExitCode})
+            fragment->Invalidate();
+        m_CodeRevision++;
+    }
+
+    void FsmState::RefreshLayoutCode() const
+    {
+        //Nodes are moved and recoloured directly on the canvas, so the layout is compared instead
+        if (const auto layout = m_Node.GetLayout(); layout != m_CodeLayout)
+        {
+            m_CodeLayout = layout;
+            m_LayoutCode.Invalidate();
+            m_CodeRevision++;
+        }
     }
 
     void FsmState::AddTrigger(const std::string& key, const FsmTriggerPtr& value)
     {
         m_Triggers[key] = value;
+        if (const auto fsm = NodeEditor::Get()->GetCurrentFsm())
+            fsm->InvalidateActivateCode();
         if (value == nullptr)
             return;
         if (value->GetCurrentStateId() != m_Id)
@@ -106,6 +212,8 @@ namespace LuaFsm
     FsmTriggerPtr FsmState::AddTrigger(const std::string& key)
     {
         m_Triggers[key] = std::make_shared<FsmTrigger>(key);
+        if (const auto fsm = NodeEditor::Get()->GetCurrentFsm())
+            fsm->InvalidateActivateCode();
         auto& value = m_Triggers[key]; // Reference to the shared pointer
         value->SetCurrentState(m_Id);
         return value;
@@ -147,6 +255,11 @@ namespace LuaFsm
     }
     
     void FsmState::UpdateFromFile(const std::string& filePath)
+    {
+        UpdateFromFile(filePath, WritesLayoutFile() ? Fsm::ReadLayoutFile(filePath) : nlohmann::json::object());
+    }
+
+    void FsmState::UpdateFromFile(const std::string& filePath, const nlohmann::json& layout)
     {
         const std::string code = FileReader::ReadAllText(filePath);
         if (code.empty())
@@ -157,15 +270,25 @@ namespace LuaFsm
         else
             name = m_Id;
         SetName(name);
-        std::string description;
-        if (std::smatch match; std::regex_search(code, match, FsmRegex::ClassStringRegex(m_Id, "description")))
-            description = match[1].str();
-        SetDescription(description);
+        const bool layoutFile = WritesLayoutFile();
+        if (layoutFile)
+            DeserializeLayout(Fsm::GetLayoutEntry(layout, "states", m_Id));
+        else
+        {
+            std::string description;
+            if (std::smatch match; std::regex_search(code, match, FsmRegex::ClassStringRegex(m_Id, "description")))
+                description = match[1].str();
+            SetDescription(description);
+        }
         bool isExitState = false;
         if (std::smatch match; std::regex_search(code, match, FsmRegex::ClassBoolRegex(m_Id, "isExitState")))
             isExitState = match[1].str() == "true";
         SetExitState(isExitState);
-        if (std::smatch match; std::regex_search(code, match, FsmRegex::ClassTableRegex(m_Id, "editorPos")))
+        bool isCoroutine = false;
+        if (std::smatch match; std::regex_search(code, match, FsmRegex::ClassBoolRegex(m_Id, "isCoroutine")))
+            isCoroutine = match[1].str() == "true";
+        SetCoroutine(isCoroutine);
+        if (std::smatch match; !layoutFile && std::regex_search(code, match, FsmRegex::ClassTableRegex(m_Id, "editorPos")))
         {
             std::string tableContent = match[1].str();
             std::regex idRegex = FsmRegex::ClassTableElementsRegex();
@@ -182,7 +305,7 @@ namespace LuaFsm
                 GetNode()->SetGridPos(position);
             }
         }
-        if (std::smatch match; std::regex_search(code, match, FsmRegex::ClassTableRegex(m_Id, "color")))
+        if (std::smatch match; !layoutFile && std::regex_search(code, match, FsmRegex::ClassTableRegex(m_Id, "color")))
         {
             std::string tableContent = match[1].str();
             std::regex idRegex = FsmRegex::ClassTableElementsRegex();
@@ -258,8 +381,12 @@ namespace LuaFsm
             code = std::regex_replace(code, regex, fmt::format("{0}.id = \"{1}\"", m_Id, m_Id));
         else
             ImGui::InsertNotification({ImGuiToastType::Warning, 3000, "state id entry not found in file!"});
+        //Files saved before the FSM used a layout file still hold its fields, they are moved out on this save
+        const bool layoutFile = WritesLayoutFile();
         regex = FsmRegex::ClassStringRegex(oldId, "description");
-        if (std::smatch match; std::regex_search(code, match, regex))
+        if (layoutFile)
+            FsmRegex::RemoveEntry(code, regex);
+        else if (std::smatch match; std::regex_search(code, match, regex))
             code = std::regex_replace(code, regex, fmt::format("{0}.description = \"{1}\"", m_Id, m_Description));
         else if (!m_Description.empty())
             ImGui::InsertNotification({ImGuiToastType::Warning, 3000, "Fsm state %s description entry not found in file!", m_Id.c_str()});
@@ -271,8 +398,15 @@ namespace LuaFsm
         }
         else if (m_IsExitState)
             ImGui::InsertNotification({ImGuiToastType::Warning, 3000, "Fsm state %s isExitState entry not found in file!", m_Id.c_str()});
-        regex = FsmRegex::ClassTableRegex(oldId, "editorPos");
+        regex = FsmRegex::ClassBoolRegex(oldId, "isCoroutine");
         if (std::smatch match; std::regex_search(code, match, regex))
+            code = std::regex_replace(code, regex, fmt::format("{0}.isCoroutine = {1}", m_Id, m_IsCoroutine ? "true" : "false"));
+        else if (m_IsCoroutine && !FsmRegex::InsertEntryAfter(code, FsmRegex::ClassBoolRegex(m_Id, "isExitState"), fmt::format("{0}.isCoroutine = true", m_Id)))
+            ImGui::InsertNotification({ImGuiToastType::Warning, 3000, "Fsm state %s isCoroutine entry not found in file!", m_Id.c_str()});
+        regex = FsmRegex::ClassTableRegex(oldId, "editorPos");
+        if (layoutFile)
+            FsmRegex::RemoveEntry(code, regex);
+        else if (std::smatch match; std::regex_search(code, match, regex))
         {
             std::string tableContent = match[1].str();
             std::regex idRegex = FsmRegex::ClassTableElementsRegex();
@@ -293,7 +427,9 @@ namespace LuaFsm
         else
             ImGui::InsertNotification({ImGuiToastType::Warning, 3000, "Fsm state %s position entry not found in file!", m_Id.c_str()});
         regex = FsmRegex::ClassTableRegex(oldId, "color");
-        if (std::smatch match; std::regex_search(code, match, regex))
+        if (layoutFile)
+            FsmRegex::RemoveEntry(code, regex);
+        else if (std::smatch match; std::regex_search(code, match, regex))
         {
             std::string tableContent = match[1].str();
             std::regex idRegex = FsmRegex::ClassTableElementsRegex();
@@ -318,10 +454,9 @@ namespace LuaFsm
             regex = FsmRegex::FunctionBodyReplace(oldId, "onEnter");
             if (std::smatch match; std::regex_search(code, match, regex))
             {
-                std::string func;
-                for (const auto& line : m_OnEnterEditor.GetTextLines())
-                    func += fmt::format("\t{0}\n", line);
-                code = std::regex_replace(code, regex, "$1\n" + func + "$3");
+                CodeWriter func(CodeWriter::EstimateFunctionBodySize(m_OnEnter.Get()));
+                func.WriteFunctionBody(m_OnEnter.Get());
+                code = std::regex_replace(code, regex, "$1\n" + func.ToString() + "$3");
                 auto regexString = fmt::format("({0}:onEnter)", oldId);
                 regex = std::regex(regexString);
                 code = std::regex_replace(code, regex, fmt::format("{0}:onEnter", m_Id));
@@ -331,10 +466,9 @@ namespace LuaFsm
             regex = FsmRegex::FunctionBodyReplace(oldId, "onUpdate");
             if (std::smatch match; std::regex_search(code, match, regex))
             {
-                std::string func;
-                for (const auto& line : m_OnUpdateEditor.GetTextLines())
-                    func += fmt::format("\t{0}\n", line);
-                code = std::regex_replace(code, regex, "$1\n" + func + "$3");
+                CodeWriter func(CodeWriter::EstimateFunctionBodySize(m_OnUpdate.Get()));
+                func.WriteFunctionBody(m_OnUpdate.Get());
+                code = std::regex_replace(code, regex, "$1\n" + func.ToString() + "$3");
                 auto regexString = fmt::format("({0}:onUpdate)", oldId);
                 regex = std::regex(regexString);
                 code = std::regex_replace(code, regex, fmt::format("{0}:onEnter", m_Id));
@@ -344,10 +478,9 @@ namespace LuaFsm
             regex = FsmRegex::FunctionBodyReplace(oldId, "onExit");
             if (std::smatch match; std::regex_search(code, match, regex))
             {
-                std::string func;
-                for (const auto& line : m_OnExitEditor.GetTextLines())
-                    func += fmt::format("\t{0}\n", line);
-                code = std::regex_replace(code, regex, "$1\n" + func + "$3");
+                CodeWriter func(CodeWriter::EstimateFunctionBodySize(m_OnExit.Get()));
+                func.WriteFunctionBody(m_OnExit.Get());
+                code = std::regex_replace(code, regex, "$1\n" + func.ToString() + "$3");
                 auto regexString = fmt::format("({0}:onExit)", oldId);
                 regex = std::regex(regexString);
                 code = std::regex_replace(code, regex, fmt::format("{0}:onEnter", m_Id));
@@ -427,7 +560,14 @@ namespace LuaFsm
                         NodeEditor::Get()->GetCurrentFsm()->SetInitialState("");
                 }
                 ImGui::SameLine();
-                ImGui::Checkbox(MakeIdString("Is Exit State").c_str(), &m_IsExitState);
+                if (ImGui::Checkbox(MakeIdString("Is Exit State").c_str(), &m_IsExitState))
+                    InvalidateFragment(m_InfoCode);
+                ImGui::SameLine();
+                if (ImGui::Checkbox(MakeIdString("Coroutine").c_str(), &m_IsCoroutine))
+                    InvalidateFragment(m_InfoCode);
+                ImGui::SetItemTooltip("Run onUpdate once per entry of the state, as a coroutine resumed every update.\n"
+                                      "Call coroutine.yield() in it to wait for the next update.\n"
+                                      "It is closed if the state is left before it returns.");
                 ImGui::Separator();
                 auto color = m_Node.GetColor();
                 ImGui::ColorEdit4(MakeIdString("Node Color").c_str(), reinterpret_cast<float*>(&color));
@@ -454,6 +594,8 @@ namespace LuaFsm
                         {
                             std::string key = trigger->GetId();
                             std::string label = key + fmt::format(" : priority {0}", trigger->GetPriority());
+                            if (trigger->IsEventDriven())
+                                label += fmt::format(" : on {0}", trigger->GetEvent());
                             ImGui::Selectable(MakeIdString(label).c_str(), false);
                             ImGui::SetItemTooltip(fmt::format("{0}\n{1}", trigger->GetName(), trigger->GetDescription()).c_str());
                             if (ImGui::IsItemClicked())
@@ -487,19 +629,22 @@ namespace LuaFsm
                         RemoveTrigger(key);
                 }
                 ImGui::Text("OnEnter:");
-                Window::DrawTextEditor(m_OnEnterEditor, m_OnEnter);
+                if (Window::DrawTextEditor(m_OnEnterEditor, m_OnEnter))
+                    InvalidateFragment(m_OnEnterCode);
                 ImGui::EndTabItem();
             }
             
             if (ImGui::BeginTabItem(MakeIdString("OnUpdate").c_str()))
             {
-                Window::DrawTextEditor(m_OnUpdateEditor, m_OnUpdate);
+                if (Window::DrawTextEditor(m_OnUpdateEditor, m_OnUpdate))
+                    InvalidateFragment(m_OnUpdateCode);
                 ImGui::EndTabItem();
             }
             
             if (ImGui::BeginTabItem(MakeIdString("OnExit").c_str()))
             {
-                Window::DrawTextEditor(m_OnExitEditor, m_OnExit);
+                if (Window::DrawTextEditor(m_OnExitEditor, m_OnExit))
+                    InvalidateFragment(m_OnExitCode);
                 ImGui::EndTabItem();
             }
             
@@ -554,6 +699,8 @@ namespace LuaFsm
             return;
         obj->SetCurrentState("");
         m_Triggers.erase(trigger);
+        if (const auto fsm = NodeEditor::Get()->GetCurrentFsm())
+            fsm->InvalidateActivateCode();
     }
 
     void FsmState::AppendToFile()
@@ -563,62 +710,124 @@ namespace LuaFsm
             const auto filePath = fsm->GetLinkedFile();
             if (filePath.empty())
                 return;
-            auto code = FileReader::ReadAllText(filePath);
-            if (code.empty())
+            if (!FileReader::FileExists(filePath.c_str()))
                 return;
-            code += "\n\n";
-            code += GetLuaCode();
-            std::ofstream file(filePath);
+            std::ofstream file(filePath, std::ios::app);
             if (!file.is_open())
             {
                 ImGui::InsertNotification({ImGuiToastType::Error, 3000, "Failed to export file at: %s", filePath.c_str()});
                 return;
             }
-            file << code;
+            bool written;
+            {
+                CodeWriter writer(file, EstimateLuaCodeSize() + 2);
+                writer.Append("\n\n");
+                WriteLuaCode(writer);
+                written = writer.Flush();
+            }
             file.close();
+            if (!written || !file.good())
+            {
+                ImGui::InsertNotification({ImGuiToastType::Error, 3000, "Failed to write file at: %s", filePath.c_str()});
+                return;
+            }
+            fsm->SaveLayoutFile();
+            NodeEditor::Get()->CompileBytecode(filePath);
             CreateLastState();
         }
     }
     
     std::string FsmState::GetLuaCode()
     {
-        std::string code;
-        code += fmt::format("---@FSM_STATE {0}\n", m_Id);
-        code += fmt::format("---@class {0} : FSM_STATE\n", m_Id);
-        code += fmt::format("local {0} = FSM_STATE:new({{}})\n", m_Id);
-        code += fmt::format("{0}.id = \"{1}\"\n", m_Id, m_Id);
-        code += fmt::format("{0}.name = \"{1}\"\n", m_Id, m_Name);
-        code += fmt::format("{0}.description = \"{1}\"\n", m_Id, m_Description);
-        std::string isExitState = m_IsExitState ? "true" : "false";
-        code += fmt::format("{0}.isExitState = {1}\n", m_Id, isExitState);
-        code += fmt::format("{0}.editorPos = {{{1}, {2}}}\n", m_Id, m_Node.GetGridPos().x, m_Node.GetGridPos().y);
-        code += fmt::format("{0}.color = {{{1}, {2}, {3}, {4}}}\n", m_Id, m_Node.GetColor().Value.x, m_Node.GetColor().Value.y, m_Node.GetColor().Value.z, m_Node.GetColor().Value.w);
-        if (!m_OnUpdate.empty())
+        CodeWriter writer(EstimateLuaCodeSize());
+        WriteLuaCode(writer);
+        return writer.ToString();
+    }
+
+    size_t FsmState::EstimateLuaCodeSize() const
+    {
+        size_t size = 256 + m_Id.size() * 12 + m_Name.size() + m_Description.size();
+        for (const auto* function : {&m_OnUpdate, &m_OnEnter, &m_OnExit})
+            if (!function->empty())
+                size += 32 + m_Id.size() + CodeWriter::EstimateFunctionBodySize(function->Get());
+        return size;
+    }
+
+    bool FsmState::WritesLayoutFile()
+    {
+        const auto fsm = NodeEditor::Get()->GetCurrentFsm();
+        return fsm && fsm->UsesLayoutFile();
+    }
+
+    nlohmann::json FsmState::SerializeLayout() const
+    {
+        const auto layout = m_Node.GetLayout();
+        nlohmann::json json;
+        json["description"] = m_Description;
+        json["editorPos"] = {layout.gridPos.x, layout.gridPos.y};
+        json["color"] = {layout.color.x, layout.color.y, layout.color.z, layout.color.w};
+        return json;
+    }
+
+    void FsmState::DeserializeLayout(const nlohmann::json& layout)
+    {
+        SetDescription(layout.value("description", ""));
+        if (const auto pos = layout.find("editorPos"); pos != layout.end() && pos->is_array() && pos->size() >= 2)
+            GetNode()->SetGridPos({pos->at(0).get<float>(), pos->at(1).get<float>()});
+        if (const auto color = layout.find("color"); color != layout.end() && color->is_array() && color->size() >= 4)
+            GetNode()->SetColor(ImColor(color->at(0).get<float>(), color->at(1).get<float>(), color->at(2).get<float>(), color->at(3).get<float>()));
+    }
+
+    std::string FsmState::GetLuaReference() const
+    {
+        if (const auto fsm = NodeEditor::Get()->GetCurrentFsm(); fsm && fsm->UsesRegistrationTable())
+            return fmt::format("{0}.{1}", Fsm::StatesTable, m_Id);
+        return m_Id;
+    }
+
+    void FsmState::WriteLuaCode(CodeWriter& writer) const
+    {
+        const auto reference = GetLuaReference();
+        const bool layoutFile = WritesLayoutFile();
+        writer.Append(m_HeaderCode.Get(128 + m_Id.size() * 4, [this, &reference](CodeWriter& code)
         {
-            code += fmt::format("\nfunction {0}:onUpdate()\n", m_Id);
-            for (const auto& line : m_OnUpdateEditor.GetTextLines())
-                code += fmt::format("\t{0}\n", line);
-            code += fmt::format("end---@endFunc\n");
-        }
-        if (!m_OnEnter.empty())
+            code.Write("---@FSM_STATE {0}\n", m_Id);
+            code.Write("---@class {0} : FSM_STATE\n", m_Id);
+            code.Write("{0}{1} = FSM_STATE:new({{}})\n", reference == m_Id ? "local " : "", reference);
+            code.Write("{0}.id = \"{1}\"\n", reference, m_Id);
+        }));
+        writer.Append(m_InfoCode.Get(104 + m_Id.size() * 4 + m_Name.size() + m_Description.size(), [this, &reference, layoutFile](CodeWriter& code)
         {
-            code += fmt::format("\nfunction {0}:onEnter()\n", m_Id);
-            for (const auto& line : m_OnEnterEditor.GetTextLines())
-                code += fmt::format("\t{0}\n", line);
-            code += fmt::format("end---@endFunc\n");
-        }
-        if (!m_OnExit.empty())
+            code.Write("{0}.name = \"{1}\"\n", reference, m_Name);
+            if (!layoutFile)
+                code.Write("{0}.description = \"{1}\"\n", reference, m_Description);
+            code.Write("{0}.isExitState = {1}\n", reference, m_IsExitState ? "true" : "false");
+            code.Write("{0}.isCoroutine = {1}\n", reference, m_IsCoroutine ? "true" : "false");
+        }));
+        RefreshLayoutCode();
+        writer.Append(m_LayoutCode.Get(96 + m_Id.size() * 2, [this, &reference, layoutFile](CodeWriter& code)
         {
-            code += fmt::format("\nfunction {0}:onExit()\n", m_Id);
-            for (const auto& line : m_OnExitEditor.GetTextLines())
-                code += fmt::format("\t{0}\n", line);
-            code += fmt::format("end---@endFunc\n");
-        }
-        //for (const auto& value : m_Triggers | std::views::values)
-        //{
-        //    code += value->GetLuaCode() + "\n";
-        //}
-        return code;
+            if (layoutFile)
+                return;
+            const auto& layout = m_CodeLayout;
+            code.Write("{0}.editorPos = {{{1}, {2}}}\n", reference, layout.gridPos.x, layout.gridPos.y);
+            code.Write("{0}.color = {{{1}, {2}, {3}, {4}}}\n", reference, layout.color.x, layout.color.y, layout.color.z, layout.color.w);
+        }));
+        //instance is the FSM, or the FSM:newInstance record, that runs the state
+        const auto writeFunction = [&reference](CodeWriter& code, const char* name, const char* parameters, const std::string& body)
+        {
+            if (body.empty())
+                return;
+            code.Write("\nfunction {0}:{1}({2})\n", reference, name, parameters);
+            code.WriteFunctionBody(body);
+            code.Append("end---@endFunc\n");
+        };
+        writer.Append(m_OnUpdateCode.Get(32 + m_Id.size() + CodeWriter::EstimateFunctionBodySize(m_OnUpdate.Get()),
+            [&](CodeWriter& code) { writeFunction(code, "onUpdate", CodeWriter::UsesVarargs(m_OnUpdate.Get()) ? "instance, ..." : "instance", m_OnUpdate.Get()); }));
+        writer.Append(m_OnEnterCode.Get(32 + m_Id.size() + CodeWriter::EstimateFunctionBodySize(m_OnEnter.Get()),
+            [&](CodeWriter& code) { writeFunction(code, "onEnter", "instance", m_OnEnter.Get()); }));
+        writer.Append(m_OnExitCode.Get(32 + m_Id.size() + CodeWriter::EstimateFunctionBodySize(m_OnExit.Get()),
+            [&](CodeWriter& code) { writeFunction(code, "onExit", "instance", m_OnExit.Get()); }));
     }
     
     
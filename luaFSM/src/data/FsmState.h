@@ -4,8 +4,10 @@
 
 #include "FsmTrigger.h"
 #include "Fsm.h"
+#include "FunctionBody.h"
 #include "Graphics/VisualNode.h"
 #include "imgui/TextEditor.h"
+#include "IO/CodeWriter.h"
 
 namespace LuaFsm
 {
@@ -45,6 +47,7 @@ namespace LuaFsm
             m_OnExit == other.GetOnExit() &&
             m_Description == other.GetDescription() &&
             m_IsExitState == other.IsExitState() &&
+            m_IsCoroutine == other.IsCoroutine() &&
             m_Node.GetGridPos() == other.GetNode().GetGridPos() &&
             m_Node.GetColor() == static_cast<ImVec4>(other.GetNode().GetColor());
         }
@@ -64,6 +67,7 @@ namespace LuaFsm
             m_OnExit == other.GetOnExit() &&
             m_Description == other.GetDescription() &&
             m_IsExitState == other.IsExitState() &&
+            m_IsCoroutine == other.IsCoroutine() &&
             m_Node.GetGridPos() == other.GetNode()->GetGridPos() &&
             m_Node.GetColor() == static_cast<ImVec4>(other.GetNode()->GetColor());
         }
@@ -83,6 +87,7 @@ namespace LuaFsm
             m_OnExit == other.GetOnExit() ||
             m_Description == other.GetDescription() ||
             m_IsExitState == other.IsExitState() ||
+            m_IsCoroutine == other.IsCoroutine() ||
             m_Node.GetGridPos() == other.GetNode().GetGridPos() ||
             m_Node.GetColor() == static_cast<ImVec4>(other.GetNode().GetColor());
         }
@@ -102,6 +107,7 @@ namespace LuaFsm
             m_OnExit != other.GetOnExit() ||
             m_Description != other.GetDescription() ||
             m_IsExitState != other.IsExitState() ||
+            m_IsCoroutine != other.IsCoroutine() ||
             m_Node.GetGridPos() != other.GetNode()->GetGridPos() ||
             m_Node.GetColor() != static_cast<ImVec4>(other.GetNode()->GetColor());
         }
@@ -109,23 +115,27 @@ namespace LuaFsm
         [[nodiscard]] bool IsUnSaved() const { return m_UnSaved; }
         void SetUnSaved(const bool unSaved) { m_UnSaved = unSaved; }
         
-        void SetName(const std::string& name) override { m_Name = name; }
+        void SetName(const std::string& name) override;
         void SetId(const std::string& id) override;
         void RefactorId(const std::string& newId);
         
         [[nodiscard]] std::string GetDescription() const { return m_Description; }
-        void SetDescription(const std::string& description) { m_Description = description; }
+        void SetDescription(const std::string& description);
         
-        [[nodiscard]] std::string GetOnEnter() const { return m_OnEnter; }
-        void SetOnEnter(const std::string& onEnter) { m_OnEnter = onEnter; }
+        [[nodiscard]] const std::string& GetOnEnter() const { return m_OnEnter.Get(); }
+        [[nodiscard]] const FunctionBody& GetOnEnterBody() const { return m_OnEnter; }
+        void SetOnEnter(const std::string& onEnter);
         
-        [[nodiscard]] std::string GetOnUpdate() const { return m_OnUpdate; }
-        void SetOnUpdate(const std::string& onUpdate) { m_OnUpdate = onUpdate; }
+        [[nodiscard]] const std::string& GetOnUpdate() const { return m_OnUpdate.Get(); }
+        [[nodiscard]] const FunctionBody& GetOnUpdateBody() const { return m_OnUpdate; }
+        void SetOnUpdate(const std::string& onUpdate);
         
-        [[nodiscard]] std::string GetOnExit() const { return m_OnExit; }
-        void SetOnExit(const std::string& onExit) { m_OnExit = onExit; }
+        [[nodiscard]] const std::string& GetOnExit() const { return m_OnExit.Get(); }
+        [[nodiscard]] const FunctionBody& GetOnExitBody() const { return m_OnExit; }
+        void SetOnExit(const std::string& onExit);
         
         [[nodiscard]] std::unordered_map<std::string, FsmTriggerPtr> GetTriggers() const { return m_Triggers; }
+        [[nodiscard]] const std::unordered_map<std::string, FsmTriggerPtr>& GetTriggersRef() const { return m_Triggers; }
         void AddTrigger(const std::string& key, const FsmTriggerPtr& value);
         void AddTrigger(const FsmTriggerPtr& value);
         FsmTriggerPtr AddTrigger(const std::string& key);
@@ -135,42 +145,73 @@ namespace LuaFsm
         
         static std::vector<std::shared_ptr<FsmState>> CreateFromFile(const std::string& filePath);
         void UpdateFromFile(const std::string& filePath);
+        //With the layout file of the FSM already parsed, loading a whole FSM reads it once
+        void UpdateFromFile(const std::string& filePath, const nlohmann::json& layout);
         void UpdateFileContents(std::string& code, const std::string& oldId);
         void UpdateToFile(const std::string& oldId);
         void AppendToFile();
+        //Entry of this state in the layout file of the FSM
+        [[nodiscard]] nlohmann::json SerializeLayout() const;
+        void DeserializeLayout(const nlohmann::json& layout);
         
         void DrawProperties();
         void CreateLastState();
         bool IsChanged();
         std::string GetLuaCode();
+        void WriteLuaCode(CodeWriter& writer) const;
+        [[nodiscard]] size_t EstimateLuaCodeSize() const;
+        void InvalidateCode();
         
         VisualNode* DrawNode();
         VisualNode* GetNode() { return &m_Node; }
         VisualNode GetNode() const { return m_Node; }
-        TextEditor* GetOnEnterEditor() { return &m_OnEnterEditor; }
-        TextEditor* GetOnUpdateEditor() { return &m_OnUpdateEditor; }
-        TextEditor* GetOnExitEditor() { return &m_OnExitEditor; }
+        //Editors are created the first time the properties draw them, null until then
+        TextEditor* GetOnEnterEditor() { return m_OnEnterEditor.get(); }
+        TextEditor* GetOnUpdateEditor() { return m_OnUpdateEditor.get(); }
+        TextEditor* GetOnExitEditor() { return m_OnExitEditor.get(); }
         [[nodiscard]] std::string GetName() const override { return m_Name; }
         [[nodiscard]] std::string GetId() const override { return m_Id; }
         void ChangeTriggerId(const std::string& oldId, const std::string& newId);
         void UpdateEditors();
-        void SetExitState(const bool isExitState) { m_IsExitState = isExitState; }
+        void SetExitState(bool isExitState);
         [[nodiscard]] bool IsExitState() const { return m_IsExitState; }
+        //Runs onUpdate once per entry as a coroutine resumed every update, so it can yield between ticks
+        void SetCoroutine(bool isCoroutine);
+        [[nodiscard]] bool IsCoroutine() const { return m_IsCoroutine; }
 
     private:
+        void InvalidateFragment(CodeFragment& fragment);
+        void RefreshLayoutCode() const;
+        //Expression the generated code uses to refer to this object
+        [[nodiscard]] std::string GetLuaReference() const;
+        [[nodiscard]] static bool WritesLayoutFile();
+
         VisualNode m_Node{};
         std::string m_Description;
-        std::string m_OnEnter;
-        TextEditor m_OnEnterEditor{};
-        std::string m_OnUpdate;
-        TextEditor m_OnUpdateEditor{};
-        std::string m_OnExit;
-        TextEditor m_OnExitEditor{};
+        FunctionBody m_OnEnter;
+        std::unique_ptr<TextEditor> m_OnEnterEditor;
+        FunctionBody m_OnUpdate;
+        std::unique_ptr<TextEditor> m_OnUpdateEditor;
+        FunctionBody m_OnExit;
+        std::unique_ptr<TextEditor> m_OnExitEditor;
         TextEditor m_LuaCodeEditor{};
         bool m_UnSaved = false;
         PopupManager m_PopupManager{};
         std::shared_ptr<FsmState> m_PreviousState = nullptr;
         bool m_IsExitState = false;
+        bool m_IsCoroutine = false;
         std::unordered_map<std::string, std::shared_ptr<FsmTrigger>> m_Triggers{};
+
+        //Generated code is cached per fragment and rebuilt by the setter that changed it
+        mutable CodeFragment m_HeaderCode;
+        mutable CodeFragment m_InfoCode;
+        mutable CodeFragment m_LayoutCode;
+        mutable CodeFragment m_OnUpdateCode;
+        mutable CodeFragment m_OnEnterCode;
+        mutable CodeFragment m_OnExitCode;
+        mutable NodeLayout m_CodeLayout{};
+        mutable uint32_t m_CodeRevision = 1;
+        uint32_t m_LuaCodeEditorRevision = 0;
+        bool m_EditorsDirty = true;
     };
 }
@@ -9,16 +9,13 @@
 
 #include "Graphics/Window.h"
 #include "imgui/ImGuiNotify.hpp"
+#include "IO/CodeWriter.h"
 #include "IO/FileReader.h"
 
 namespace LuaFsm
 {
     FsmTrigger::FsmTrigger(const std::string& id): DrawableObject(id)
     {
-        m_ConditionEditor.SetText(m_Condition);
-        m_ConditionEditor.SetLanguageDefinition(TextEditor::LanguageDefinition::Lua());
-        m_ActionEditor.SetText(m_Action);
-        m_ActionEditor.SetLanguageDefinition(TextEditor::LanguageDefinition::Lua());
         m_LuaCodeEditor.SetLanguageDefinition(TextEditor::LanguageDefinition::Lua());
         m_Node.SetId(m_Id);
         m_Node.SetColor(IM_COL32(75, 75, 0, 150));
@@ -36,6 +33,9 @@ namespace LuaFsm
         m_Description = other.m_Description;
         m_Condition = other.m_Condition;
         m_Action = other.m_Action;
+        m_Event = other.m_Event;
+        m_After = other.m_After;
+        m_AfterUnit = other.m_AfterUnit;
         m_Priority = other.m_Priority;
         m_CurrentStateId = other.m_CurrentStateId;
         m_NextStateId = other.m_NextStateId;
@@ -47,11 +47,132 @@ namespace LuaFsm
 
     void FsmTrigger::UpdateEditors()
     {
-        Window::TrimTrailingNewlines(m_Condition);
-        m_ConditionEditor.SetText(m_Condition);
-        Window::TrimTrailingNewlines(m_Action);
-        m_ActionEditor.SetText(m_Action);
-        m_LuaCodeEditor.SetText(GetLuaCode());
+        if (m_Condition.TrimTrailingNewlines())
+        {
+            InvalidateFragment(m_ConditionCode);
+            m_EditorsDirty = true;
+        }
+        if (m_Action.TrimTrailingNewlines())
+        {
+            InvalidateFragment(m_ActionCode);
+            m_EditorsDirty = true;
+        }
+        if (m_EditorsDirty)
+        {
+            if (m_ConditionEditor)
+                m_ConditionEditor->SetText(m_Condition.Get());
+            if (m_ActionEditor)
+                m_ActionEditor->SetText(m_Action.Get());
+            m_EditorsDirty = false;
+        }
+        RefreshLayoutCode();
+        if (m_LuaCodeEditorRevision != m_CodeRevision)
+        {
+            m_LuaCodeEditor.SetText(GetLuaCode());
+            m_LuaCodeEditorRevision = m_CodeRevision;
+        }
+    }
+
+    void FsmTrigger::SetName(const std::string& name)
+    {
+        if (m_Name == name)
+            return;
+        m_Name = name;
+        InvalidateFragment(m_InfoCode);
+    }
+
+    void FsmTrigger::SetDescription(const std::string& description)
+    {
+        if (m_Description == description)
+            return;
+        m_Description = description;
+        InvalidateFragment(m_InfoCode);
+    }
+
+    void FsmTrigger::SetPriority(const int priority)
+    {
+        if (m_Priority == priority)
+            return;
+        m_Priority = priority;
+        InvalidateFragment(m_LinkCode);
+    }
+
+    void FsmTrigger::SetCondition(const std::string& condition)
+    {
+        if (m_Condition == condition)
+            return;
+        m_Condition = condition;
+        InvalidateFragment(m_ConditionCode);
+        m_EditorsDirty = true;
+    }
+
+    void FsmTrigger::SetAction(const std::string& onTrue)
+    {
+        if (m_Action == onTrue)
+            return;
+        m_Action = onTrue;
+        InvalidateFragment(m_ActionCode);
+        m_EditorsDirty = true;
+    }
+
+    void FsmTrigger::SetEvent(const std::string& event)
+    {
+        if (m_Event == event)
+            return;
+        m_Event = event;
+        InvalidateFragment(m_LinkCode);
+    }
+
+    void FsmTrigger::SetAfter(float after)
+    {
+        if (after < 0.0f)
+            after = 0.0f;
+        if (m_After == after)
+            return;
+        m_After = after;
+        InvalidateFragment(m_LinkCode);
+    }
+
+    void FsmTrigger::SetAfterUnit(const TimerUnit unit)
+    {
+        if (m_AfterUnit == unit)
+            return;
+        m_AfterUnit = unit;
+        InvalidateFragment(m_LinkCode);
+    }
+
+    const char* FsmTrigger::TimerUnitToString(const TimerUnit unit)
+    {
+        return unit == TimerUnit::Ticks ? "ticks" : "seconds";
+    }
+
+    TimerUnit FsmTrigger::TimerUnitFromString(const std::string& unit)
+    {
+        return unit == "ticks" ? TimerUnit::Ticks : TimerUnit::Seconds;
+    }
+
+    void FsmTrigger::InvalidateFragment(CodeFragment& fragment)
+    {
+        fragment.Invalidate();
+        m_CodeRevision++;
+    }
+
+    void FsmTrigger::InvalidateCode()
+    {
+        for (auto* fragment : {&m_HeaderCode, &m_InfoCode, &m_LayoutCode, &m_LinkCode, &m_ConditionCode, &m_ActionCode})
+            fragment->Invalidate();
+        m_CodeRevision++;
+    }
+
+    void FsmTrigger::RefreshLayoutCode() const
+    {
+        //Nodes are moved and recoloured directly on the canvas, so the layout is compared instead
+        if (const auto layout = m_Node.GetLayout(); layout != m_CodeLayout)
+        {
+            m_CodeLayout = layout;
+            m_LayoutCode.Invalidate();
+            m_CodeRevision++;
+        }
     }
 
     void FsmTrigger::InitPopups()
@@ -92,36 +213,112 @@ namespace LuaFsm
 
     std::string FsmTrigger::GetLuaCode()
     {
-        std::string code;
-        code += fmt::format("---@FSM_CONDITION {0}\n", m_Id);
-        code += fmt::format("---@class {0} : FSM_CONDITION\n", m_Id);
-        code += fmt::format("local {0} = FSM_CONDITION:new({{}})\n", m_Id);
-        code += fmt::format("{0}.id = \"{1}\"\n", m_Id, m_Id);
-        code += fmt::format("{0}.name = \"{1}\"\n", m_Id, m_Name);
-        code += fmt::format("{0}.description = \"{1}\"\n", m_Id, m_Description);
-        code += fmt::format("{0}.editorPos = {{{1}, {2}}}\n", m_Id, m_Node.GetGridPos().x, m_Node.GetGridPos().y);
-        code += fmt::format("{0}.inLineCurve = {1}\n", m_Id, m_Node.GetInArrowCurve());
-        code += fmt::format("{0}.outLineCurve = {1}\n", m_Id, m_Node.GetOutArrowCurve());
-        code += fmt::format("{0}.color = {{{1}, {2}, {3}, {4}}}\n", m_Id, m_Node.GetColor().Value.x, m_Node.GetColor().Value.y, m_Node.GetColor().Value.z, m_Node.GetColor().Value.w);
-        code += fmt::format("{0}.currentStateId = \"{1}\"\n", m_Id, m_CurrentStateId);
-        code += fmt::format("{0}.nextStateId = \"{1}\"\n", m_Id, m_NextStateId);
-        code += fmt::format("{0}.priority = {1}\n", m_Id, m_Priority);
+        CodeWriter writer(EstimateLuaCodeSize());
+        WriteLuaCode(writer);
+        return writer.ToString();
+    }
+
+    size_t FsmTrigger::EstimateLuaCodeSize() const
+    {
+        size_t size = 320 + m_Id.size() * 16 + m_Name.size() + m_Description.size();
+        size += m_CurrentStateId.size() + m_NextStateId.size() + m_Event.size();
         if (!m_Condition.empty())
-        {
-            code += fmt::format("\n---@return boolean isTrue\n");
-            code += fmt::format("function {0}:condition()\n", m_Id);
-            for (const auto& line : m_ConditionEditor.GetTextLines())
-                code += fmt::format("\t{0}\n", line);
-            code += fmt::format("end---@endFunc\n");
-        }
+            size += 64 + m_Id.size() + CodeWriter::EstimateFunctionBodySize(m_Condition.Get());
         if (!m_Action.empty())
+            size += 32 + m_Id.size() + CodeWriter::EstimateFunctionBodySize(m_Action.Get());
+        return size;
+    }
+
+    bool FsmTrigger::WritesLayoutFile()
+    {
+        const auto fsm = NodeEditor::Get()->GetCurrentFsm();
+        return fsm && fsm->UsesLayoutFile();
+    }
+
+    nlohmann::json FsmTrigger::SerializeLayout() const
+    {
+        const auto layout = m_Node.GetLayout();
+        nlohmann::json json;
+        json["description"] = m_Description;
+        json["editorPos"] = {layout.gridPos.x, layout.gridPos.y};
+        json["inLineCurve"] = layout.inArrowCurve;
+        json["outLineCurve"] = layout.outArrowCurve;
+        json["color"] = {layout.color.x, layout.color.y, layout.color.z, layout.color.w};
+        return json;
+    }
+
+    void FsmTrigger::DeserializeLayout(const nlohmann::json& layout)
+    {
+        SetDescription(layout.value("description", ""));
+        if (const auto pos = layout.find("editorPos"); pos != layout.end() && pos->is_array() && pos->size() >= 2)
+            GetNode()->SetGridPos({pos->at(0).get<float>(), pos->at(1).get<float>()});
+        m_Node.SetInArrowCurve(layout.value("inLineCurve", 0.0f));
+        m_Node.SetOutArrowCurve(layout.value("outLineCurve", 0.0f));
+        if (const auto color = layout.find("color"); color != layout.end() && color->is_array() && color->size() >= 4)
+            GetNode()->SetColor(ImColor(color->at(0).get<float>(), color->at(1).get<float>(), color->at(2).get<float>(), color->at(3).get<float>()));
+    }
+
+    std::string FsmTrigger::GetLuaReference() const
+    {
+        if (const auto fsm = NodeEditor::Get()->GetCurrentFsm(); fsm && fsm->UsesRegistrationTable())
+            return fmt::format("{0}.{1}", Fsm::ConditionsTable, m_Id);
+        return m_Id;
+    }
+
+    void FsmTrigger::WriteLuaCode(CodeWriter& writer) const
+    {
+        const auto reference = GetLuaReference();
+        const bool layoutFile = WritesLayoutFile();
+        writer.Append(m_HeaderCode.Get(128 + m_Id.size() * 4, [this, &reference](CodeWriter& code)
         {
-            code += fmt::format("\nfunction {0}:action()\n", m_Id);
-            for (const auto& line : m_ActionEditor.GetTextLines())
-                code += fmt::format("\t{0}\n", line);
-            code += fmt::format("end---@endFunc\n");
-        }
-        return code;
+            code.Write("---@FSM_CONDITION {0}\n", m_Id);
+            code.Write("---@class {0} : FSM_CONDITION\n", m_Id);
+            code.Write("{0}{1} = FSM_CONDITION:new({{}})\n", reference == m_Id ? "local " : "", reference);
+            code.Write("{0}.id = \"{1}\"\n", reference, m_Id);
+        }));
+        writer.Append(m_InfoCode.Get(48 + m_Id.size() * 2 + m_Name.size() + m_Description.size(), [this, &reference, layoutFile](CodeWriter& code)
+        {
+            code.Write("{0}.name = \"{1}\"\n", reference, m_Name);
+            if (!layoutFile)
+                code.Write("{0}.description = \"{1}\"\n", reference, m_Description);
+        }));
+        RefreshLayoutCode();
+        writer.Append(m_LayoutCode.Get(160 + m_Id.size() * 4, [this, &reference, layoutFile](CodeWriter& code)
+        {
+            if (layoutFile)
+                return;
+            const auto& layout = m_CodeLayout;
+            code.Write("{0}.editorPos = {{{1}, {2}}}\n", reference, layout.gridPos.x, layout.gridPos.y);
+            code.Write("{0}.inLineCurve = {1}\n", reference, layout.inArrowCurve);
+            code.Write("{0}.outLineCurve = {1}\n", reference, layout.outArrowCurve);
+            code.Write("{0}.color = {{{1}, {2}, {3}, {4}}}\n", reference, layout.color.x, layout.color.y, layout.color.z, layout.color.w);
+        }));
+        writer.Append(m_LinkCode.Get(160 + m_Id.size() * 6 + m_CurrentStateId.size() + m_NextStateId.size() + m_Event.size(), [this, &reference](CodeWriter& code)
+        {
+            code.Write("{0}.currentStateId = \"{1}\"\n", reference, m_CurrentStateId);
+            code.Write("{0}.nextStateId = \"{1}\"\n", reference, m_NextStateId);
+            code.Write("{0}.priority = {1}\n", reference, m_Priority);
+            code.Write("{0}.event = \"{1}\"\n", reference, m_Event);
+            code.Write("{0}.after = {1}\n", reference, m_After);
+            code.Write("{0}.afterUnit = \"{1}\"\n", reference, TimerUnitToString(m_AfterUnit));
+        }));
+        writer.Append(m_ConditionCode.Get(64 + m_Id.size() + CodeWriter::EstimateFunctionBodySize(m_Condition.Get()), [this, &reference](CodeWriter& code)
+        {
+            if (m_Condition.empty())
+                return;
+            code.Append("\n---@return boolean isTrue\n");
+            code.Write("function {0}:condition({1})\n", reference, CodeWriter::UsesVarargs(m_Condition.Get()) ? "instance, ..." : "instance");
+            code.WriteFunctionBody(m_Condition.Get());
+            code.Append("end---@endFunc\n");
+        }));
+        writer.Append(m_ActionCode.Get(32 + m_Id.size() + CodeWriter::EstimateFunctionBodySize(m_Action.Get()), [this, &reference](CodeWriter& code)
+        {
+            if (m_Action.empty())
+                return;
+            code.Write("\nfunction {0}:action({1})\n", reference, CodeWriter::UsesVarargs(m_Action.Get()) ? "instance, ..." : "instance");
+            code.WriteFunctionBody(m_Action.Get());
+            code.Append("end---@endFunc\n");
+        }));
     }
 
     void FsmTrigger::UpdateFileContents(std::string& code, const std::string& oldId)
@@ -151,13 +348,19 @@ namespace LuaFsm
             code = std::regex_replace(code, regex, fmt::format("{0}.name = \"{1}\"", m_Id, m_Name));
         else if (!m_Name.empty())
                 ImGui::InsertNotification({ImGuiToastType::Warning, 3000, "Fsm condition %s name entry not found in file!", m_Id.c_str()});
+        //Files saved before the FSM used a layout file still hold its fields, they are moved out on this save
+        const bool layoutFile = WritesLayoutFile();
         regex = FsmRegex::ClassStringRegex(oldId, "description");
-        if (std::smatch match; std::regex_search(code, match, regex))
+        if (layoutFile)
+            FsmRegex::RemoveEntry(code, regex);
+        else if (std::smatch match; std::regex_search(code, match, regex))
             code = std::regex_replace(code, regex, fmt::format("{0}.description = \"{1}\"", m_Id, m_Description));
         else if (!m_Description.empty())
             ImGui::InsertNotification({ImGuiToastType::Warning, 3000, "Fsm condition %s description entry not found in file!", m_Id.c_str()});
         regex = FsmRegex::ClassTableRegex(oldId, "editorPos");
-        if (std::smatch match; std::regex_search(code, match, regex))
+        if (layoutFile)
+            FsmRegex::RemoveEntry(code, regex);
+        else if (std::smatch match; std::regex_search(code, match, regex))
         {
             std::string tableContent = match[1].str();
             std::regex idRegex = FsmRegex::ClassTableElementsRegex();
@@ -178,7 +381,9 @@ namespace LuaFsm
         else
             ImGui::InsertNotification({ImGuiToastType::Warning, 3000, "Fsm condition %s position entry not found in file!", m_Id.c_str()});
         regex = FsmRegex::ClassTableRegex(oldId, "color");
-        if (std::smatch match; std::regex_search(code, match, regex))
+        if (layoutFile)
+            FsmRegex::RemoveEntry(code, regex);
+        else if (std::smatch match; std::regex_search(code, match, regex))
         {
             std::string tableContent = match[1].str();
             std::regex idRegex = FsmRegex::ClassTableElementsRegex();
@@ -213,14 +418,33 @@ namespace LuaFsm
             code = std::regex_replace(code, regex, fmt::format("{0}.priority = {1}", m_Id, m_Priority));
         else if (m_Priority != 0)
             ImGui::InsertNotification({ImGuiToastType::Warning, 3000, "Fsm condition %s priority entry not found in file!", m_Id.c_str()});
-        regex = FsmRegex::ClassFloatRegex(oldId, "inLineCurve");
+        regex = FsmRegex::ClassStringRegex(oldId, "event");
         if (std::smatch match; std::regex_search(code, match, regex))
+            code = std::regex_replace(code, regex, fmt::format("{0}.event = \"{1}\"", m_Id, m_Event));
+        else if (!m_Event.empty() && !FsmRegex::InsertEntryAfter(code, FsmRegex::ClassIntegerRegex(m_Id, "priority"), fmt::format("{0}.event = \"{1}\"", m_Id, m_Event)))
+            ImGui::InsertNotification({ImGuiToastType::Warning, 3000, "Fsm condition %s event entry not found in file!", m_Id.c_str()});
+        regex = FsmRegex::ClassFloatRegex(oldId, "after");
+        if (std::smatch match; std::regex_search(code, match, regex))
+            code = std::regex_replace(code, regex, fmt::format("{0}.after = {1}", m_Id, m_After));
+        else if (IsTimed() && !FsmRegex::InsertEntryAfter(code, FsmRegex::ClassIntegerRegex(m_Id, "priority"), fmt::format("{0}.after = {1}", m_Id, m_After)))
+            ImGui::InsertNotification({ImGuiToastType::Warning, 3000, "Fsm condition %s after entry not found in file!", m_Id.c_str()});
+        regex = FsmRegex::ClassStringRegex(oldId, "afterUnit");
+        if (std::smatch match; std::regex_search(code, match, regex))
+            code = std::regex_replace(code, regex, fmt::format("{0}.afterUnit = \"{1}\"", m_Id, TimerUnitToString(m_AfterUnit)));
+        else if (IsTimed())
+            FsmRegex::InsertEntryAfter(code, FsmRegex::ClassFloatRegex(m_Id, "after"), fmt::format("{0}.afterUnit = \"{1}\"", m_Id, TimerUnitToString(m_AfterUnit)));
+        regex = FsmRegex::ClassFloatRegex(oldId, "inLineCurve");
+        if (layoutFile)
+            FsmRegex::RemoveEntry(code, regex);
+        else if (std::smatch match; std::regex_search(code, match, regex))
             code = std::regex_replace(code, regex, fmt::format("{0}.inLineCurve = {1}", m_Id, m_Node.GetInArrowCurve()));
         else if (m_Node.GetInArrowCurve() > 0.0001f || m_Node.GetInArrowCurve() < 0.0001f)
             ImGui::InsertNotification({ImGuiToastType::Warning, 3000, "Fsm condition %s inLineCurve entry not found in file!", m_Id.c_str()});
 
         regex = FsmRegex::ClassFloatRegex(oldId, "outLineCurve");
-        if (std::smatch match; std::regex_search(code, match, regex))
+        if (layoutFile)
+            FsmRegex::RemoveEntry(code, regex);
+        else if (std::smatch match; std::regex_search(code, match, regex))
             code = std::regex_replace(code, regex, fmt::format("{0}.outLineCurve = {1}", m_Id, m_Node.GetOutArrowCurve()));
         else if (m_Node.GetOutArrowCurve() > 0.0001f || m_Node.GetOutArrowCurve() < 0.0001f)
             ImGui::InsertNotification({ImGuiToastType::Warning, 3000, "Fsm condition %s outLineCurve entry not found in file!", m_Id.c_str()});
@@ -230,10 +454,9 @@ namespace LuaFsm
             regex = FsmRegex::FunctionBodyReplace(oldId, "condition");
             if (std::smatch match; std::regex_search(code, match, regex))
             {
-                std::string func;
-                for (const auto& line : m_ConditionEditor.GetTextLines())
-                    func += fmt::format("\t{0}\n", line);
-                code = std::regex_replace(code, regex, "$1\n" + func + "$3");
+                CodeWriter func(CodeWriter::EstimateFunctionBodySize(m_Condition.Get()));
+                func.WriteFunctionBody(m_Condition.Get());
+                code = std::regex_replace(code, regex, "$1\n" + func.ToString() + "$3");
                 auto regexString = fmt::format("({0}:condition)", oldId);
                 regex = std::regex(regexString);
                 code = std::regex_replace(code, regex, fmt::format("{0}:condition", m_Id));
@@ -243,10 +466,9 @@ namespace LuaFsm
             regex = FsmRegex::FunctionBodyReplace(oldId, "action");
             if (std::smatch match; std::regex_search(code, match, regex))
             {
-                std::string func;
-                for (const auto& line : m_ActionEditor.GetTextLines())
-                    func += fmt::format("\t{0}\n", line);
-                code = std::regex_replace(code, regex, "$1\n" + func + "$3");
+                CodeWriter func(CodeWriter::EstimateFunctionBodySize(m_Action.Get()));
+                func.WriteFunctionBody(m_Action.Get());
+                code = std::regex_replace(code, regex, "$1\n" + func.ToString() + "$3");
                 auto regexString = fmt::format("({0}:action)", oldId);
                 regex = std::regex(regexString);
                 code = std::regex_replace(code, regex, fmt::format("{0}:action", m_Id));
@@ -258,6 +480,11 @@ namespace LuaFsm
     }
 
     void FsmTrigger::UpdateFromFile(const std::string& filePath)
+    {
+        UpdateFromFile(filePath, WritesLayoutFile() ? Fsm::ReadLayoutFile(filePath) : nlohmann::json::object());
+    }
+
+    void FsmTrigger::UpdateFromFile(const std::string& filePath, const nlohmann::json& layout)
     {
         const std::string code = FileReader::ReadAllText(filePath);
         if (code.empty())
@@ -268,10 +495,16 @@ namespace LuaFsm
         else
             name = m_Id;
         SetName(name);
-        std::string description;
-        if (std::smatch match; std::regex_search(code, match, FsmRegex::ClassStringRegex(m_Id, "description")))
-            description = match[1].str();
-        SetDescription(description);
+        const bool layoutFile = WritesLayoutFile();
+        if (layoutFile)
+            DeserializeLayout(Fsm::GetLayoutEntry(layout, "conditions", m_Id));
+        else
+        {
+            std::string description;
+            if (std::smatch match; std::regex_search(code, match, FsmRegex::ClassStringRegex(m_Id, "description")))
+                description = match[1].str();
+            SetDescription(description);
+        }
         std::string currentStateId;
         if (std::smatch match; std::regex_search(code, match, FsmRegex::ClassStringRegex(m_Id, "currentStateId")))
             currentStateId = match[1].str();
@@ -284,15 +517,30 @@ namespace LuaFsm
         if (std::smatch match; std::regex_search(code, match, FsmRegex::ClassIntegerRegex(m_Id, "priority")))
             priority = std::stoi(match[1].str());
         SetPriority(priority);
-        float inLineCurve = 0;
-        if (std::smatch match; std::regex_search(code, match, FsmRegex::ClassFloatRegex(m_Id, "inLineCurve")))
-            inLineCurve = std::stof(match[1].str());
-        m_Node.SetInArrowCurve(inLineCurve);
-        float outLineCurve = 0;
-        if (std::smatch match; std::regex_search(code, match, FsmRegex::ClassFloatRegex(m_Id, "outLineCurve")))
-            outLineCurve = std::stof(match[1].str());
-        m_Node.SetOutArrowCurve(outLineCurve);
-        if (std::smatch match; std::regex_search(code, match, FsmRegex::ClassTableRegex(m_Id, "editorPos")))
+        std::string event;
+        if (std::smatch match; std::regex_search(code, match, FsmRegex::ClassStringRegex(m_Id, "event")))
+            event = match[1].str();
+        SetEvent(event);
+        float after = 0;
+        if (std::smatch match; std::regex_search(code, match, FsmRegex::ClassFloatRegex(m_Id, "after")))
+            after = std::stof(match[1].str());
+        SetAfter(after);
+        std::string afterUnit;
+        if (std::smatch match; std::regex_search(code, match, FsmRegex::ClassStringRegex(m_Id, "afterUnit")))
+            afterUnit = match[1].str();
+        SetAfterUnit(TimerUnitFromString(afterUnit));
+        if (!layoutFile)
+        {
+            float inLineCurve = 0;
+            if (std::smatch match; std::regex_search(code, match, FsmRegex::ClassFloatRegex(m_Id, "inLineCurve")))
+                inLineCurve = std::stof(match[1].str());
+            m_Node.SetInArrowCurve(inLineCurve);
+            float outLineCurve = 0;
+            if (std::smatch match; std::regex_search(code, match, FsmRegex::ClassFloatRegex(m_Id, "outLineCurve")))
+                outLineCurve = std::stof(match[1].str());
+            m_Node.SetOutArrowCurve(outLineCurve);
+        }
+        if (std::smatch match; !layoutFile && std::regex_search(code, match, FsmRegex::ClassTableRegex(m_Id, "editorPos")))
         {
             std::string tableContent = match[1].str();
             std::regex idRegex = FsmRegex::ClassTableElementsRegex();
@@ -309,7 +557,7 @@ namespace LuaFsm
                 GetNode()->SetGridPos(position);
             }
         }
-        if (std::smatch match; std::regex_search(code, match, FsmRegex::ClassTableRegex(m_Id, "color")))
+        if (std::smatch match; !layoutFile && std::regex_search(code, match, FsmRegex::ClassTableRegex(m_Id, "color")))
         {
             std::string tableContent = match[1].str();
             std::regex idRegex = FsmRegex::ClassTableElementsRegex();
@@ -404,6 +652,8 @@ namespace LuaFsm
 
     void FsmTrigger::SetNextState(const std::string& stateId)
     {
+        if (m_NextStateId != stateId)
+            InvalidateFragment(m_LinkCode);
         m_NextStateId = stateId;
         const auto fsm = NodeEditor::Get()->GetCurrentFsm();
         if (!fsm)
@@ -416,10 +666,15 @@ namespace LuaFsm
 
     void FsmTrigger::SetCurrentState(const std::string& stateId)
     {
+        const bool changed = m_CurrentStateId != stateId;
+        if (changed)
+            InvalidateFragment(m_LinkCode);
         m_CurrentStateId = stateId;
         const auto fsm = NodeEditor::Get()->GetCurrentFsm();
         if (!fsm)
             return;
+        if (changed)
+            fsm->InvalidateActivateCode();
         if (const auto state = fsm->GetState(stateId); state)
         {
             m_CurrentState = state.get();
@@ -439,9 +694,11 @@ namespace LuaFsm
     {
         const auto oldId = m_Id;
         m_Id = id;
+        InvalidateCode();
         const auto fsm = NodeEditor::Get()->GetCurrentFsm();
         if (fsm == nullptr)
             return;
+        fsm->InvalidateActivateCode();
         if (!oldId.empty())
         {
             for (const auto& [key, value] : fsm->GetStates())
@@ -494,8 +751,29 @@ namespace LuaFsm
                 SetDescription(description);
                 ImGui::Text("Priority");
                 ImGui::SetNextItemWidth(150.f);
-                ImGui::InputInt(MakeIdString("Priority").c_str(), &m_Priority);
+                if (ImGui::InputInt(MakeIdString("Priority").c_str(), &m_Priority))
+                    InvalidateFragment(m_LinkCode);
                 ImGui::SetItemTooltip("Priority decides the order in which conditions get evaluated.");
+                ImGui::Text("Event");
+                std::string event = m_Event;
+                ImGui::SetNextItemWidth(150.f);
+                ImGui::InputText(MakeIdString("Event").c_str(), &event);
+                SetEvent(event);
+                ImGui::SetItemTooltip("Leave empty to evaluate the condition on every update.\n"
+                                      "Otherwise it is only evaluated when fsm:dispatch is called with this event.");
+                ImGui::Text("After");
+                float after = m_After;
+                ImGui::SetNextItemWidth(150.f);
+                ImGui::InputFloat(MakeIdString("After").c_str(), &after, 0.0f, 0.0f, "%.3f");
+                SetAfter(after);
+                ImGui::SetItemTooltip("Leave at 0 to evaluate the condition on every update.\n"
+                                      "Otherwise it is evaluated once, this long after the current state is entered.\n"
+                                      "Return true from the condition for a plain timeout.");
+                ImGui::SameLine();
+                int afterUnit = static_cast<int>(m_AfterUnit);
+                ImGui::SetNextItemWidth(100.f);
+                ImGui::Combo(MakeIdString("Unit").c_str(), &afterUnit, "seconds\0ticks\0");
+                SetAfterUnit(static_cast<TimerUnit>(afterUnit));
                 ImGui::Separator();
                 ImGui::SetNextItemWidth(100.f);
                 float inCurve = m_Node.GetInArrowCurve();
@@ -566,7 +844,8 @@ namespace LuaFsm
                 ImGui::Separator();
                 ImGui::Text("Condition");
                 ImGui::Separator();
-                Window::DrawTextEditor(m_ConditionEditor, m_Condition);
+                if (Window::DrawTextEditor(m_ConditionEditor, m_Condition))
+                    InvalidateFragment(m_ConditionCode);
                 ImGui::Separator();
                 
                 ImGui::EndTabItem();
@@ -574,7 +853,8 @@ namespace LuaFsm
             
             if (ImGui::BeginTabItem(MakeIdString("Action").c_str()))
             {
-                Window::DrawTextEditor(m_ActionEditor, m_Action);
+                if (Window::DrawTextEditor(m_ActionEditor, m_Action))
+                    InvalidateFragment(m_ActionCode);
                 ImGui::EndTabItem();
             }
             
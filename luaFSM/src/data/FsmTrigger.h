@@ -5,8 +5,10 @@
 #include "imgui.h"
 #include "json.hpp"
 #include "Graphics/VisualNode.h"
+#include "FunctionBody.h"
 #include "imgui/TextEditor.h"
 #include "imgui/popups/Popup.h"
+#include "IO/CodeWriter.h"
 
 namespace LuaFsm
 {
@@ -18,6 +20,17 @@ namespace LuaFsm
         DeleteTrigger,
         SetNewId
     };
+
+    /**
+     * \brief Unit of the delay of a timed condition
+     */
+    enum class TimerUnit : int
+    {
+        //Seconds of game time, passed to FSM_TIMERS:update
+        Seconds,
+        //Calls of FSM_TIMERS:update
+        Ticks
+    };
     
     class FsmState;
     class Fsm;
@@ -40,6 +53,9 @@ namespace LuaFsm
             && m_Action == other.GetAction()
             && m_CurrentStateId == other.GetCurrentStateId()
             && m_NextStateId == other.GetNextStateId()     
+            && m_Event == other.GetEvent()
+            && m_After == other.GetAfter()
+            && m_AfterUnit == other.GetAfterUnit()
             && m_Node.GetGridPos() == other.GetNode().GetGridPos()
             && m_Node.GetColor() == static_cast<ImVec4>(other.GetNode().GetColor());
         }
@@ -52,6 +68,9 @@ namespace LuaFsm
             && m_Action == other.GetAction()
             && m_CurrentStateId == other.GetCurrentStateId()
             && m_NextStateId == other.GetNextStateId()     
+            && m_Event == other.GetEvent()
+            && m_After == other.GetAfter()
+            && m_AfterUnit == other.GetAfterUnit()
             && m_Node.GetGridPos() == other.GetNode()->GetGridPos()
             && m_Node.GetColor() == static_cast<ImVec4>(other.GetNode()->GetColor());
         }
@@ -66,6 +85,9 @@ namespace LuaFsm
             || m_Action != other.GetAction()
             || m_CurrentStateId != other.GetCurrentStateId()
             || m_NextStateId != other.GetNextStateId()     
+            || m_Event != other.GetEvent()
+            || !COMPARE_FLOATS(m_After, other.GetAfter())
+            || m_AfterUnit != other.GetAfterUnit()
             || m_Node.GetGridPos() != other.GetNode().GetGridPos()
             || !COMPARE_FLOATS(m_Node.GetInArrowCurve(), other.GetNode().GetInArrowCurve())
             || !COMPARE_FLOATS(m_Node.GetOutArrowCurve(), other.GetNode().GetOutArrowCurve())
@@ -80,6 +102,9 @@ namespace LuaFsm
             || m_Action != other.GetAction()
             || m_CurrentStateId != other.GetCurrentStateId()
             || m_NextStateId != other.GetNextStateId()     
+            || m_Event != other.GetEvent()
+            || !COMPARE_FLOATS(m_After, other.GetAfter())
+            || m_AfterUnit != other.GetAfterUnit()
             || m_Node.GetGridPos() != other.GetNode()->GetGridPos()
             || !COMPARE_FLOATS(m_Node.GetInArrowCurve(), other.GetNode()->GetInArrowCurve())
             || !COMPARE_FLOATS(m_Node.GetOutArrowCurve(), other.GetNode()->GetOutArrowCurve())
@@ -91,6 +116,8 @@ namespace LuaFsm
         
         static std::vector<std::shared_ptr<FsmTrigger>> CreateFromFile(const std::string& filePath);
         void UpdateFromFile(const std::string& filePath);
+        //With the layout file of the FSM already parsed, loading a whole FSM reads it once
+        void UpdateFromFile(const std::string& filePath, const nlohmann::json& layout);
         void UpdateToFile(const std::string& oldId);
         void RefactorId(const std::string& newId);
 
@@ -98,19 +125,35 @@ namespace LuaFsm
         void virtual SetId(const std::string& id) override;
         
         [[nodiscard]] virtual std::string GetName() const override { return m_Name; }
-        void virtual SetName(const std::string& name) override { m_Name = name; }
+        void virtual SetName(const std::string& name) override;
         
         [[nodiscard]] const std::string& GetDescription() const { return m_Description; }
-        void SetDescription(const std::string& description) { m_Description = description; }
+        void SetDescription(const std::string& description);
         
         [[nodiscard]] int GetPriority() const { return m_Priority; }
-        void SetPriority(const int priority) { m_Priority = priority; }
+        void SetPriority(int priority);
         
-        [[nodiscard]] const std::string& GetCondition() const { return m_Condition; }
-        void SetCondition(const std::string& condition) { m_Condition = condition; }
+        [[nodiscard]] const std::string& GetCondition() const { return m_Condition.Get(); }
+        [[nodiscard]] const FunctionBody& GetConditionBody() const { return m_Condition; }
+        void SetCondition(const std::string& condition);
         
-        [[nodiscard]] const std::string& GetAction() const { return m_Action; }
-        void SetAction(const std::string& onTrue) { m_Action = onTrue; }
+        [[nodiscard]] const std::string& GetAction() const { return m_Action.Get(); }
+        [[nodiscard]] const FunctionBody& GetActionBody() const { return m_Action; }
+        void SetAction(const std::string& onTrue);
+
+        //Event the condition is subscribed to, empty when it is evaluated on every update
+        [[nodiscard]] const std::string& GetEvent() const { return m_Event; }
+        void SetEvent(const std::string& event);
+        [[nodiscard]] bool IsEventDriven() const { return !m_Event.empty(); }
+
+        //Delay after entering the current state at which the condition is evaluated once, 0 to poll it instead
+        [[nodiscard]] float GetAfter() const { return m_After; }
+        void SetAfter(float after);
+        [[nodiscard]] TimerUnit GetAfterUnit() const { return m_AfterUnit; }
+        void SetAfterUnit(TimerUnit unit);
+        [[nodiscard]] bool IsTimed() const { return m_After > 0.0f; }
+        static const char* TimerUnitToString(TimerUnit unit);
+        static TimerUnit TimerUnitFromString(const std::string& unit);
         
         FsmState* GetCurrentState();
         std::string GetCurrentStateId() const { return m_CurrentStateId; }
@@ -121,8 +164,9 @@ namespace LuaFsm
         void SetNextState(const std::string& stateId);
         void UpdateFileContents(std::string& code, const std::string& oldId);
 
-        TextEditor* GetConditionEditor() { return &m_ConditionEditor; }
-        TextEditor* GetActionEditor() { return &m_ActionEditor; }
+        //Editors are created the first time the properties draw them, null until then
+        TextEditor* GetConditionEditor() { return m_ConditionEditor.get(); }
+        TextEditor* GetActionEditor() { return m_ActionEditor.get(); }
         
         VisualNode* GetNode() { return &m_Node; }
         [[nodiscard]] VisualNode GetNode() const { return m_Node; }
@@ -131,17 +175,32 @@ namespace LuaFsm
         void CreateLastState();
         bool IsChanged();
         void AppendToFile();
+        //Entry of this condition in the layout file of the FSM
+        [[nodiscard]] nlohmann::json SerializeLayout() const;
+        void DeserializeLayout(const nlohmann::json& layout);
         
         std::string GetLuaCode();
+        void WriteLuaCode(CodeWriter& writer) const;
+        [[nodiscard]] size_t EstimateLuaCodeSize() const;
+        void InvalidateCode();
 
     private:
+        void InvalidateFragment(CodeFragment& fragment);
+        void RefreshLayoutCode() const;
+        //Expression the generated code uses to refer to this object
+        [[nodiscard]] std::string GetLuaReference() const;
+        [[nodiscard]] static bool WritesLayoutFile();
+
         VisualNode m_Node{};
         std::string m_Description;
         int m_Priority = 0;
-        std::string m_Condition = "return false";
-        TextEditor m_ConditionEditor{};
-        std::string m_Action;
-        TextEditor m_ActionEditor{};
+        FunctionBody m_Condition{"return false"};
+        std::unique_ptr<TextEditor> m_ConditionEditor;
+        FunctionBody m_Action;
+        std::unique_ptr<TextEditor> m_ActionEditor;
+        std::string m_Event;
+        float m_After = 0.0f;
+        TimerUnit m_AfterUnit = TimerUnit::Seconds;
         TextEditor m_LuaCodeEditor{};
         std::string m_NextStateId;
         std::string m_CurrentStateId;
@@ -150,6 +209,18 @@ namespace LuaFsm
         bool m_UnSaved = false;
         FsmState* m_CurrentState = nullptr;
         FsmState* m_NextState = nullptr;
+
+        //Generated code is cached per fragment and rebuilt by the setter that changed it
+        mutable CodeFragment m_HeaderCode;
+        mutable CodeFragment m_InfoCode;
+        mutable CodeFragment m_LayoutCode;
+        mutable CodeFragment m_LinkCode;
+        mutable CodeFragment m_ConditionCode;
+        mutable CodeFragment m_ActionCode;
+        mutable NodeLayout m_CodeLayout{};
+        mutable uint32_t m_CodeRevision = 1;
+        uint32_t m_LuaCodeEditorRevision = 0;
+        bool m_EditorsDirty = true;
     };
 
 }
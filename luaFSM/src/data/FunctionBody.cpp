@@ -0,0 +1,69 @@
+﻿#include "pch.h"
+#include "FunctionBody.h"
+
+#include <unordered_map>
+
+namespace LuaFsm
+{
+    namespace
+    {
+        struct BodyPool
+        {
+            std::unordered_multimap<size_t, std::weak_ptr<const std::string>> entries;
+            //Entries at which expired ones are swept next, doubled after every sweep
+            size_t sweepAt = 256;
+        };
+
+        BodyPool& GetPool()
+        {
+            static BodyPool pool;
+            return pool;
+        }
+    }
+
+    FunctionBody::FunctionBody() : m_Text(Intern({}))
+    {
+    }
+
+    FunctionBody::FunctionBody(const std::string_view text) : m_Text(Intern(text))
+    {
+    }
+
+    FunctionBody& FunctionBody::operator=(const std::string_view text)
+    {
+        if (*m_Text != text)
+            m_Text = Intern(text);
+        return *this;
+    }
+
+    bool FunctionBody::TrimTrailingNewlines()
+    {
+        std::string_view text = *m_Text;
+        while (!text.empty() && (text.back() == '\n' || text.back() == '\r'))
+            text.remove_suffix(1);
+        if (text.size() == m_Text->size())
+            return false;
+        m_Text = Intern(text);
+        return true;
+    }
+
+    std::shared_ptr<const std::string> FunctionBody::Intern(const std::string_view text)
+    {
+        auto& pool = GetPool();
+        const auto hash = std::hash<std::string_view>{}(text);
+        auto [first, last] = pool.entries.equal_range(hash);
+        for (auto it = first; it != last; ++it)
+        {
+            if (auto body = it->second.lock(); body && *body == text)
+                return body;
+        }
+        if (pool.entries.size() >= pool.sweepAt)
+        {
+            std::erase_if(pool.entries, [](const auto& entry) { return entry.second.expired(); });
+            pool.sweepAt = std::max<size_t>(256, pool.entries.size() * 2);
+        }
+        auto body = std::make_shared<const std::string>(text);
+        pool.entries.emplace(hash, body);
+        return body;
+    }
+}
@@ -0,0 +1,40 @@
+﻿#pragma once
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace LuaFsm
+{
+    /**
+     * \brief Lua function body interned in a pool shared by every state and condition
+     *
+     * Identical bodies share one immutable string, so copying a body only adds a reference
+     * and two bodies are equal exactly when they point at the same string.
+     * Bodies are looked up in the pool by hash, entries of bodies nothing refers to anymore are dropped as it grows.
+     */
+    class FunctionBody
+    {
+    public:
+        FunctionBody();
+        explicit FunctionBody(std::string_view text);
+
+        FunctionBody& operator=(std::string_view text);
+
+        [[nodiscard]] const std::string& Get() const { return *m_Text; }
+        [[nodiscard]] bool empty() const { return m_Text->empty(); }
+        [[nodiscard]] size_t size() const { return m_Text->size(); }
+        //Same for every copy of the body, for keying bodies without comparing their text
+        [[nodiscard]] const void* GetKey() const { return m_Text.get(); }
+
+        bool operator==(const FunctionBody& other) const { return m_Text == other.m_Text; }
+        bool operator==(const std::string_view text) const { return *m_Text == text; }
+
+        //Removes trailing line breaks, true when there were any
+        bool TrimTrailingNewlines();
+
+    private:
+        static std::shared_ptr<const std::string> Intern(std::string_view text);
+
+        std::shared_ptr<const std::string> m_Text;
+    };
+}
@@ -1,11 +1,19 @@
 ﻿#include "pch.h"
 #include "NodeEditor.h"
 
+#include <filesystem>
 #include <fstream>
 
 #include "ImGuiNotify.hpp"
 #include "Graphics/Window.h"
+#include "IO/BytecodeExporter.h"
+#include "IO/CodeWriter.h"
+#include "IO/CppExporter.h"
+#include "IO/ExportModel.h"
 #include "IO/FileReader.h"
+#include "IO/FfiLuaExporter.h"
+#include "IO/FlatLuaExporter.h"
+#include "IO/RuntimeExporter.h"
 
 namespace LuaFsm
 {
@@ -45,15 +53,24 @@ namespace LuaFsm
 
         const float lineLength = Math::Distance(fromPos, toPos);
         const ImVec2 midPoint = fromPos + normalizedDirection * (lineLength * 0.5f);
+        float heat = -1.0f;
         if (fromNode && fromNode->GetType() == NodeType::Transition)
         {
             color = ImColor(155, 255, 155, 255);
             fromNode->SetOutLineMidPoint(midPoint);
+            heat = Get()->GetLinkHeat(fromNode, true);
         }
         if (targetNode && targetNode->GetType() == NodeType::Transition)
         {
             color = ImColor(255, 155, 155, 255);
             targetNode->SetInLineMidPoint(midPoint);
+            heat = Get()->GetLinkHeat(targetNode, false);
+        }
+        float lineThickness = thickness;
+        if (heat >= 0.0f)
+        {
+            color = HeatColor(heat, 1.0f);
+            lineThickness = thickness * (1.0f + 2.0f * heat);
         }
         ImVec2 arrowTip = toPos;
         ImVec2 leftCorner, rightCorner;
@@ -62,15 +79,9 @@ namespace LuaFsm
         {
             const ImVec2 controlPoint = midPoint + perpendicular * (lineLength * curve);
             if (fromNode->GetType() == NodeType::Transition)
-            {
-                color = ImColor(155, 255, 155, 255);
                 fromNode->SetOutLineMidPoint(controlPoint);
-            }
             if (targetNode->GetType() == NodeType::Transition)
-            {
-                color = ImColor(255, 155, 155, 255);
                 targetNode->SetInLineMidPoint(controlPoint);
-            }
             const ImVec2 newFromPos = fromNode->GetFromPoint(controlPoint);
             const ImVec2 newToPos = targetNode->GetFromPoint(controlPoint);
             targetNode->SetLastConnectionPoint(newToPos);
@@ -85,11 +96,11 @@ namespace LuaFsm
 
             drawList->PathLineTo(newFromPos);
             drawList->PathBezierCubicCurveTo(controlPoint, controlPoint, newToPos);
-            drawList->PathStroke(color, false, thickness);
+            drawList->PathStroke(color, false, lineThickness);
         }
         else
         {
-            drawList->AddLine(fromPos, toPos, color, thickness);
+            drawList->AddLine(fromPos, toPos, color, lineThickness);
             if (targetNode)
                 targetNode->SetLastConnectionPoint(toPos);
 
@@ -135,6 +146,14 @@ namespace LuaFsm
             Window::SetTheme(settings["defaultTheme"]);
         if (settings.contains("functionEditorOnly"))
             m_FunctionEditorOnly = settings["functionEditorOnly"];
+        if (settings.contains("exportBytecode"))
+            m_ExportBytecode = settings["exportBytecode"];
+        if (settings.contains("shareFunctions"))
+            m_ShareFunctions = settings["shareFunctions"];
+        if (settings.contains("heatmapMetric"))
+            m_HeatmapMetric = static_cast<ProfileMetric>(settings["heatmapMetric"].get<int>());
+        if (settings.contains("profileGuidedExport"))
+            m_ProfileGuidedExport = settings["profileGuidedExport"];
     }
 
     nlohmann::json NodeEditor::SerializeSettings() const
@@ -145,6 +164,10 @@ namespace LuaFsm
         settings["defaultPath"] = FileReader::lastPath;
         settings["defaultTheme"] = Window::GetActiveTheme();
         settings["functionEditorOnly"] = m_FunctionEditorOnly;
+        settings["exportBytecode"] = m_ExportBytecode;
+        settings["shareFunctions"] = m_ShareFunctions;
+        settings["heatmapMetric"] = static_cast<int>(m_HeatmapMetric);
+        settings["profileGuidedExport"] = m_ProfileGuidedExport;
         return settings;
     }
 
@@ -163,20 +186,369 @@ namespace LuaFsm
         DeserializeSettings(nlohmann::json::parse(code));
     }
     
-    void NodeEditor::ExportLua(const std::string& filePath) const
+    bool NodeEditor::LoadProfile(const std::string& filePath)
+    {
+        if (!m_Fsm)
+            return false;
+        const auto text = FileReader::ReadAllText(filePath);
+        if (text.empty())
+            return false;
+        FsmProfile profile;
+        if (!FsmProfile::Parse(text, m_Fsm->GetId(), profile))
+        {
+            ImGui::InsertNotification({ImGuiToastType::Error, 3000, "%s is not a profile written by FSM_PROFILER", filePath.c_str()});
+            return false;
+        }
+        if (profile.IsEmpty())
+        {
+            ImGui::InsertNotification({ImGuiToastType::Warning, 5000, "The profile has no records of FSM %s", m_Fsm->GetId().c_str()});
+            return false;
+        }
+        profile.filePath = filePath;
+        m_Profile = std::move(profile);
+        m_ShowHeatmap = true;
+        ImGui::InsertNotification({ImGuiToastType::Success, 3000, "Loaded profile of %zu states and %zu conditions over %.2f s",
+            m_Profile.states.size(), m_Profile.conditions.size(), m_Profile.duration});
+        return true;
+    }
+
+    bool NodeEditor::LoadTrace(const std::string& filePath)
+    {
+        if (!m_Fsm)
+            return false;
+        const auto bytes = FileReader::ReadAllBytes(filePath);
+        if (bytes.empty())
+            return false;
+        FsmTrace trace;
+        if (!FsmTrace::Parse(bytes, m_Fsm->GetId(), trace))
+        {
+            ImGui::InsertNotification({ImGuiToastType::Error, 3000, "%s is not a trace written by FSM_TRACE", filePath.c_str()});
+            return false;
+        }
+        if (trace.IsEmpty())
+        {
+            ImGui::InsertNotification({ImGuiToastType::Warning, 5000, "The trace has no records of FSM %s", m_Fsm->GetId().c_str()});
+            return false;
+        }
+        ClearTrace();
+        trace.filePath = filePath;
+        m_Trace = std::move(trace);
+        m_ShowTraceReplay = true;
+        SetTraceInstance(0);
+        ImGui::InsertNotification({ImGuiToastType::Success, 3000, "Loaded trace of %zu state changes of %zu instances",
+            m_Trace.records.size(), m_Trace.instances.size()});
+        return true;
+    }
+
+    void NodeEditor::ClearTrace()
+    {
+        for (const auto& [id, type] : m_TraceHighlights)
+        {
+            if (const auto node = GetNode(id, type))
+                node->SetIsHighlighted(false);
+        }
+        m_TraceHighlights.clear();
+        m_Trace = {};
+        m_TraceView.clear();
+        m_TraceInstance = 0;
+        m_TracePosition = 0;
+        m_ShowTraceReplay = false;
+    }
+
+    const TraceRecord* NodeEditor::GetTraceRecord() const
+    {
+        if (m_TracePosition < 0 || m_TracePosition >= static_cast<int>(m_TraceView.size()))
+            return nullptr;
+        return &m_Trace.records[m_TraceView[m_TracePosition]];
+    }
+
+    void NodeEditor::SetTraceInstance(const uint32_t instance)
+    {
+        m_TraceInstance = instance;
+        m_TraceView.clear();
+        for (size_t i = 0; i < m_Trace.records.size(); ++i)
+        {
+            if (instance == 0 || m_Trace.records[i].instance == instance)
+                m_TraceView.push_back(i);
+        }
+        SetTracePosition(0);
+    }
+
+    void NodeEditor::SetTracePosition(const int position)
+    {
+        m_TracePosition = std::clamp(position, 0, std::max(0, static_cast<int>(m_TraceView.size()) - 1));
+        HighlightTraceRecord();
+        const auto record = GetTraceRecord();
+        if (!m_FollowTrace || !record || !IsTraceShown())
+            return;
+        if (const auto node = GetNode(record->toState, NodeType::State))
+            SetCanvasScroll(node->GetGridPos() - GetCanvasSize() / 2);
+    }
+
+    void NodeEditor::HighlightTraceRecord()
+    {
+        for (const auto& [id, type] : m_TraceHighlights)
+        {
+            if (const auto node = GetNode(id, type))
+                node->SetIsHighlighted(false);
+        }
+        m_TraceHighlights.clear();
+        const auto record = GetTraceRecord();
+        if (!record || !m_ShowTraceReplay || !IsTraceShown())
+            return;
+        m_TraceHighlights.emplace_back(record->toState, NodeType::State);
+        if (!record->condition.empty())
+            m_TraceHighlights.emplace_back(record->condition, NodeType::Transition);
+        for (const auto& [id, type] : m_TraceHighlights)
+        {
+            if (const auto node = GetNode(id, type))
+                node->SetIsHighlighted(true);
+        }
+    }
+
+    void NodeEditor::HighlightSimulationState(const std::string& id)
+    {
+        if (!m_SimulationHighlight.empty() && m_SimulationHighlight != id)
+        {
+            if (const auto node = GetNode(m_SimulationHighlight, NodeType::State))
+                node->SetIsHighlighted(false);
+        }
+        m_SimulationHighlight = id;
+        if (id.empty())
+            return;
+        if (const auto node = GetNode(id, NodeType::State))
+            node->SetIsHighlighted(true);
+    }
+
+    float NodeEditor::GetHeat(const VisualNode* node) const
+    {
+        if (!IsProfileShown())
+            return -1.0f;
+        switch (node->GetType())
+        {
+        case NodeType::State:
+            return m_Profile.GetStateHeat(node->GetId(), m_HeatmapMetric);
+        case NodeType::Transition:
+            return m_Profile.GetConditionHeat(node->GetId(), m_HeatmapMetric);
+        case NodeType::Fsm:
+            break;
+        }
+        return -1.0f;
+    }
+
+    float NodeEditor::GetLinkHeat(const VisualNode* triggerNode, const bool outgoing) const
+    {
+        if (!IsProfileShown())
+            return -1.0f;
+        if (outgoing)
+            return m_Profile.GetTransitionHeat(triggerNode->GetId(), m_HeatmapMetric);
+        return m_Profile.GetConditionHeat(triggerNode->GetId(), m_HeatmapMetric);
+    }
+
+    ImColor NodeEditor::HeatColor(const float heat, const float alpha)
+    {
+        //Blue for cold, through yellow, to red for the hottest record
+        const ImVec4 cold{0.15f, 0.35f, 0.8f, alpha};
+        const ImVec4 warm{0.9f, 0.8f, 0.15f, alpha};
+        const ImVec4 hot{0.9f, 0.15f, 0.1f, alpha};
+        const auto lerp = [](const ImVec4& a, const ImVec4& b, const float t)
+        {
+            return ImVec4{a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t, a.z + (b.z - a.z) * t, a.w};
+        };
+        const float t = std::clamp(heat, 0.0f, 1.0f);
+        return t < 0.5f ? lerp(cold, warm, t * 2.0f) : lerp(warm, hot, (t - 0.5f) * 2.0f);
+    }
+
+    void NodeEditor::Export(const std::string& filePath, const ExportTarget target) const
+    {
+        if (m_Fsm && target == ExportTarget::LuaJitFfi && m_Fsm->GetStates().empty())
+        {
+            ImGui::InsertNotification({ImGuiToastType::Error, 3000, "Cannot export an FSM without states to LuaJIT FFI"});
+            return;
+        }
+        if (m_Fsm && (target == ExportTarget::FlatLua || target == ExportTarget::LuaJitFfi || target == ExportTarget::CppHeader))
+        {
+            const auto triggers = m_Fsm->GetTriggers();
+            for (const auto& trigger : triggers | std::views::values)
+            {
+                if (!trigger->IsTimed())
+                    continue;
+                ImGui::InsertNotification({ImGuiToastType::Warning, 5000, "Timed conditions like %s need the FSM.lua runtime and are left out of this export", trigger->GetId().c_str()});
+                break;
+            }
+        }
+        if (m_Fsm && (target == ExportTarget::FlatLua || target == ExportTarget::LuaJitFfi))
+        {
+            const auto states = m_Fsm->GetStates();
+            for (const auto& state : states | std::views::values)
+            {
+                if (!state->IsCoroutine())
+                    continue;
+                ImGui::InsertNotification({ImGuiToastType::Warning, 5000, "Coroutine states like %s need the FSM.lua runtime, this export calls their onUpdate as a plain function", state->GetId().c_str()});
+                break;
+            }
+        }
+        if (target == ExportTarget::CppHeader)
+            ExportCpp(filePath);
+        else
+            ExportLua(filePath, target);
+    }
+
+    void NodeEditor::ExportLua(const std::string& filePath, const ExportTarget target) const
     {
         if (!m_Fsm)
             return;
+        std::string runtime;
+        if (target == ExportTarget::ReleaseRuntime)
+        {
+            runtime = FileReader::ReadAllText(RuntimeExporter::RuntimePath);
+            if (runtime.empty())
+            {
+                ImGui::InsertNotification({ImGuiToastType::Error, 3000, "Runtime not found at: %s", RuntimeExporter::RuntimePath});
+                return;
+            }
+        }
         std::ofstream file(filePath);
         if (!file.is_open())
         {
             ImGui::InsertNotification({ImGuiToastType::Error, 3000, "Failed to export file at: %s", filePath.c_str()});
             return;
         }
-        file << m_Fsm->GetLuaCode();
+        bool written;
+        {
+            CodeWriter writer(file);
+            switch (target)
+            {
+            case ExportTarget::EditorLua:
+                m_Fsm->WriteLuaCode(writer);
+                break;
+            case ExportTarget::FlatLua:
+                FlatLuaExporter::Write(*m_Fsm, writer, GetExportProfile(), m_ShareFunctions);
+                break;
+            case ExportTarget::LuaJitFfi:
+                FfiLuaExporter::Write(*m_Fsm, writer, GetExportProfile());
+                break;
+            case ExportTarget::ReleaseRuntime:
+                RuntimeExporter::WriteRelease(runtime, writer);
+                break;
+            default:
+                break;
+            }
+            written = writer.Flush();
+        }
         file.close();
-        m_Fsm->SetLinkedFile(filePath);
+        //A full disk only shows up in the stream state, after the last flush or the close
+        if (!written || !file.good())
+        {
+            ImGui::InsertNotification({ImGuiToastType::Error, 3000, "Failed to write file at: %s", filePath.c_str()});
+            return;
+        }
+        if (target == ExportTarget::EditorLua)
+        {
+            m_Fsm->SetLinkedFile(filePath);
+            m_Fsm->SaveLayoutFile();
+        }
+        ImGui::InsertNotification({ImGuiToastType::Success, 3000, "Exported file at: %s", filePath.c_str()});
+        if (target == ExportTarget::FlatLua)
+            ReportProfileOrdering(true);
+        else if (target == ExportTarget::LuaJitFfi)
+            ReportProfileOrdering(false);
+        //lua 5.4 bytecode does not load in LuaJIT
+        if (target != ExportTarget::LuaJitFfi)
+            CompileBytecode(filePath);
+    }
+
+    const FsmProfile* NodeEditor::GetExportProfile() const
+    {
+        if (!m_ProfileGuidedExport || !m_Fsm || !HasProfile() || m_Profile.fsmId != m_Fsm->GetId())
+            return nullptr;
+        return &m_Profile;
+    }
+
+    void NodeEditor::ReportProfileOrdering(const bool withStateChecks) const
+    {
+        const auto* profile = GetExportProfile();
+        if (!profile)
+            return;
+        const auto model = ExportModel::Build(*m_Fsm, profile);
+        const auto saved = [](const int64_t plain, const int64_t guided)
+        {
+            return plain > 0 ? 100.0 * static_cast<double>(plain - guided) / static_cast<double>(plain) : 0.0;
+        };
+        if (withStateChecks)
+        {
+            ImGui::InsertNotification({ImGuiToastType::Info, 5000, "Profile ordering predicts %.1f%% fewer condition evaluations (%lld to %lld) and %.1f%% fewer state checks (%lld to %lld)",
+                saved(model.plainCost.evaluations, model.guidedCost.evaluations),
+                static_cast<long long>(model.plainCost.evaluations), static_cast<long long>(model.guidedCost.evaluations),
+                saved(model.plainCost.stateChecks, model.guidedCost.stateChecks),
+                static_cast<long long>(model.plainCost.stateChecks), static_cast<long long>(model.guidedCost.stateChecks)});
+        }
+        else
+        {
+            ImGui::InsertNotification({ImGuiToastType::Info, 5000, "Profile ordering predicts %.1f%% fewer condition evaluations (%lld to %lld)",
+                saved(model.plainCost.evaluations, model.guidedCost.evaluations),
+                static_cast<long long>(model.plainCost.evaluations), static_cast<long long>(model.guidedCost.evaluations)});
+        }
+    }
+
+    void NodeEditor::CompileBytecode(const std::string& filePath) const
+    {
+        if (!m_ExportBytecode)
+            return;
+        std::string error;
+        switch (BytecodeExporter::CompileFile(filePath, error))
+        {
+        case BytecodeExporter::Result::Compiled:
+            ImGui::InsertNotification({ImGuiToastType::Success, 3000, "Compiled bytecode: %s", BytecodeExporter::GetBytecodePath(filePath).c_str()});
+            break;
+        case BytecodeExporter::Result::UpToDate:
+            ImGui::InsertNotification({ImGuiToastType::Info, 3000, "Bytecode is up to date: %s", BytecodeExporter::GetBytecodePath(filePath).c_str()});
+            break;
+        case BytecodeExporter::Result::Failed:
+            ImGui::InsertNotification({ImGuiToastType::Error, 5000, "Bytecode not compiled: %s", error.c_str()});
+            break;
+        }
+    }
+
+    void NodeEditor::ExportCpp(const std::string& filePath) const
+    {
+        if (!m_Fsm)
+            return;
+        if (m_Fsm->GetStates().empty())
+        {
+            ImGui::InsertNotification({ImGuiToastType::Error, 3000, "Cannot export an FSM without states to C++"});
+            return;
+        }
+        const std::filesystem::path headerPath(filePath);
+        auto benchPath = headerPath;
+        benchPath.replace_filename(headerPath.stem().string() + "_bench.cpp");
+        std::ofstream header(headerPath);
+        std::ofstream bench(benchPath);
+        if (!header.is_open() || !bench.is_open())
+        {
+            ImGui::InsertNotification({ImGuiToastType::Error, 3000, "Failed to export file at: %s", filePath.c_str()});
+            return;
+        }
+        bool written;
+        {
+            CodeWriter writer(header);
+            CppExporter::WriteHeader(*m_Fsm, writer, GetExportProfile());
+            written = writer.Flush();
+        }
+        {
+            CodeWriter writer(bench);
+            CppExporter::WriteBenchmark(*m_Fsm, headerPath.filename().string(), writer);
+            written = writer.Flush() && written;
+        }
+        header.close();
+        bench.close();
+        if (!written || !header.good() || !bench.good())
+        {
+            ImGui::InsertNotification({ImGuiToastType::Error, 3000, "Failed to write file at: %s", filePath.c_str()});
+            return;
+        }
         ImGui::InsertNotification({ImGuiToastType::Success, 3000, "Exported file at: %s", filePath.c_str()});
+        ReportProfileOrdering(false);
     }
 
     IdValidityError NodeEditor::CheckIdValidity(const std::string& id) const
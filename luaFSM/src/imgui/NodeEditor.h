@@ -6,6 +6,9 @@
 #include "ImGuiNotify.hpp"
 #include "data/Fsm.h"
 #include "Graphics/VisualNode.h"
+#include "IO/FsmProfile.h"
+#include "IO/FsmTrace.h"
+#include "runtime/LuaSimulation.h"
 
 namespace LuaFsm
 {
@@ -59,6 +62,16 @@ namespace LuaFsm
             return regex;
         }
 
+        //Files written before a field existed have no entry for it yet, add it on the line below anchor
+        static bool InsertEntryAfter(std::string &code, const std::regex &anchor, const std::string &entry)
+        {
+            std::smatch match;
+            if (!std::regex_search(code, match, anchor))
+                return false;
+            code.insert(static_cast<size_t>(match.position(0) + match.length(0)), "\n" + entry);
+            return true;
+        }
+
         static std::regex ClassTableRegex(const std::string &id, const std::string &fieldName)
         {
             const auto prefix =  fmt::format(R"({0}\.{1})", id, fieldName);
@@ -109,6 +122,49 @@ namespace LuaFsm
             return regex;
         }
         
+        static std::regex LocalTableDeclaration(const std::string &tableName)
+        {
+            const auto string = fmt::format(R"(local\s+{0}\s*=\s*\{{\s*\}})", tableName);
+            std::regex regex(string);
+            return regex;
+        }
+        
+        static std::regex LayoutFileAnnotation()
+        {
+            std::regex regex(R"(---@layoutFile\b)");
+            return regex;
+        }
+
+        //Blackboard predicates of an FSM, from ---@predicates up to ---@endPredicates
+        static std::regex PredicatesBlock()
+        {
+            std::regex regex(R"(---@predicates\b[\s\S]*?---@endPredicates)");
+            return regex;
+        }
+
+        static std::regex PredicateFunction(const std::string &id)
+        {
+            const auto string = fmt::format(R"(function\s+{0}\.predicates\.(\w+)\s*\(.*\)\s*([\s\S]*?)\s*end---@endFunc)", id);
+            std::regex regex(string);
+            return regex;
+        }
+
+        //Removes the whole line of an entry, for fields that moved out of the file
+        static bool RemoveEntry(std::string &code, const std::regex &entry)
+        {
+            std::smatch match;
+            if (!std::regex_search(code, match, entry))
+                return false;
+            auto start = static_cast<size_t>(match.position(0));
+            while (start > 0 && code[start - 1] != '\n')
+                start--;
+            auto end = static_cast<size_t>(match.position(0) + match.length(0));
+            if (end < code.size() && code[end] == '\n')
+                end++;
+            code.erase(start, end - start);
+            return true;
+        }
+        
         static std::string FunctionNameString(const std::string &id, const std::string &funcName)
         {
             return fmt::format("{0}:{1}\\(.*\\)", id, funcName);
@@ -129,6 +185,23 @@ namespace LuaFsm
         }
     };
 
+    /**
+     * \brief Kinds of files an FSM can be exported to
+     */
+    enum class ExportTarget : int
+    {
+        //Editor format, linked to the FSM after export
+        EditorLua,
+        //Standalone lua module with integer states and a single update function
+        FlatLua,
+        //Header-only C++ machine with a generated microbenchmark next to it
+        CppHeader,
+        //Copy of the FSM.lua runtime with TRACE logging stripped
+        ReleaseRuntime,
+        //LuaJIT module with machine states in FFI arrays and a tick loop free of NYI constructs
+        LuaJitFfi
+    };
+
     enum class IdValidityError
     {
         Valid,
@@ -195,7 +268,15 @@ namespace LuaFsm
                              arrowHeadWidth = 10.0f,
                              float arrowHeadLength = 15.0f, const float curve = 0.0f, VisualNode* fromNode = nullptr, VisualNode* targetNode = nullptr);
         static void DrawConnection(VisualNode* fromNode, VisualNode* toNode);
-        void ExportLua(const std::string& filePath) const;
+        void Export(const std::string& filePath, ExportTarget target) const;
+        void ExportLua(const std::string& filePath, ExportTarget target = ExportTarget::EditorLua) const;
+        void ExportCpp(const std::string& filePath) const;
+        //Precompiles an exported or saved lua file when bytecode export is on
+        void CompileBytecode(const std::string& filePath) const;
+        //Profile the standalone exports order their dispatch by, null when profile guided export is off
+        [[nodiscard]] const FsmProfile* GetExportProfile() const;
+        //Toasts the savings the profile ordering predicts for the current FSM
+        void ReportProfileOrdering(bool withStateChecks) const;
 
         void SetCurrentFsm(const FsmPtr& fsm) { m_Fsm = fsm; DeselectAllNodes(); }
         [[nodiscard]] FsmPtr GetCurrentFsm() const { return m_Fsm; }
@@ -244,6 +325,12 @@ namespace LuaFsm
         bool FunctionEditorOnly() const { return m_FunctionEditorOnly; }
         void SetFunctionEditorOnly(const bool functionEditorOnly) { m_FunctionEditorOnly = functionEditorOnly; }
 
+        bool ExportBytecode() const { return m_ExportBytecode; }
+        void SetExportBytecode(const bool exportBytecode) { m_ExportBytecode = exportBytecode; }
+
+        bool ShareFunctions() const { return m_ShareFunctions; }
+        void SetShareFunctions(const bool shareFunctions) { m_ShareFunctions = shareFunctions; }
+
         ImVec2 GetDragOffset() const { return m_DragOffset; }
         void SetDragOffset(const ImVec2& offset) { m_DragOffset = offset; }
         
@@ -254,6 +341,61 @@ namespace LuaFsm
         void SetPanning(const bool panning) { m_IsPanning = panning; }
 
         [[nodiscard]] ImGuiWindow* GetCanvasWindow() const { return ImGui::FindWindowByName(canvasName.c_str()); }
+
+        //Runtime profile drawn as a heatmap over the graph
+        bool LoadProfile(const std::string& filePath);
+        //Replaces the profile without toasts, for the live timings of the simulation
+        void SetProfile(FsmProfile profile) { m_Profile = std::move(profile); }
+        void ClearProfile() { m_Profile = {}; m_ShowHeatmap = false; }
+        [[nodiscard]] bool HasProfile() const { return !m_Profile.IsEmpty(); }
+        [[nodiscard]] bool IsProfileShown() const { return m_ShowHeatmap && m_Fsm && m_Profile.fsmId == m_Fsm->GetId(); }
+        [[nodiscard]] const StateProfile* GetStateProfile(const std::string& id) const { return IsProfileShown() ? m_Profile.GetState(id) : nullptr; }
+        [[nodiscard]] const ConditionProfile* GetConditionProfile(const std::string& id) const { return IsProfileShown() ? m_Profile.GetCondition(id) : nullptr; }
+
+        bool ShowHeatmap() const { return m_ShowHeatmap; }
+        void SetShowHeatmap(const bool show) { m_ShowHeatmap = show; }
+
+        bool ProfileGuidedExport() const { return m_ProfileGuidedExport; }
+        void SetProfileGuidedExport(const bool profileGuided) { m_ProfileGuidedExport = profileGuided; }
+
+        ProfileMetric GetHeatmapMetric() const { return m_HeatmapMetric; }
+        void SetHeatmapMetric(const ProfileMetric metric) { m_HeatmapMetric = metric; }
+
+        //Heat between 0 and 1, negative when the heatmap is off or the profile has no record of the node
+        [[nodiscard]] float GetHeat(const VisualNode* node) const;
+        //Links into a condition show its evaluations, links out of it the transitions it caused
+        [[nodiscard]] float GetLinkHeat(const VisualNode* triggerNode, bool outgoing) const;
+        static ImColor HeatColor(float heat, float alpha);
+
+        //Transition trace replayed by highlighting the nodes of each record
+        bool LoadTrace(const std::string& filePath);
+        void ClearTrace();
+        [[nodiscard]] bool HasTrace() const { return !m_Trace.IsEmpty(); }
+        [[nodiscard]] bool IsTraceShown() const { return HasTrace() && m_Fsm && m_Trace.fsmId == m_Fsm->GetId(); }
+        [[nodiscard]] const FsmTrace& GetTrace() const { return m_Trace; }
+        //Indices into the trace records of the selected instance
+        [[nodiscard]] const std::vector<size_t>& GetTraceView() const { return m_TraceView; }
+        [[nodiscard]] const TraceRecord* GetTraceRecord() const;
+
+        //Instance 0 replays the records of every instance
+        [[nodiscard]] uint32_t GetTraceInstance() const { return m_TraceInstance; }
+        void SetTraceInstance(uint32_t instance);
+        [[nodiscard]] int GetTracePosition() const { return m_TracePosition; }
+        void SetTracePosition(int position);
+        //Highlights the new state and the condition of the current record, redone every frame by the replay window
+        //since hovering lists in the property pages clears highlights
+        void HighlightTraceRecord();
+
+        bool ShowTraceReplay() const { return m_ShowTraceReplay; }
+        void SetShowTraceReplay(const bool show) { m_ShowTraceReplay = show; HighlightTraceRecord(); }
+
+        bool FollowTrace() const { return m_FollowTrace; }
+        void SetFollowTrace(const bool follow) { m_FollowTrace = follow; }
+
+        //Headless simulation of the current FSM in an embedded lua state
+        [[nodiscard]] LuaSimulation& GetSimulation() { return m_Simulation; }
+        //Highlights the state a simulated instance is in, an empty id clears it
+        void HighlightSimulationState(const std::string& id);
         
     public:
         inline static uint32_t nodeWindowFlags = ImGuiWindowFlags_NoCollapse
@@ -286,6 +428,21 @@ namespace LuaFsm
         bool m_AppendStates = true;
         bool m_ShowPriority = false;
         bool m_FunctionEditorOnly = false;
+        bool m_ExportBytecode = false;
+        bool m_ShareFunctions = false;
+        FsmProfile m_Profile;
+        bool m_ShowHeatmap = false;
+        ProfileMetric m_HeatmapMetric = ProfileMetric::Time;
+        bool m_ProfileGuidedExport = false;
+        FsmTrace m_Trace;
+        std::vector<size_t> m_TraceView;
+        uint32_t m_TraceInstance = 0;
+        int m_TracePosition = 0;
+        std::vector<std::pair<std::string, NodeType>> m_TraceHighlights;
+        bool m_ShowTraceReplay = false;
+        bool m_FollowTrace = true;
+        LuaSimulation m_Simulation;
+        std::string m_SimulationHighlight;
     };
     
 }
@@ -216,6 +216,64 @@ namespace LuaFsm
         Popup::Open();
     }
 
+    LoadProfilePopup::LoadProfilePopup()
+    {
+        id = "LoadProfile";
+        config.flags |= ImGuiWindowFlags_NoCollapse;
+        config.path = ".";
+    }
+
+    void LoadProfilePopup::DrawFields()
+    {
+        if (filePath.empty())
+        {
+            OpenFileDialog("LoadProfileDialog", "Load Profile", ".fsmprof", &folder, &filePath, config);
+            if (!filePath.empty())
+            {
+                NodeEditor::Get()->LoadProfile(filePath);
+                folder = "";
+                filePath = "";
+                Close();
+            }
+        }
+    }
+
+    void LoadProfilePopup::Open()
+    {
+        if (!FileReader::lastPath.empty())
+            config.path = FileReader::lastPath;
+        Popup::Open();
+    }
+
+    LoadTracePopup::LoadTracePopup()
+    {
+        id = "LoadTrace";
+        config.flags |= ImGuiWindowFlags_NoCollapse;
+        config.path = ".";
+    }
+
+    void LoadTracePopup::DrawFields()
+    {
+        if (filePath.empty())
+        {
+            OpenFileDialog("LoadTraceDialog", "Load Trace", ".fsmtrace", &folder, &filePath, config);
+            if (!filePath.empty())
+            {
+                NodeEditor::Get()->LoadTrace(filePath);
+                folder = "";
+                filePath = "";
+                Close();
+            }
+        }
+    }
+
+    void LoadTracePopup::Open()
+    {
+        if (!FileReader::lastPath.empty())
+            config.path = FileReader::lastPath;
+        Popup::Open();
+    }
+
     CreateFilePopup::CreateFilePopup()
     {
         id = "CreateFile";
@@ -252,6 +310,7 @@ namespace LuaFsm
                 const auto code = fsm->GetLuaCode();
                 FileReader::SaveFile(filePath, code);
                 fsm->SetLinkedFile(filePath);
+                fsm->SaveLayoutFile();
                 NodeEditor::Get()->SaveSettings();
                 folder = "";
                 filePath = "";
@@ -260,6 +319,41 @@ namespace LuaFsm
         }
     }
 
+    ExportFilePopup::ExportFilePopup(const std::string& instanceId, const int target, std::string extension, std::string fileNameFormat)
+        : target(target), extension(std::move(extension)), fileNameFormat(std::move(fileNameFormat))
+    {
+        id = instanceId;
+        config.flags |= ImGuiWindowFlags_NoCollapse;
+        config.path = ".";
+    }
+
+    void ExportFilePopup::DrawFields()
+    {
+        const auto fsm = NodeEditor::Get()->GetCurrentFsm();
+        if (!fsm)
+        {
+            Close();
+            return;
+        }
+        if (filePath.empty())
+        {
+            if (!FileReader::lastPath.empty())
+                config.path = FileReader::lastPath;
+            config.fileName = fmt::format(fmt::runtime(fileNameFormat), fsm->GetId());
+            if (!OpenFileDialog(id + "Dialog", "Export File", extension, &folder, &filePath, config))
+                isOpen = true;
+            else
+                isOpen = false;
+            if (!filePath.empty())
+            {
+                NodeEditor::Get()->Export(filePath, static_cast<ExportTarget>(target));
+                folder = "";
+                filePath = "";
+                Close();
+            }
+        }
+    }
+
     AddStatePopup::AddStatePopup(const std::string& instanceId)
     {
         id = instanceId;
@@ -323,6 +417,7 @@ namespace LuaFsm
                     state->SetOnExit(originalState->GetOnExit());
                     state->SetDescription(originalState->GetDescription());
                     state->SetExitState(originalState->IsExitState());
+                    state->SetCoroutine(originalState->IsCoroutine());
                     state->GetNode()->SetColor(originalState->GetNode()->GetColor());
                 }
                 if (nodeEditor->AppendStates())
@@ -414,6 +509,7 @@ namespace LuaFsm
                     condition->SetAction(originalCondition->GetAction());
                     condition->GetNode()->SetColor(originalCondition->GetNode()->GetColor());
                     condition->SetPriority(originalCondition->GetPriority());
+                    condition->SetEvent(originalCondition->GetEvent());
                 }
                 if (nodeEditor->AppendStates())
                 {
@@ -547,6 +643,7 @@ namespace LuaFsm
             if (std::smatch match; std::regex_search(code, match, regex))
                 code = std::regex_replace(code, regex, "");
             FileReader::SaveFile(filePath, code);
+            NodeEditor::Get()->GetCurrentFsm()->SaveLayoutFile();
             Close();
         }
         ImGui::SameLine();
@@ -583,6 +680,7 @@ namespace LuaFsm
             if (std::smatch match; std::regex_search(code, match, regex))
                 code = std::regex_replace(code, regex, "");
             FileReader::SaveFile(filePath, code);
+            NodeEditor::Get()->GetCurrentFsm()->SaveLayoutFile();
             Close();
         }
         ImGui::SameLine();
@@ -651,6 +749,8 @@ namespace LuaFsm
         appendToFile = NodeEditor::Get()->AppendStates();
         showPriority = NodeEditor::Get()->ShowPriority();
         functionEditorOnly = NodeEditor::Get()->FunctionEditorOnly();
+        exportBytecode = NodeEditor::Get()->ExportBytecode();
+        shareFunctions = NodeEditor::Get()->ShareFunctions();
     }
 
     void OptionsPopUp::DrawFields()
@@ -661,6 +761,12 @@ namespace LuaFsm
         ImGui::SetItemTooltip("Show priority of conditions on the canvas.");
         ImGui::Checkbox("Don't save function body", &functionEditorOnly);
         ImGui::SetItemTooltip("Only edit function bodies in your text editor, never overwrite from the program.");
+        ImGui::Checkbox("Export bytecode", &exportBytecode);
+        ImGui::SetItemTooltip("Also write stripped lua 5.4 bytecode (.luac) next to saved and exported lua files,\n"
+                              "so the game skips parsing them. Only loads in lua 5.4, not in LuaJIT.");
+        ImGui::Checkbox("Share identical functions", &shareFunctions);
+        ImGui::SetItemTooltip("Flat lua exports write identical function bodies once and let every state\n"
+                              "and condition using them refer to the same function.");
     }
 
     void OptionsPopUp::DrawButtons()
@@ -670,6 +776,8 @@ namespace LuaFsm
             NodeEditor::Get()->SetAppendStates(appendToFile);
             NodeEditor::Get()->SetShowPriority(showPriority);
             NodeEditor::Get()->SetFunctionEditorOnly(functionEditorOnly);
+            NodeEditor::Get()->SetExportBytecode(exportBytecode);
+            NodeEditor::Get()->SetShareFunctions(shareFunctions);
             NodeEditor::Get()->SaveSettings();
             Close();
         }
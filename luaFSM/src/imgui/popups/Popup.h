@@ -97,6 +97,28 @@ namespace LuaFsm
         IGFD::FileDialogConfig config;
     };
     
+    class LoadProfilePopup : public Popup
+    {
+    public:
+        LoadProfilePopup();
+        void DrawFields() override;
+        void Open() override;
+        std::string filePath;
+        std::string folder;
+        IGFD::FileDialogConfig config;
+    };
+    
+    class LoadTracePopup : public Popup
+    {
+    public:
+        LoadTracePopup();
+        void DrawFields() override;
+        void Open() override;
+        std::string filePath;
+        std::string folder;
+        IGFD::FileDialogConfig config;
+    };
+    
     class CreateFilePopup : public Popup
     {
     public:
@@ -107,6 +129,21 @@ namespace LuaFsm
         IGFD::FileDialogConfig config;
     };
 
+    class ExportFilePopup : public Popup
+    {
+    public:
+        ExportFilePopup(const std::string& instanceId, int target, std::string extension, std::string fileNameFormat);
+        void DrawFields() override;
+        //ExportTarget to write, stored as int to keep NodeEditor.h out of this header
+        int target;
+        std::string extension;
+        //Default file name, {0} is replaced with the FSM id
+        std::string fileNameFormat;
+        std::string filePath;
+        std::string folder;
+        IGFD::FileDialogConfig config;
+    };
+
     class AddStatePopup : public Popup
     {
     public:
@@ -187,6 +224,8 @@ namespace LuaFsm
         bool appendToFile = true;
         bool showPriority = false;
         bool functionEditorOnly = false;
+        bool exportBytecode = false;
+        bool shareFunctions = false;
         void DrawFields() override;
         void DrawButtons() override;
     };
@@ -0,0 +1,188 @@
+﻿#include "pch.h"
+#include "FsmHost.h"
+
+#include <chrono>
+
+namespace LuaFsm
+{
+    FsmHost::~FsmHost()
+    {
+        Stop();
+    }
+
+    bool FsmHost::Start(const SimulationCode& code, const int instanceCount, const int workerCount, const int shardsPerWorker)
+    {
+        Stop();
+        m_Error.clear();
+        m_Failed = false;
+        m_InstanceCount = std::max(1, instanceCount);
+        const int workers = std::clamp(workerCount, 1, m_InstanceCount);
+        const int shardCount = std::min(m_InstanceCount, workers * std::max(1, shardsPerWorker));
+
+        //Contiguous ranges of instances, the first shards take one more when they don't divide evenly
+        m_Shards.reserve(shardCount);
+        int firstIndex = 1;
+        for (int i = 0; i < shardCount; ++i)
+        {
+            const int count = m_InstanceCount / shardCount + (i < m_InstanceCount % shardCount ? 1 : 0);
+            auto shard = std::make_unique<LuaSimulation>();
+            if (!shard->Start(code, count, false, firstIndex))
+            {
+                m_Error = shard->GetError();
+                m_Shards.clear();
+                return false;
+            }
+            m_Shards.push_back(std::move(shard));
+            firstIndex += count;
+        }
+
+        m_Queues = std::make_unique<ShardQueue[]>(workers);
+        for (int i = 0; i < workers; ++i)
+        {
+            m_Queues[i].begin = shardCount * i / workers;
+            m_Queues[i].end = shardCount * (i + 1) / workers;
+        }
+        m_Stats.assign(workers, {});
+        m_Stopping = false;
+        m_Barrier = std::make_unique<std::barrier<>>(workers + 1);
+        m_Workers.reserve(workers);
+        for (int i = 0; i < workers; ++i)
+            m_Workers.emplace_back(&FsmHost::WorkerLoop, this, i);
+        return true;
+    }
+
+    void FsmHost::Stop()
+    {
+        if (!m_Workers.empty())
+        {
+            m_Stopping = true;
+            m_Barrier->arrive_and_wait();
+            for (auto& worker : m_Workers)
+                worker.join();
+            m_Workers.clear();
+        }
+        m_Barrier.reset();
+        m_Queues.reset();
+        m_Shards.clear();
+    }
+
+    bool FsmHost::TickAll(const double dt)
+    {
+        if (m_Workers.empty())
+            return false;
+        m_Dt = dt;
+        for (size_t i = 0; i < m_Workers.size(); ++i)
+            m_Queues[i].next.store(m_Queues[i].begin, std::memory_order_relaxed);
+        //Releases the workers, the second wait returns once every shard ticked
+        m_Barrier->arrive_and_wait();
+        m_Barrier->arrive_and_wait();
+        return !m_Failed;
+    }
+
+    void FsmHost::WorkerLoop(const int worker)
+    {
+        while (true)
+        {
+            m_Barrier->arrive_and_wait();
+            if (m_Stopping)
+                return;
+            TickShards(worker);
+            m_Barrier->arrive_and_wait();
+        }
+    }
+
+    void FsmHost::TickShards(const int worker)
+    {
+        auto& stats = m_Stats[worker];
+        const auto start = std::chrono::steady_clock::now();
+        const int workers = static_cast<int>(m_Workers.size());
+        //Own shards first, then the ones the other workers have not claimed yet
+        for (int offset = 0; offset < workers; ++offset)
+        {
+            const int victim = (worker + offset) % workers;
+            auto& queue = m_Queues[victim];
+            while (!m_Failed.load(std::memory_order_relaxed))
+            {
+                const int shard = queue.next.fetch_add(1, std::memory_order_relaxed);
+                if (shard >= queue.end)
+                    break;
+                if (!m_Shards[shard]->Run(1, m_Dt))
+                    Fail(m_Shards[shard]->GetError());
+                ++stats.shards;
+                stats.updates += m_Shards[shard]->GetInstanceCount();
+                if (offset != 0)
+                    ++stats.stolen;
+            }
+        }
+        stats.busySeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void FsmHost::Fail(const std::string& error)
+    {
+        std::lock_guard lock(m_ErrorMutex);
+        if (!m_Failed)
+            m_Error = error;
+        m_Failed = true;
+    }
+
+    std::vector<FsmScalingResult> FsmScalingBenchmark::Run(const SimulationCode& code, std::string& error, FsmScalingProgress* progress) const
+    {
+        //Doubling thread counts, ending on maxThreads even when it is no power of two
+        std::vector<int> threadCounts;
+        for (int threads = 1; threads < maxThreads; threads *= 2)
+            threadCounts.push_back(threads);
+        threadCounts.push_back(std::max(1, maxThreads));
+        if (progress)
+        {
+            progress->ticksDone = 0;
+            progress->ticksTotal = static_cast<int>(threadCounts.size()) * (warmupTicks + ticks);
+        }
+        //Ticks one step, false when it failed or the caller cancelled
+        const auto tick = [progress](FsmHost& host)
+        {
+            if (progress && progress->cancel)
+                return false;
+            if (!host.TickAll(LuaSimulation::tickSeconds))
+                return false;
+            if (progress)
+                ++progress->ticksDone;
+            return true;
+        };
+
+        std::vector<FsmScalingResult> results;
+        for (const int threads : threadCounts)
+        {
+            FsmHost host;
+            if (!host.Start(code, instances, threads, shardsPerWorker))
+            {
+                error = host.GetError();
+                break;
+            }
+            bool ticked = true;
+            for (int i = 0; i < warmupTicks && ticked; ++i)
+                ticked = tick(host);
+            //Shards stolen during the warmup are left out of the result
+            int64_t warmupStolen = 0;
+            for (const auto& stats : host.GetWorkerStats())
+                warmupStolen += stats.stolen;
+            const auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < ticks && ticked; ++i)
+                ticked = tick(host);
+            const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (!ticked)
+            {
+                error = host.GetError().empty() ? "Cancelled" : host.GetError();
+                break;
+            }
+            FsmScalingResult result;
+            result.threads = threads;
+            result.updatesPerSecond = static_cast<double>(host.GetInstanceCount()) * ticks / std::max(seconds, 1e-9);
+            result.speedup = results.empty() ? 1.0 : result.updatesPerSecond / results.front().updatesPerSecond;
+            for (const auto& stats : host.GetWorkerStats())
+                result.stolen += stats.stolen;
+            result.stolen -= warmupStolen;
+            results.push_back(result);
+        }
+        return results;
+    }
+}
@@ -0,0 +1,129 @@
+﻿#pragma once
+#include <atomic>
+#include <barrier>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "LuaSimulation.h"
+
+namespace LuaFsm
+{
+    /**
+     * \brief Work done by one worker thread of an FsmHost
+     */
+    struct FsmWorkerStats
+    {
+        //Shards ticked, and how many of them were taken from another worker
+        int64_t shards = 0;
+        int64_t stolen = 0;
+        //Instance updates
+        int64_t updates = 0;
+        //Seconds spent ticking shards, the rest of a TickAll the worker waited at the barrier
+        double busySeconds = 0.0;
+    };
+
+    /**
+     * \brief Ticks instances of an FSM on several threads
+     *
+     * Instances are split into shards, each a sandboxed lua state (LuaSimulation) holding a contiguous
+     * range of instances. An instance lives in one state for its whole life, so a state is the smallest unit
+     * of work a thread can take. Every worker owns shardsPerWorker shards and ticks them first, a worker that
+     * runs out takes the remaining shards of the others. With shardsPerWorker at 1 every worker ticks exactly
+     * one state, more shards per worker even out machines whose instances cost differently per tick.
+     * TickAll returns once every shard ticked, the workers meet the caller at a barrier before and after.
+     */
+    class FsmHost
+    {
+    public:
+        FsmHost() = default;
+        ~FsmHost();
+        FsmHost(const FsmHost&) = delete;
+        FsmHost& operator=(const FsmHost&) = delete;
+
+        //Creates the shards and starts the workers, false with the reason in GetError when a shard failed to load
+        bool Start(const SimulationCode& code, int instanceCount, int workerCount, int shardsPerWorker = 4);
+        void Stop();
+        [[nodiscard]] bool IsRunning() const { return !m_Workers.empty(); }
+
+        //Ticks every instance once and advances the timers of every shard by dt seconds,
+        //false with the reason in GetError when a script raised an error
+        bool TickAll(double dt);
+
+        [[nodiscard]] const std::string& GetError() const { return m_Error; }
+        [[nodiscard]] int GetWorkerCount() const { return static_cast<int>(m_Workers.size()); }
+        [[nodiscard]] int GetShardCount() const { return static_cast<int>(m_Shards.size()); }
+        [[nodiscard]] int GetInstanceCount() const { return m_InstanceCount; }
+        //Stats since Start, only read them between TickAll calls
+        [[nodiscard]] const std::vector<FsmWorkerStats>& GetWorkerStats() const { return m_Stats; }
+
+    private:
+        /**
+         * \brief Shards a worker owns, claimed one at a time by the owner and by thieves
+         */
+        struct ShardQueue
+        {
+            int begin = 0;
+            int end = 0;
+            std::atomic<int> next = 0;
+        };
+
+        void WorkerLoop(int worker);
+        void TickShards(int worker);
+        void Fail(const std::string& error);
+
+        std::vector<std::unique_ptr<LuaSimulation>> m_Shards;
+        std::unique_ptr<ShardQueue[]> m_Queues;
+        std::vector<FsmWorkerStats> m_Stats;
+        std::vector<std::thread> m_Workers;
+        std::unique_ptr<std::barrier<>> m_Barrier;
+        double m_Dt = 0.0;
+        bool m_Stopping = false;
+        std::atomic<bool> m_Failed = false;
+        std::mutex m_ErrorMutex;
+        std::string m_Error;
+        int m_InstanceCount = 0;
+    };
+
+    /**
+     * \brief Throughput of FsmHost with a number of worker threads
+     */
+    struct FsmScalingResult
+    {
+        int threads = 0;
+        double updatesPerSecond = 0.0;
+        //Throughput relative to one thread
+        double speedup = 0.0;
+        int64_t stolen = 0;
+    };
+
+    /**
+     * \brief Progress of an FsmScalingBenchmark running on another thread
+     */
+    struct FsmScalingProgress
+    {
+        //Ticks run so far and in total, warmup included
+        std::atomic<int> ticksDone = 0;
+        std::atomic<int> ticksTotal = 0;
+        //Set by the caller to stop after the tick in progress
+        std::atomic<bool> cancel = false;
+    };
+
+    /**
+     * \brief Measures how FsmHost scales from 1 thread up to maxThreads, doubling the threads every step
+     */
+    struct FsmScalingBenchmark
+    {
+        int instances = 100000;
+        int ticks = 100;
+        int warmupTicks = 10;
+        int maxThreads = 1;
+        int shardsPerWorker = 4;
+
+        //Results of every thread count, stops early with the reason in error when a host failed or it was cancelled
+        std::vector<FsmScalingResult> Run(const SimulationCode& code, std::string& error, FsmScalingProgress* progress = nullptr) const;
+    };
+}
@@ -0,0 +1,392 @@
+﻿#include "pch.h"
+#include "LuaSimulation.h"
+
+#include <cstdlib>
+
+extern "C" {
+#include "lua.h"
+#include "lualib.h"
+#include "lauxlib.h"
+}
+
+#include <spdlog/fmt/bundled/format.h>
+
+#include "data/FSM.h"
+#include "IO/FileReader.h"
+#include "IO/RuntimeExporter.h"
+
+namespace LuaFsm
+{
+    namespace
+    {
+        //Creates the instances and returns the functions the simulation calls,
+        //ticking in lua so a run costs one call from C++ however many instances there are
+        constexpr const char* driverCode = R"(
+local fsm, inputs, instanceCount, firstIndex = ...
+fsm:activate()
+local instances = {}
+for i = 1, instanceCount do
+    instances[i] = fsm:newInstance({})
+end
+local tick = 0
+local indexOffset = firstIndex - 1
+
+local function run(ticks, seconds)
+    for _ = 1, ticks do
+        tick = tick + 1
+        for i = 1, instanceCount do
+            local instance = instances[i]
+            inputs(instance, instance.context, tick, i + indexOffset)
+            instance:onUpdate()
+        end
+        FSM_TIMERS:update(seconds)
+    end
+end
+
+local function stateOf(i)
+    local instance = instances[i]
+    local state = instance and instance.currentState
+    return state and state.id or nil
+end
+
+local function stateCounts()
+    local counts = {}
+    for i = 1, instanceCount do
+        local state = instances[i].currentState
+        if state then
+            counts[state.id] = (counts[state.id] or 0) + 1
+        end
+    end
+    return counts
+end
+
+return run, stateOf, stateCounts
+)";
+
+        //Instructions between checks of the time limit
+        constexpr int hookInstructions = 100000;
+    }
+
+    const char* LuaSimulation::defaultInputScript = R"(--Runs before every update of an instance with: instance, context, tick, index
+--Dispatch events or set the context fields your conditions read, for example:
+--if tick % 120 == 0 then instance:dispatch("alarm") end
+--context.health = 100 - tick % 100
+)";
+
+    bool SimulationCode::Read(const Fsm& fsm, const std::string& inputs, SimulationCode& code, std::string& error)
+    {
+        if (fsm.GetLinkedFile().empty())
+        {
+            error = "The FSM has no linked file, save it to a file first";
+            return false;
+        }
+        code.runtime = FileReader::ReadAllText(RuntimeExporter::RuntimePath);
+        if (code.runtime.empty())
+        {
+            error = fmt::format("Runtime not found at: {}", RuntimeExporter::RuntimePath);
+            return false;
+        }
+        code.fsm = fsm.GetLinkedFileCode();
+        if (code.fsm.empty())
+        {
+            error = fmt::format("Could not read {}", fsm.GetLinkedFile());
+            return false;
+        }
+        code.fsmFile = fsm.GetLinkedFile();
+        code.fsmId = fsm.GetId();
+        code.inputs = inputs;
+        return true;
+    }
+
+    LuaSimulation::~LuaSimulation()
+    {
+        Stop();
+    }
+
+    bool LuaSimulation::Start(const SimulationCode& code, const int instanceCount, const bool profile, const int firstIndex)
+    {
+        Stop();
+        m_Error.clear();
+        m_Output.clear();
+        m_FsmId = code.fsmId;
+        m_InstanceCount = std::max(1, instanceCount);
+        m_Profile = profile;
+        m_Tick = 0;
+        m_RunTicks = 0;
+        m_RunSeconds = 0.0;
+
+        m_State = lua_newstate(Allocate, this);
+        if (!m_State)
+        {
+            m_Error = "Could not create a lua state";
+            return false;
+        }
+        m_StartTime = std::chrono::steady_clock::now();
+        m_Deadline = m_StartTime + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(timeLimit));
+        lua_sethook(m_State, TimeLimitHook, LUA_MASKCOUNT, hookInstructions);
+        OpenSandboxLibraries();
+
+        if (!Load(code.runtime, fmt::format("@{}", RuntimeExporter::RuntimePath)) || !Call(0, 0)
+            || !Load(code.fsm, "@" + code.fsmFile) || !Call(0, 0))
+        {
+            Stop();
+            return false;
+        }
+        if (profile)
+        {
+            lua_getglobal(m_State, "FSM_PROFILER");
+            lua_pushcfunction(m_State, Clock);
+            lua_setfield(m_State, -2, "clock");
+            lua_getfield(m_State, -1, "start");
+            lua_insert(m_State, -2);
+            if (!Call(1, 0))
+            {
+                Stop();
+                return false;
+            }
+        }
+
+        //Driver arguments: the FSM table, the compiled input script, the instance count and the first index
+        if (!Load(driverCode, "=simulation"))
+        {
+            Stop();
+            return false;
+        }
+        if (lua_getglobal(m_State, m_FsmId.c_str()) != LUA_TTABLE)
+        {
+            m_Error = fmt::format("{} does not define the FSM {}", code.fsmFile, m_FsmId);
+            Stop();
+            return false;
+        }
+        //Kept on the first line so errors report the line numbers of the script
+        if (!Load("local instance, context, tick, index = ... " + code.inputs, "=inputs"))
+        {
+            Stop();
+            return false;
+        }
+        lua_pushinteger(m_State, m_InstanceCount);
+        lua_pushinteger(m_State, firstIndex);
+        if (!Call(4, 3))
+        {
+            Stop();
+            return false;
+        }
+        m_StateCountsRef = luaL_ref(m_State, LUA_REGISTRYINDEX);
+        m_StateOfRef = luaL_ref(m_State, LUA_REGISTRYINDEX);
+        m_RunRef = luaL_ref(m_State, LUA_REGISTRYINDEX);
+        return true;
+    }
+
+    void LuaSimulation::Stop()
+    {
+        if (!m_State)
+            return;
+        lua_close(m_State);
+        m_State = nullptr;
+        m_Memory = 0;
+    }
+
+    bool LuaSimulation::Run(const int ticks, const double seconds)
+    {
+        if (!m_State || ticks <= 0)
+            return false;
+        lua_rawgeti(m_State, LUA_REGISTRYINDEX, m_RunRef);
+        lua_pushinteger(m_State, ticks);
+        lua_pushnumber(m_State, seconds);
+        const auto start = std::chrono::steady_clock::now();
+        m_Deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(timeLimit));
+        const bool ran = Call(2, 0);
+        m_RunSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (!ran)
+            return false;
+        m_Tick += ticks;
+        m_RunTicks += ticks;
+        return true;
+    }
+
+    double LuaSimulation::GetTicksPerSecond() const
+    {
+        if (m_RunSeconds <= 0.0)
+            return 0.0;
+        return static_cast<double>(m_RunTicks) / m_RunSeconds;
+    }
+
+    std::string LuaSimulation::GetCurrentState(const int instance)
+    {
+        if (!m_State)
+            return "";
+        lua_rawgeti(m_State, LUA_REGISTRYINDEX, m_StateOfRef);
+        lua_pushinteger(m_State, instance);
+        if (!Call(1, 1))
+            return "";
+        std::string id;
+        if (lua_type(m_State, -1) == LUA_TSTRING)
+            id = lua_tostring(m_State, -1);
+        lua_pop(m_State, 1);
+        return id;
+    }
+
+    std::unordered_map<std::string, int> LuaSimulation::GetStateCounts()
+    {
+        std::unordered_map<std::string, int> counts;
+        if (!m_State)
+            return counts;
+        lua_rawgeti(m_State, LUA_REGISTRYINDEX, m_StateCountsRef);
+        if (!Call(0, 1))
+            return counts;
+        lua_pushnil(m_State);
+        while (lua_next(m_State, -2) != 0)
+        {
+            if (lua_type(m_State, -2) == LUA_TSTRING)
+                counts[lua_tostring(m_State, -2)] = static_cast<int>(lua_tointeger(m_State, -1));
+            lua_pop(m_State, 1);
+        }
+        lua_pop(m_State, 1);
+        return counts;
+    }
+
+    bool LuaSimulation::GetProfile(FsmProfile& profile)
+    {
+        if (!m_State || !m_Profile)
+            return false;
+        lua_getglobal(m_State, "FSM_PROFILER");
+        lua_getfield(m_State, -1, "format");
+        lua_insert(m_State, -2);
+        if (!Call(1, 1))
+            return false;
+        size_t length = 0;
+        const char* text = lua_tolstring(m_State, -1, &length);
+        const bool parsed = text && FsmProfile::Parse({text, length}, m_FsmId, profile);
+        lua_pop(m_State, 1);
+        return parsed;
+    }
+
+    bool LuaSimulation::Load(const std::string& code, const std::string& chunkName)
+    {
+        //Text only, precompiled chunks can crash the state
+        if (luaL_loadbufferx(m_State, code.data(), code.size(), chunkName.c_str(), "t") == LUA_OK)
+            return true;
+        const char* message = lua_tostring(m_State, -1);
+        m_Error = message ? message : "Unknown error loading " + chunkName;
+        lua_pop(m_State, 1);
+        return false;
+    }
+
+    bool LuaSimulation::Call(const int arguments, const int results)
+    {
+        const int handler = lua_gettop(m_State) - arguments;
+        lua_pushcfunction(m_State, Traceback);
+        lua_insert(m_State, handler);
+        const int status = lua_pcall(m_State, arguments, results, handler);
+        lua_remove(m_State, handler);
+        if (status == LUA_OK)
+            return true;
+        const char* message = lua_tostring(m_State, -1);
+        m_Error = message ? message : "Unknown lua error";
+        lua_pop(m_State, 1);
+        return false;
+    }
+
+    void LuaSimulation::OpenSandboxLibraries()
+    {
+        static constexpr luaL_Reg libraries[] = {
+            {LUA_GNAME, luaopen_base},
+            {LUA_COLIBNAME, luaopen_coroutine},
+            {LUA_TABLIBNAME, luaopen_table},
+            {LUA_STRLIBNAME, luaopen_string},
+            {LUA_MATHLIBNAME, luaopen_math},
+            {LUA_UTF8LIBNAME, luaopen_utf8},
+            {LUA_OSLIBNAME, luaopen_os},
+        };
+        for (const auto& [name, open] : libraries)
+        {
+            luaL_requiref(m_State, name, open, 1);
+            lua_pop(m_State, 1);
+        }
+        for (const auto name : {"dofile", "loadfile", "load", "require"})
+        {
+            lua_pushnil(m_State);
+            lua_setglobal(m_State, name);
+        }
+        lua_pushcfunction(m_State, Print);
+        lua_setglobal(m_State, "print");
+
+        //os keeps only the functions without side effects outside the state
+        lua_getglobal(m_State, LUA_OSLIBNAME);
+        lua_createtable(m_State, 0, 4);
+        for (const auto name : {"clock", "time", "date", "difftime"})
+        {
+            lua_getfield(m_State, -2, name);
+            lua_setfield(m_State, -2, name);
+        }
+        lua_setglobal(m_State, LUA_OSLIBNAME);
+        lua_pop(m_State, 1);
+    }
+
+    LuaSimulation* LuaSimulation::FromState(lua_State* state)
+    {
+        void* simulation = nullptr;
+        lua_getallocf(state, &simulation);
+        return static_cast<LuaSimulation*>(simulation);
+    }
+
+    void* LuaSimulation::Allocate(void* userData, void* pointer, size_t oldSize, const size_t newSize)
+    {
+        const auto simulation = static_cast<LuaSimulation*>(userData);
+        //Without a block oldSize holds the type of the new object
+        if (!pointer)
+            oldSize = 0;
+        if (newSize == 0)
+        {
+            std::free(pointer);
+            simulation->m_Memory -= oldSize;
+            return nullptr;
+        }
+        if (newSize > oldSize && simulation->m_Memory - oldSize + newSize > memoryLimit)
+            return nullptr;
+        void* block = std::realloc(pointer, newSize);
+        if (block)
+            simulation->m_Memory = simulation->m_Memory - oldSize + newSize;
+        return block;
+    }
+
+    void LuaSimulation::TimeLimitHook(lua_State* state, lua_Debug*)
+    {
+        if (std::chrono::steady_clock::now() > FromState(state)->m_Deadline)
+            luaL_error(state, "Stopped after running for more than %d seconds", static_cast<int>(timeLimit));
+    }
+
+    int LuaSimulation::Print(lua_State* state)
+    {
+        const auto simulation = FromState(state);
+        std::string line;
+        const int count = lua_gettop(state);
+        for (int i = 1; i <= count; ++i)
+        {
+            if (i > 1)
+                line += '\t';
+            size_t length = 0;
+            const char* text = luaL_tolstring(state, i, &length);
+            line.append(text, length);
+            lua_pop(state, 1);
+        }
+        simulation->m_Output.push_back(std::move(line));
+        if (simulation->m_Output.size() > outputLines)
+            simulation->m_Output.pop_front();
+        return 0;
+    }
+
+    int LuaSimulation::Clock(lua_State* state)
+    {
+        const auto elapsed = std::chrono::steady_clock::now() - FromState(state)->m_StartTime;
+        lua_pushnumber(state, std::chrono::duration<double>(elapsed).count());
+        return 1;
+    }
+
+    int LuaSimulation::Traceback(lua_State* state)
+    {
+        const char* message = lua_tostring(state, 1);
+        luaL_traceback(state, state, message ? message : "(error object is not a string)", 1);
+        return 1;
+    }
+}
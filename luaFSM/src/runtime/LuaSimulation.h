@@ -0,0 +1,119 @@
+﻿#pragma once
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <unordered_map>
+
+#include "IO/FsmProfile.h"
+
+struct lua_State;
+struct lua_Debug;
+
+namespace LuaFsm
+{
+    class Fsm;
+
+    /**
+     * \brief Lua sources a simulation runs
+     */
+    struct SimulationCode
+    {
+        //assets/FSM.lua
+        std::string runtime;
+        //File linked to the FSM and its path, for error messages
+        std::string fsm;
+        std::string fsmFile;
+        std::string fsmId;
+        //Script run before every update of an instance
+        std::string inputs;
+
+        //Reads FSM.lua and the linked file of the FSM, false with the reason in error
+        static bool Read(const Fsm& fsm, const std::string& inputs, SimulationCode& code, std::string& error);
+    };
+
+    /**
+     * \brief Runs an FSM headless in a sandboxed lua 5.4 state inside the editor
+     *
+     * Loads assets/FSM.lua and the file linked to the FSM, activates it and ticks a number of its instances.
+     * Before every update of an instance the input script runs with (instance, context, tick, index),
+     * to dispatch events or set the context fields the conditions read.
+     * The state only has the base, coroutine, table, string, math and utf8 libraries and os.clock, time and date.
+     * There is no io, package or debug library and no loading of files or bytecode, and a memory limit and
+     * a time limit per run stop runaway scripts.
+     */
+    class LuaSimulation
+    {
+    public:
+        LuaSimulation() = default;
+        ~LuaSimulation();
+        LuaSimulation(const LuaSimulation&) = delete;
+        LuaSimulation& operator=(const LuaSimulation&) = delete;
+
+        //Creates the state and the instances, false with the reason in GetError when anything failed to load.
+        //The input script sees the instances numbered from firstIndex
+        bool Start(const SimulationCode& code, int instanceCount, bool profile, int firstIndex = 1);
+        void Stop();
+        [[nodiscard]] bool IsRunning() const { return m_State != nullptr; }
+
+        //Runs ticks on every instance, advancing FSM_TIMERS by seconds per tick.
+        //False with the reason in GetError when a script raised an error
+        bool Run(int ticks, double seconds = tickSeconds);
+
+        [[nodiscard]] const std::string& GetError() const { return m_Error; }
+        [[nodiscard]] const std::string& GetFsmId() const { return m_FsmId; }
+        [[nodiscard]] int GetInstanceCount() const { return m_InstanceCount; }
+        [[nodiscard]] int64_t GetTick() const { return m_Tick; }
+        //Ticks per second of the time spent in Run since Start
+        [[nodiscard]] double GetTicksPerSecond() const;
+        //Instance updates per second of the time spent in Run since Start
+        [[nodiscard]] double GetUpdatesPerSecond() const { return GetTicksPerSecond() * m_InstanceCount; }
+        //Kilobytes used by the lua state
+        [[nodiscard]] double GetMemory() const { return static_cast<double>(m_Memory) / 1024.0; }
+
+        //Id of the current state of an instance, counted from 1, empty when it has none
+        [[nodiscard]] std::string GetCurrentState(int instance);
+        //Number of instances in each state
+        [[nodiscard]] std::unordered_map<std::string, int> GetStateCounts();
+        //Timings recorded by FSM_PROFILER so far, false when profiling is off
+        bool GetProfile(FsmProfile& profile);
+        //Lines printed by the scripts, oldest first
+        [[nodiscard]] const std::deque<std::string>& GetOutput() const { return m_Output; }
+
+        //Seconds FSM_TIMERS advance by per tick
+        static constexpr double tickSeconds = 1.0 / 60.0;
+        static constexpr size_t memoryLimit = 256ull * 1024 * 1024;
+        static constexpr double timeLimit = 5.0;
+        static constexpr size_t outputLines = 200;
+        //Default input script of the simulation panel
+        static const char* defaultInputScript;
+
+    private:
+        bool Load(const std::string& code, const std::string& chunkName);
+        bool Call(int arguments, int results);
+        void OpenSandboxLibraries();
+        static LuaSimulation* FromState(lua_State* state);
+        static void* Allocate(void* userData, void* pointer, size_t oldSize, size_t newSize);
+        static void TimeLimitHook(lua_State* state, lua_Debug* debug);
+        static int Print(lua_State* state);
+        static int Clock(lua_State* state);
+        static int Traceback(lua_State* state);
+
+        lua_State* m_State = nullptr;
+        std::string m_FsmId;
+        std::string m_Error;
+        int m_InstanceCount = 0;
+        int64_t m_Tick = 0;
+        bool m_Profile = false;
+        size_t m_Memory = 0;
+        //Registry references of the driver functions
+        int m_RunRef = 0;
+        int m_StateOfRef = 0;
+        int m_StateCountsRef = 0;
+        double m_RunSeconds = 0.0;
+        int64_t m_RunTicks = 0;
+        std::chrono::steady_clock::time_point m_StartTime;
+        std::chrono::steady_clock::time_point m_Deadline;
+        std::deque<std::string> m_Output;
+    };
+}
@@ -15,10 +15,12 @@ IncludeDir["imgui"] = "3rd/imgui"
 IncludeDir["glfw"] = "3rd/glfw/include"
 IncludeDir["glad"] = "3rd/glad/include"
 IncludeDir["imguifiledialog"] = "3rd/ImGuiFileDialog"
+IncludeDir["lua"] = "3rd/lua"
 
 include "3rd/imgui_premake.lua"
 include "3rd/glfw_premake.lua"
 include "3rd/glad_premake.lua"
+include "3rd/lua_premake.lua"
 
 project "luaFSM"
     location "luaFSM"
@@ -50,6 +52,7 @@ project "luaFSM"
         "%{IncludeDir.glad}",
         "%{IncludeDir.imguifiledialog}",
         "%{IncludeDir.glfw}",
+        "%{IncludeDir.lua}",
     }
 
     links
@@ -57,6 +60,7 @@ project "luaFSM"
         "imgui",
         "GLFW",
         "glad",
+        "lua",
     }
 
     postbuildcommands